@@ -0,0 +1,86 @@
+// Detector throughput on the CPU interpreter at several batch sizes, frames going through
+// detectBatch the way a batched pipeline hands them over
+
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "BenchUtil.h"
+#include "Detector.h"
+#include "VideoSource.h"
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{video v                 | ../res/face_test.mp4 | Clip to replay, looped as needed}"
+        "{model_path m            | ../res/detect.tflite | Path to a CPU model}"
+        "{labels_path l           | ../res/labels.txt | Path to the labels}"
+        "{confidence_threshold c  | 0.5        | Filter out detections of score < confidence_threshold}"
+        "{threads                 | 3          | CPU interpreter threads}"
+        "{xnnpack                 | 1          | XNNPACK delegate on the CPU interpreter [1]}"
+        "{batches b               | 1,2,4,8    | Batch sizes to compare}"
+        "{frames n                | 240        | Frames per batch size}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    int frames = parser.get<int>("frames");
+    std::vector<int> batches;
+    std::stringstream list(parser.get<std::string>("batches"));
+    for (std::string item; std::getline(list, item, ',');) batches.push_back(std::stoi(item));
+
+    std::string report = cv::format("{\n  \"frames\": %d,\n  \"threads\": %d,\n  \"batches\": {\n", frames, parser.get<int>("threads"));
+    try {
+        // Decoded up front so only the detector is timed
+        std::vector<cv::Mat> clip(frames);
+        {
+            FileVideoSource source(parser.get<std::string>("video"), 0, Pacing::None, true);
+            for (cv::Mat& frame : clip) source.getFrame(frame);
+        }
+
+        double singleFps = 0;
+        for (size_t b = 0; b < batches.size(); b++) {
+            TfliteCpuConfig cpu;
+            cpu.threads = parser.get<int>("threads");
+            cpu.xnnpack = parser.get<int>("xnnpack");
+            cpu.maxBatch = batches[b];
+            TfliteDetector detector(parser.get<std::string>("model_path"), parser.get<std::string>("labels_path"), parser.get<float>("confidence_threshold"), false,
+                                    true, false, cpu);
+            detector.warmUp(clip[0].size());
+
+            // Whole batches only, so every call runs at the size being measured
+            int batch = std::max(1, std::min(batches[b], detector.maxBatch()));
+            std::vector<Detections> detections(batch);
+            LatencySamples perBatch;
+            int done = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (; done + batch <= frames; done += batch) {
+                auto call = std::chrono::steady_clock::now();
+                detector.detectBatch(&clip[done], batch, detections.data());
+                perBatch.add(elapsedMs(call));
+            }
+            double fps = done / (elapsedMs(start) / 1000);
+            if (b == 0) singleFps = fps;
+
+            fprintf(stderr, "batch %d%s: %.1f frames/s (%.2fx), %.2f ms per call mean / %.2f ms p99\n", batches[b],
+                            batch < batches[b] ? " (model can't batch, ran 1)" : "", fps, fps / singleFps, perBatch.mean(), perBatch.percentile(99));
+            report += cv::format("    \"%d\": {\"effective_batch\": %d, \"frames_per_second\": %.2f, \"speedup\": %.3f, \"call_ms_mean\": %.3f, \"call_ms_p99\": %.3f}%s\n",
+                                 batches[b], batch, fps, fps / singleFps, perBatch.mean(), perBatch.percentile(99), b + 1 < batches.size() ? "," : "");
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+    report += "  }\n}\n";
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
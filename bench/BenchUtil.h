@@ -0,0 +1,144 @@
+#pragma once
+
+// Small helpers shared by the bench/ tools
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// Latency samples for one stage, kept exactly so percentiles aren't bucket approximations
+class LatencySamples {
+public:
+
+    void add(double ms) {
+        _ms.push_back(ms);
+        _sorted = false;
+    }
+
+    size_t count() const { return _ms.size(); }
+
+    double mean() const {
+        double sum = 0;
+        for (double ms : _ms) sum += ms;
+        return _ms.empty() ? 0 : sum / _ms.size();
+    }
+
+    double percentile(double p) {
+        if (_ms.empty()) return 0;
+        sort();
+        size_t i = (size_t)std::ceil(p / 100.0 * _ms.size());
+        return _ms[std::min(_ms.size() - 1, i > 0 ? i - 1 : 0)];
+    }
+
+    double max() {
+        if (_ms.empty()) return 0;
+        sort();
+        return _ms.back();
+    }
+
+    // Stats plus a log2 histogram with bucket upper bounds in microseconds
+    std::string json() {
+        std::vector<int> buckets;
+        for (double ms : _ms) {
+            double us = std::max(1.0, ms * 1000);
+            size_t bucket = (size_t)std::ceil(std::log2(us));
+            if (bucket >= buckets.size()) buckets.resize(bucket + 1, 0);
+            buckets[bucket]++;
+        }
+        std::string histogram;
+        for (size_t i = 0; i < buckets.size(); i++) {
+            if (!buckets[i]) continue;
+            if (!histogram.empty()) histogram += ", ";
+            histogram += cv::format("\"%llu\": %d", 1ULL << i, buckets[i]);
+        }
+        return cv::format("{\"count\": %zu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, \"histogram_us\": {%s}}",
+                          count(), mean(), percentile(50), percentile(90), percentile(99), max(), histogram.c_str());
+    }
+
+private:
+
+    void sort() {
+        if (!_sorted) std::sort(_ms.begin(), _ms.end());
+        _sorted = true;
+    }
+
+    std::vector<double> _ms;
+    bool _sorted = true;
+
+};
+
+inline double elapsedMs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Where a tool's JSON report goes, a file or - for stdout. Made as soon as the options are
+// parsed: for stdout, everything printed from then on for people (the tool's summary, and the
+// library's model and video messages) is sent to stderr, so the report is all stdout carries
+class ReportWriter {
+public:
+
+    explicit ReportWriter(std::string path) : _path(std::move(path)) {
+        if (_path != "-") return;
+        std::cout.flush();
+        fflush(stdout);
+        _stdout = dup(STDOUT_FILENO);
+        if (_stdout >= 0) dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
+    ~ReportWriter() {
+        if (_stdout < 0) return;
+        std::cout.flush();
+        fflush(stdout);
+        dup2(_stdout, STDOUT_FILENO);
+        close(_stdout);
+    }
+
+    ReportWriter(const ReportWriter&) = delete;
+    ReportWriter& operator=(const ReportWriter&) = delete;
+
+    // Returns false, having said why on stderr, if the report couldn't be written
+    bool write(const std::string& report) {
+        if (_path != "-") {
+            FILE* f = fopen(_path.c_str(), "w");
+            bool ok = f && fputs(report.c_str(), f) >= 0;
+            if (f && fclose(f) != 0) ok = false;
+            if (!ok) std::cerr << "Error - Could not write " << _path << ": " << strerror(errno) << std::endl;
+            return ok;
+        }
+        std::cout.flush();
+        fflush(stdout);
+        int fd = _stdout >= 0 ? _stdout : STDOUT_FILENO;
+        for (size_t done = 0; done < report.size();) {
+            ssize_t n = ::write(fd, report.data() + done, report.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "Error - Could not write the report: " << strerror(errno) << std::endl;
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+private:
+
+    std::string _path;
+    int _stdout = -1;  // the real stdout, while stdout points at stderr
+
+};
+
+inline long peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
@@ -0,0 +1,121 @@
+// Times the event log from both ends: what record() costs the thread handing it results, at a
+// steady frame rate, and how fast the segments scan back afterwards. The log is written to a
+// scratch directory, which is left behind when --keep is given
+
+#include <iostream>
+#include <stdio.h>
+#include <thread>
+
+#include <opencv2/core.hpp>
+
+#include "BenchUtil.h"
+#include "EventLog.h"
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{dir                     | /tmp/eventLogBench | Scratch directory for the log, emptied first}"
+        "{frames n                | 20000      | Frames to record}"
+        "{rate                    | 2000       | Frames a second handed to record(), 0 for as fast as possible}"
+        "{faces                   | 3          | Detections per frame}"
+        "{segment_kb              | 4096       | Segment size}"
+        "{queue_depth             | 256        | Frames the ring holds}"
+        "{keep                    | 0          | Leave the log behind [1]}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    std::string dir = parser.get<std::string>("dir");
+    int frames = parser.get<int>("frames");
+    int rate = parser.get<int>("rate");
+    int faces = std::min(parser.get<int>("faces"), kMaxDetections);
+    EventLogConfig config;
+    config.segmentBytes = (size_t)parser.get<int>("segment_kb") << 10;
+    config.queueDepth = parser.get<int>("queue_depth");
+
+    try {
+        for (const std::string& path : EventLog::segments(dir)) remove(path.c_str());
+    } catch (std::runtime_error&) {
+        // Not there yet; the log creates it
+    }
+
+    // A handful of names, as a small vault hands out
+    static const char* names[] = {"alice", "bob", "carol", "dave", nullptr};
+    LatencySamples recordMs;
+    uint64_t logged, dropped;
+    double writeSeconds;
+    {
+        EventLog log(dir, config);
+        log.start();
+        FrameResult result;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            if (rate > 0) std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t)i * 1000000 / rate));
+            result.index = i;
+            result.detected = i % 3 == 0;
+            result.captureTime = std::chrono::steady_clock::now();
+            result.detections.clear();
+            for (int k = 0; k < faces; k++) {
+                Detection d;
+                d.x1 = 40.0f * k;
+                d.y1 = 20;
+                d.x2 = d.x1 + 96;
+                d.y2 = 140;
+                d.score = 0.9f;
+                d.label = "face";
+                d.trackId = i / 30 + k;
+                d.name = names[(i / 30 + k) % 5];
+                d.matchScore = 0.6f;
+                result.detections.push_back(d);
+            }
+            auto before = std::chrono::steady_clock::now();
+            log.record(result);
+            recordMs.add(elapsedMs(before));
+        }
+        log.stop();
+        writeSeconds = elapsedMs(start) / 1000;
+        logged = log.logged();
+        dropped = log.dropped();
+    }
+
+    // The scan nameVaultLog does, without formatting the output
+    std::vector<std::string> segments = EventLog::segments(dir);
+    uint64_t scanned = 0, detections = 0, bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& path : segments) {
+        EventSegment segment(path);
+        const EventRecord* frame;
+        while (segment.next(frame)) {
+            const LoggedDetection* d = segment.detections(frame);
+            for (uint16_t i = 0; i < frame->count; i++) detections += segment.text(d[i].name)[0] != '\0';
+            scanned++;
+        }
+        bytes += segment.header().headerBytes + segment.header().used;
+    }
+    double scanSeconds = elapsedMs(start) / 1000;
+    if (!parser.get<int>("keep")) {
+        for (const std::string& path : segments) remove(path.c_str());
+    }
+
+    fprintf(stderr, "record(): %.2f us mean, %.2f us p99, %.2f us max; %llu logged, %llu dropped over %.1f s\n",
+                    recordMs.mean() * 1000, recordMs.percentile(99) * 1000, recordMs.max() * 1000,
+                    (unsigned long long)logged, (unsigned long long)dropped, writeSeconds);
+    fprintf(stderr, "%zu segments, %.1f bytes a frame; scanned %llu frames at %.0f frames/s, %.1f MB/s\n", segments.size(),
+                    logged ? (double)bytes / logged : 0.0, (unsigned long long)scanned, scanned / scanSeconds, bytes / scanSeconds / 1e6);
+
+    std::string report = cv::format("{\n  \"frames\": %d,\n  \"rate\": %d,\n  \"faces\": %d,\n  \"record\": %s,\n"
+                                    "  \"logged\": %llu,\n  \"dropped\": %llu,\n  \"segments\": %zu,\n  \"bytes_per_frame\": %.1f,\n"
+                                    "  \"scan_frames_per_second\": %.0f,\n  \"scan_mb_per_second\": %.1f,\n  \"named_detections\": %llu\n}\n",
+                                    frames, rate, faces, recordMs.json().c_str(), (unsigned long long)logged, (unsigned long long)dropped,
+                                    segments.size(), logged ? (double)bytes / logged : 0.0, scanned / scanSeconds, bytes / scanSeconds / 1e6,
+                                    (unsigned long long)detections);
+
+    if (!writer.write(report)) return 1;
+
+    return scanned == logged ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+// Exact and IVF gallery search latency and recall at 1k, 10k and 100k identities
+
+#include <iostream>
+#include <random>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <opencv2/core.hpp>
+
+#include "BenchUtil.h"
+#include "Matcher.h"
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{format                  | int8       | Vault format: int8 or fp16}"
+        "{queries q               | 500        | Queries per gallery size}"
+        "{threads t               | 4          | Threads for the exact search}"
+        "{probe p                 | 8          | IVF lists scanned per query}"
+        "{noise                   | 0.05       | Per-dimension noise on a query, relative to an enrolled embedding}"
+        "{scratch                 | /tmp/matchBench.vault | Where to build the synthetic vaults}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    VaultFormat format = parser.get<std::string>("format") == "fp16" ? VaultFormat::Fp16 : VaultFormat::Int8;
+    int queries = parser.get<int>("queries");
+    float noise = parser.get<float>("noise");
+    std::string scratch = parser.get<std::string>("scratch");
+    const int k = 10;
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> gaussian;
+
+    std::string report = cv::format("{\n  \"format\": \"%s\",\n  \"queries\": %d,\n  \"k\": %d,\n  \"galleries\": {\n", parser.get<std::string>("format").c_str(), queries, k);
+    const size_t sizes[] = {1000, 10000, 100000};
+    try {
+        for (int s = 0; s < 3; s++) {
+            size_t rows = sizes[s];
+            std::vector<float> embeddings(rows * kEmbeddingSize);
+            for (float& v : embeddings) v = gaussian(rng);
+            std::vector<std::string> names(rows);
+            for (size_t i = 0; i < rows; i++) names[i] = "id" + std::to_string(i);
+            NameVault::create(scratch, format, rows);
+            {
+                NameVault writer(scratch, true);
+                writer.append(names.data(), embeddings.data(), rows);
+            }
+            NameVault vault(scratch);
+
+            // Queries are noisy copies of enrolled faces, like a new frame of someone known
+            std::vector<float> query(queries * kEmbeddingSize);
+            for (int q = 0; q < queries; q++) {
+                size_t row = rng() % rows;
+                float norm = 0;
+                for (int d = 0; d < kEmbeddingSize; d++) {
+                    float v = embeddings[row * kEmbeddingSize + d] + noise * gaussian(rng) * 10;
+                    query[q * kEmbeddingSize + d] = v;
+                    norm += v * v;
+                }
+                for (int d = 0; d < kEmbeddingSize; d++) query[q * kEmbeddingSize + d] /= std::sqrt(norm);
+            }
+
+            MatcherConfig single;
+            single.ivfMinRows = SIZE_MAX;
+            MatcherConfig threaded = single;
+            threaded.threads = parser.get<int>("threads");
+            threaded.minRowsPerThread = 1024;
+            MatcherConfig ivf;
+            ivf.ivfMinRows = 0;
+            ivf.ivfProbe = parser.get<int>("probe");
+
+            Matcher exact(vault, single);
+            Matcher sharded(vault, threaded);
+            auto buildStart = std::chrono::steady_clock::now();
+            Matcher approx(vault, ivf);
+            double buildMs = elapsedMs(buildStart);
+
+            LatencySamples exactMs, shardedMs, approxMs;
+            std::vector<Match> truth, found;
+            int top1 = 0, topK = 0;
+            for (int q = 0; q < queries; q++) {
+                const float* v = &query[q * kEmbeddingSize];
+                auto t0 = std::chrono::steady_clock::now();
+                exact.searchExact(v, k, truth);
+                auto t1 = std::chrono::steady_clock::now();
+                sharded.searchExact(v, k, found);
+                auto t2 = std::chrono::steady_clock::now();
+                approx.searchApprox(v, k, found);
+                auto t3 = std::chrono::steady_clock::now();
+                exactMs.add(elapsedMs(t0, t1));
+                shardedMs.add(elapsedMs(t1, t2));
+                approxMs.add(elapsedMs(t2, t3));
+
+                // Recall of the approximate search against the exact one
+                if (!found.empty() && found[0].row == truth[0].row) top1++;
+                for (const Match& t : truth) {
+                    for (const Match& f : found) {
+                        if (f.row == t.row) {
+                            topK++;
+                            break;
+                        }
+                    }
+                }
+            }
+            double recall1 = (double)top1 / queries;
+            double recallK = (double)topK / (queries * (double)truth.size());
+
+            fprintf(stderr, "%6zu ids: exact %.3f ms, %d threads %.3f ms, ivf %.3f ms (recall@1 %.3f, recall@%d %.3f)\n",
+                            rows, exactMs.mean(), threaded.threads, shardedMs.mean(), approxMs.mean(), recall1, k, recallK);
+            report += cv::format("    \"%zu\": {\n", rows);
+            report += "      \"exact\": " + exactMs.json() + ",\n";
+            report += "      \"exact_threaded\": " + shardedMs.json() + ",\n";
+            report += "      \"ivf\": " + approxMs.json() + ",\n";
+            report += cv::format("      \"ivf_build_ms\": %.1f,\n      \"recall_at_1\": %.4f,\n      \"recall_at_%d\": %.4f\n    }%s\n",
+                                 buildMs, recall1, k, recallK, s < 2 ? "," : "");
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+    report += "  }\n}\n";
+    unlink(scratch.c_str());
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
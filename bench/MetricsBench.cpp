@@ -0,0 +1,113 @@
+// What the always-on metrics cost the threads that record them: Counter::add, Gauge::set and
+// a ScopedTimer into a Histogram, each timed in a tight loop on several threads at once. The
+// per-frame cost is a frame's worth of each (the pipeline records about 10 timers, 12 counter
+// bumps and 6 gauge sets a frame) against the frame budget; the exit code is 1 past max_percent
+
+#include <atomic>
+#include <iostream>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "BenchUtil.h"
+#include "Metrics.h"
+
+static Counter benchCounter("namevault_bench_counter_total", "Bumped by metricsBench");
+static Gauge benchGauge("namevault_bench_gauge", "Set by metricsBench");
+static Histogram benchHistogram("namevault_bench_seconds", "Observed by metricsBench");
+
+struct OpCosts {
+    double counterNs = 0;
+    double gaugeNs = 0;
+    double timerNs = 0;
+};
+
+// Nanoseconds per call, the loop's own overhead included
+template <typename F>
+static double timeNs(int iterations, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) f(i);
+    return elapsedMs(start) * 1e6 / iterations;
+}
+
+static OpCosts measure(int iterations) {
+    // The first call on a thread allocates its shard; that's once per thread, not per frame
+    benchCounter.add();
+    { ScopedTimer timer(benchHistogram); }
+
+    OpCosts costs;
+    costs.counterNs = timeNs(iterations, [](int) { benchCounter.add(); });
+    costs.gaugeNs = timeNs(iterations, [](int i) { benchGauge.set(i); });
+    costs.timerNs = timeNs(iterations, [](int) { ScopedTimer timer(benchHistogram); });
+    return costs;
+}
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{iterations n            | 10000000   | Calls timed per operation and thread}"
+        "{threads                 | 4          | Threads recording at once, as the pipeline's stages do}"
+        "{timers                  | 10         | Scoped timers a frame}"
+        "{counters                | 12         | Counter bumps a frame}"
+        "{gauges                  | 6          | Gauge sets a frame}"
+        "{frame_ms                | 33.3       | Frame budget}"
+        "{max_percent             | 1          | Most of the frame budget the metrics may take}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    int iterations = parser.get<int>("iterations");
+    int threadCount = std::max(1, parser.get<int>("threads"));
+    int timers = parser.get<int>("timers");
+    int counters = parser.get<int>("counters");
+    int gauges = parser.get<int>("gauges");
+    double frameMs = parser.get<double>("frame_ms");
+    double maxPercent = parser.get<double>("max_percent");
+
+    // Started together so the shards are written concurrently, the way the stages write them
+    std::vector<OpCosts> costs(threadCount);
+    std::vector<std::thread> threads;
+    std::atomic<int> ready{0};
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t]() {
+            ready.fetch_add(1);
+            while (ready.load() < threadCount) std::this_thread::yield();
+            costs[t] = measure(iterations);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    // The slowest thread's cost, since each stage's thread pays its own
+    OpCosts worst;
+    for (const OpCosts& c : costs) {
+        worst.counterNs = std::max(worst.counterNs, c.counterNs);
+        worst.gaugeNs = std::max(worst.gaugeNs, c.gaugeNs);
+        worst.timerNs = std::max(worst.timerNs, c.timerNs);
+    }
+    double frameNs = timers * worst.timerNs + counters * worst.counterNs + gauges * worst.gaugeNs;
+    double percent = frameNs / (frameMs * 1e6) * 100;
+
+    auto start = std::chrono::steady_clock::now();
+    std::string text = renderMetrics();
+    double renderMs = elapsedMs(start);
+
+    fprintf(stderr, "counter %.1f ns, gauge %.1f ns, timer %.1f ns; %.2f us a frame, %.4f%% of %.1f ms (limit %.2f%%)\n",
+                    worst.counterNs, worst.gaugeNs, worst.timerNs, frameNs / 1000, percent, frameMs, maxPercent);
+    fprintf(stderr, "renderMetrics %.3f ms for %zu bytes, on the exporter's thread\n", renderMs, text.size());
+
+    std::string report = cv::format("{\n  \"threads\": %d,\n  \"iterations\": %d,\n  \"counter_ns\": %.2f,\n  \"gauge_ns\": %.2f,\n"
+                                    "  \"timer_ns\": %.2f,\n  \"frame_ns\": %.1f,\n  \"frame_ms\": %.2f,\n  \"frame_percent\": %.4f,\n"
+                                    "  \"render_ms\": %.3f\n}\n",
+                                    threadCount, iterations, worst.counterNs, worst.gaugeNs, worst.timerNs, frameNs, frameMs, percent, renderMs);
+
+    if (!writer.write(report)) return 1;
+
+    return percent <= maxPercent ? 0 : 1;
+}
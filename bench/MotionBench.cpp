@@ -0,0 +1,152 @@
+// Share of frames the motion gate keeps from the detector, and the detector time that saves,
+// on an idle clip and a busy one. The gate kernel itself is timed on every frame
+
+#include <iostream>
+#include <stdio.h>
+#include <time.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "BenchUtil.h"
+#include "Detector.h"
+#include "MotionGate.h"
+#include "VideoSource.h"
+
+// CPU time across every thread, so the interpreter's own threads count too
+static double processCpuMs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+struct ClipResult {
+    int frames = 0;
+    int detectorRuns = 0;
+    LatencySamples gateMs;
+    double detectorMs = 0;  // detector time actually spent, CPU and wall
+    double detectorWallMs = 0;
+};
+
+// Runs the gate the way Pipeline does without a tracker: the detector runs on motion, or once
+// refreshEvery frames have gone by without it
+static ClipResult runClip(const std::vector<cv::Mat>& clip, Detector& detector, const MotionGateConfig& config) {
+    ClipResult result;
+    MotionGate gate(config);
+    Detections detections;
+    int sinceDetect = 0;
+    for (const cv::Mat& frame : clip) {
+        auto start = std::chrono::steady_clock::now();
+        bool still = !gate.changed(frame);
+        result.gateMs.add(elapsedMs(start));
+
+        result.frames++;
+        if (still && sinceDetect + 1 < config.refreshEvery) {
+            sinceDetect++;
+            continue;
+        }
+        sinceDetect = 0;
+        double cpu = processCpuMs();
+        auto wall = std::chrono::steady_clock::now();
+        detector.detect(frame, detections);
+        result.detectorWallMs += elapsedMs(wall);
+        result.detectorMs += processCpuMs() - cpu;
+        result.detectorRuns++;
+    }
+    return result;
+}
+
+static std::vector<cv::Mat> loadClip(const std::string& path, int frames) {
+    FileVideoSource source(path, 0, Pacing::None, true);
+    std::vector<cv::Mat> clip(frames);
+    for (cv::Mat& frame : clip) source.getFrame(frame);
+    return clip;
+}
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{video v                 | ../res/face_test.mp4 | Busy clip, looped as needed}"
+        "{idle                    |            | Idle clip; by default the busy clip's first frame repeated with sensor noise}"
+        "{noise                   | 2          | Standard deviation of the noise added to the made-up idle clip}"
+        "{model_path m            | ../res/detect_tpu.tflite | Path to the model}"
+        "{labels_path l           | ../res/labels.txt | Path to the labels}"
+        "{confidence_threshold c  | 0.5        | Filter out detections of score < confidence_threshold}"
+        "{use_tpu t               | true       | Use Coral accelerator for object detection}"
+        "{frames n                | 300        | Frames per clip}"
+        "{cell                    | 8          | Frame pixels per side of one motion cell}"
+        "{threshold               | 10         | Luma change for a cell to count as changed}"
+        "{sensitivity             | 0.005      | Share of cells that have to change for a frame to count as motion}"
+        "{refresh                 | 30         | Most frames in a row the gate can skip}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    int frames = parser.get<int>("frames");
+    MotionGateConfig config;
+    config.enabled = true;
+    config.cell = parser.get<int>("cell");
+    config.threshold = parser.get<int>("threshold");
+    config.sensitivity = parser.get<float>("sensitivity");
+    config.refreshEvery = parser.get<int>("refresh");
+
+    std::string report = cv::format("{\n  \"frames\": %d,\n  \"cell\": %d,\n  \"threshold\": %d,\n  \"sensitivity\": %.4f,\n  \"refresh\": %d,\n  \"clips\": {\n",
+                                    frames, config.cell, config.threshold, config.sensitivity, config.refreshEvery);
+    try {
+        TfliteDetector detector(parser.get<std::string>("model_path"), parser.get<std::string>("labels_path"), parser.get<float>("confidence_threshold"), parser.get<bool>("use_tpu"));
+
+        std::vector<cv::Mat> busy = loadClip(parser.get<std::string>("video"), frames);
+        std::vector<cv::Mat> idle;
+        std::string idlePath = parser.get<std::string>("idle");
+        if (!idlePath.empty()) {
+            idle = loadClip(idlePath, frames);
+        } else {
+            cv::Mat noise(busy[0].size(), CV_16SC3);
+            for (int i = 0; i < frames; i++) {
+                cv::randn(noise, 0, parser.get<double>("noise"));
+                cv::Mat frame;
+                cv::add(busy[0], noise, frame, cv::noArray(), CV_8U);
+                idle.push_back(frame);
+            }
+        }
+
+        detector.warmUp(busy[0].size());
+
+        // Every frame through the detector is what the gate is saving against
+        MotionGateConfig off = config;
+        off.sensitivity = -1;
+        ClipResult ungated = runClip(busy, detector, off);
+        double detectorCpuMs = ungated.detectorMs / ungated.frames;
+        double detectorWallMs = ungated.detectorWallMs / ungated.frames;
+        fprintf(stderr, "detector: %.3f ms CPU, %.3f ms wall per frame\n", detectorCpuMs, detectorWallMs);
+
+        const char* names[2] = {"idle", "busy"};
+        const std::vector<cv::Mat>* clips[2] = {&idle, &busy};
+        for (int c = 0; c < 2; c++) {
+            ClipResult result = runClip(*clips[c], detector, config);
+            double skipped = 1 - (double)result.detectorRuns / result.frames;
+            double gateMs = result.gateMs.mean();
+            // Saved per frame: detector runs avoided, less the gate's own cost on every frame
+            double savedCpuMs = detectorCpuMs - result.detectorMs / result.frames - gateMs;
+            double savedWallMs = detectorWallMs - result.detectorWallMs / result.frames - gateMs;
+            fprintf(stderr, "%s: %.1f%% skipped, gate %.3f ms mean / %.3f ms p99, saves %.3f ms CPU and %.3f ms wall per frame\n",
+                            names[c], skipped * 100, gateMs, result.gateMs.percentile(99), savedCpuMs, savedWallMs);
+            report += cv::format("    \"%s\": {\"skipped\": %.4f, \"detector_runs\": %d, \"gate_ms_mean\": %.4f, \"gate_ms_p99\": %.4f, "
+                                 "\"saved_cpu_ms_per_frame\": %.3f, \"saved_wall_ms_per_frame\": %.3f}%s\n",
+                                 names[c], skipped, result.detectorRuns, gateMs, result.gateMs.percentile(99),
+                                 savedCpuMs, savedWallMs, c == 0 ? "," : "");
+        }
+        report += cv::format("  },\n  \"detector_cpu_ms_per_frame\": %.3f,\n  \"detector_wall_ms_per_frame\": %.3f\n}\n", detectorCpuMs, detectorWallMs);
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Replays a clip through the real VideoSource, Detector and Display code and reports
+// per-stage latency, throughput and peak RSS as JSON, so builds can be diffed
+
+#include <iostream>
+#include <stdio.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "BenchUtil.h"
+#include "Detector.h"
+#include "Display.h"
+#include "Pipeline.h"
+#include "VideoSource.h"
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{video v                 | ../res/face_test.mp4 | Clip to replay, looped as needed}"
+        "{model_path m            | ../res/detect_tpu.tflite | Path to the model}"
+        "{labels_path l           | ../res/labels.txt | Path to the labels}"
+        "{confidence_threshold c  | 0.5        | Filter out detections of score < confidence_threshold}"
+        "{use_tpu t               | true       | Use Coral accelerator for object detection}"
+        "{threads                 | 3          | CPU interpreter threads, 0 to autotune}"
+        "{xnnpack                 | 1          | XNNPACK delegate on the CPU interpreter [1]}"
+        "{frames n                | 300        | Frames to measure}"
+        "{warmup w                | 30         | Frames to run before measuring}"
+        "{pipelined p             | 1          | Also measure throughput and latency through the threaded pipeline}"
+        "{queue_depth q           | 2          | Frames buffered between pipeline stages}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    std::string video = parser.get<std::string>("video");
+    int frames = parser.get<int>("frames");
+    int warmup = parser.get<int>("warmup");
+
+    LatencySamples capture, detect, sink, total, endToEnd;
+    double serialFps = 0;
+    double pipelineFps = 0;
+
+    try {
+        TfliteCpuConfig cpu;
+        cpu.threads = parser.get<int>("threads");
+        cpu.xnnpack = parser.get<int>("xnnpack");
+        TfliteDetector detector(parser.get<std::string>("model_path"), parser.get<std::string>("labels_path"), parser.get<float>("confidence_threshold"), parser.get<bool>("use_tpu"),
+                                true, false, cpu);
+        Display display(false);
+
+        // Stage by stage on one thread, so each stage is timed on its own
+        {
+            FileVideoSource source(video, 0, Pacing::None, true);
+            Detections detections;
+            cv::Mat scratch;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < warmup + frames; i++) {
+                if (i == warmup) start = std::chrono::steady_clock::now();
+
+                auto t0 = std::chrono::steady_clock::now();
+                FrameLease frame = source.acquireFrame();
+                auto t1 = std::chrono::steady_clock::now();
+                detector.detect(frame.image(), detections);
+                auto t2 = std::chrono::steady_clock::now();
+                cv::Mat canvas = frame.writable(scratch);
+                display.visualize(canvas, detections, 0);
+                auto t3 = std::chrono::steady_clock::now();
+
+                if (i < warmup) continue;
+                capture.add(elapsedMs(t0, t1));
+                detect.add(elapsedMs(t1, t2));
+                sink.add(elapsedMs(t2, t3));
+                total.add(elapsedMs(t0, t3));
+            }
+            serialFps = frames / (elapsedMs(start) / 1000);
+        }
+
+        // The same work overlapped across the pipeline's threads
+        if (parser.get<int>("pipelined")) {
+            FileVideoSource source(video, 0, Pacing::Unthrottled, true);
+            PipelineConfig config;
+            config.captureDepth = parser.get<int>("queue_depth");
+            config.resultDepth = parser.get<int>("queue_depth");
+            Pipeline pipeline(source, detector, config);
+            pipeline.start();
+
+            FrameResult result;
+            auto start = std::chrono::steady_clock::now();
+            int n = 0;
+            while (n < warmup + frames && pipeline.next(result)) {
+                if (n == warmup) start = std::chrono::steady_clock::now();
+                cv::Mat canvas = result.frame.writable();
+                display.visualize(canvas, result.detections, 0);
+                if (n >= warmup) endToEnd.add(elapsedMs(result.captureTime));
+                n++;
+            }
+            pipelineFps = (n - warmup) / (elapsedMs(start) / 1000);
+            pipeline.stop();
+            if (pipeline.failed()) {
+                throw std::runtime_error(pipeline.error());
+            }
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::string report = cv::format("{\n  \"clip\": \"%s\",\n  \"frames\": %d,\n  \"warmup\": %d,\n  \"stages\": {\n", video.c_str(), frames, warmup);
+    report += "    \"capture\": " + capture.json() + ",\n";
+    report += "    \"detect\": " + detect.json() + ",\n";
+    report += "    \"sink\": " + sink.json() + ",\n";
+    report += "    \"total\": " + total.json() + "\n  },\n";
+    report += cv::format("  \"serial_fps\": %.2f,\n", serialFps);
+    if (endToEnd.count()) {
+        report += cv::format("  \"pipeline_fps\": %.2f,\n", pipelineFps);
+        report += "  \"pipeline_latency\": " + endToEnd.json() + ",\n";
+    }
+    report += cv::format("  \"peak_rss_kb\": %ld\n}\n", peakRssKb());
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Per-face recognition cost at 1, 4 and 16 faces a frame, batched against one forward pass per face
+
+#include <iostream>
+#include <stdio.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "BenchUtil.h"
+#include "Recognizer.h"
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{recognizer_model        | ../res/face_recognition_sface_2021dec.onnx | Path to the SFace model}"
+        "{frames n                | 100        | Frames to measure at each face count}"
+        "{warmup w                | 10         | Frames to run before measuring}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    std::string model = parser.get<std::string>("recognizer_model");
+    int frames = parser.get<int>("frames");
+    int warmup = parser.get<int>("warmup");
+
+    // Content doesn't change the cost, so noise will do
+    cv::Mat frame(480, 640, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+
+    std::string report = cv::format("{\n  \"frames\": %d,\n  \"warmup\": %d,\n  \"faces\": {\n", frames, warmup);
+    const int faceCounts[] = {1, 4, 16};
+    try {
+        Recognizer batched(model, 0.363, 16);
+        Recognizer single(model, 0.363, 1);
+
+        for (int f = 0; f < 3; f++) {
+            int n = faceCounts[f];
+            // A 4x4 grid of 100 px faces
+            Detections faces;
+            faces.resize(n);
+            for (int i = 0; i < n; i++) {
+                faces[i].x1 = 40 + (i % 4) * 150;
+                faces[i].y1 = 20 + (i / 4) * 115;
+                faces[i].x2 = faces[i].x1 + 100;
+                faces[i].y2 = faces[i].y1 + 100;
+                faces[i].label = kFaceLabel;
+            }
+
+            LatencySamples batchedMs, singleMs;
+            for (int i = 0; i < warmup + frames; i++) {
+                auto t0 = std::chrono::steady_clock::now();
+                batched.recognize(frame, faces);
+                auto t1 = std::chrono::steady_clock::now();
+                single.recognize(frame, faces);
+                auto t2 = std::chrono::steady_clock::now();
+                if (i < warmup) continue;
+                batchedMs.add(elapsedMs(t0, t1));
+                singleMs.add(elapsedMs(t1, t2));
+            }
+
+            fprintf(stderr, "%2d faces: batched %.3f ms/face, one at a time %.3f ms/face\n", n, batchedMs.mean() / n, singleMs.mean() / n);
+            report += cv::format("    \"%d\": {\n      \"batched_ms_per_face\": %.3f,\n      \"single_ms_per_face\": %.3f,\n", n, batchedMs.mean() / n, singleMs.mean() / n);
+            report += "      \"batched_frame\": " + batchedMs.json() + ",\n";
+            report += "      \"single_frame\": " + singleMs.json() + "\n    }" + (f < 2 ? ",\n" : "\n");
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+    report += "  }\n}\n";
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Latency and recall of tiled detection against the single-resize path, at several tile grids.
+// Clips have no labels, so recall is measured against every face any configuration found
+// (boxes matched at IoU 0.5): a face only the tiles pick up counts against the single path,
+// and one the tiles miss counts against them
+
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "BenchUtil.h"
+#include "Detector.h"
+#include "TiledDetector.h"
+#include "VideoSource.h"
+
+static float overlap(const Detection& a, const Detection& b) {
+    float w = std::min(a.x2, b.x2) - std::max(a.x1, b.x1);
+    float h = std::min(a.y2, b.y2) - std::max(a.y1, b.y1);
+    if (w <= 0 || h <= 0) return 0;
+    return w * h / ((a.x2 - a.x1) * (a.y2 - a.y1) + (b.x2 - b.x1) * (b.y2 - b.y1) - w * h);
+}
+
+static bool matches(const Detection& d, const std::vector<Detection>& boxes) {
+    for (const Detection& b : boxes) {
+        if (overlap(d, b) >= 0.5) return true;
+    }
+    return false;
+}
+
+struct RunResult {
+    std::string name;
+    int tiles = 0;
+    LatencySamples latency;
+    std::vector<std::vector<Detection>> found;  // per frame
+};
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{video v                 | ../res/face_test.mp4 | Clip to replay, looped as needed}"
+        "{model_path m            | ../res/detect.tflite | Path to a CPU model}"
+        "{labels_path l           | ../res/labels.txt | Path to the labels}"
+        "{confidence_threshold c  | 0.5        | Filter out detections of score < confidence_threshold}"
+        "{threads                 | 1          | Threads per CPU interpreter}"
+        "{xnnpack                 | 1          | XNNPACK delegate on the CPU interpreters [1]}"
+        "{grids g                 | 2x2,3x2,3x3 | Tile grids to compare, colsxrows}"
+        "{overlap                 | 0.2        | Share of a tile overlapping its neighbour}"
+        "{full_frame              | 1          | Also detect on the whole frame in the tiled runs [1]}"
+        "{interpreters i          | 2          | Interpreters running tiles at once}"
+        "{frames n                | 120        | Frames per configuration}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    int frames = parser.get<int>("frames");
+    std::vector<cv::Size> grids;
+    std::stringstream list(parser.get<std::string>("grids"));
+    for (std::string item; std::getline(list, item, ',');) {
+        int cols = 0, rows = 0;
+        if (sscanf(item.c_str(), "%dx%d", &cols, &rows) != 2 || cols < 1 || rows < 1) {
+            std::cerr << "Error - Bad grid " << item << std::endl;
+            return 1;
+        }
+        grids.push_back(cv::Size(cols, rows));
+    }
+
+    std::string report = cv::format("{\n  \"frames\": %d,\n  \"overlap\": %.3f,\n  \"interpreters\": %d,\n  \"configs\": {\n",
+                                    frames, parser.get<float>("overlap"), parser.get<int>("interpreters"));
+    try {
+        // Decoded up front so only the detector is timed
+        std::vector<cv::Mat> clip(frames);
+        {
+            FileVideoSource source(parser.get<std::string>("video"), 0, Pacing::None, true);
+            for (cv::Mat& frame : clip) source.getFrame(frame);
+        }
+
+        auto model = TfliteDetector::loadModel(parser.get<std::string>("model_path"));
+        auto labels = TfliteDetector::loadLabels(parser.get<std::string>("labels_path"));
+        TfliteCpuConfig cpu;
+        cpu.threads = parser.get<int>("threads");
+        cpu.xnnpack = parser.get<int>("xnnpack");
+        auto makeDetector = [&]() {
+            return std::make_unique<TfliteDetector>(model, nullptr, labels, parser.get<float>("confidence_threshold"), true, false, cpu);
+        };
+
+        // The single-resize path first, then each grid
+        std::vector<RunResult> runs(grids.size() + 1);
+        for (size_t r = 0; r < runs.size(); r++) {
+            std::unique_ptr<Detector> detector;
+            if (r == 0) {
+                detector = makeDetector();
+                detector->warmUp(clip[0].size());
+                runs[r].name = "single";
+                runs[r].tiles = 1;
+            } else {
+                TilingConfig tiling;
+                tiling.enabled = true;
+                tiling.cols = grids[r - 1].width;
+                tiling.rows = grids[r - 1].height;
+                tiling.overlap = parser.get<float>("overlap");
+                tiling.fullFrame = parser.get<int>("full_frame");
+                std::vector<std::unique_ptr<Detector>> detectors;
+                for (int i = 0; i < std::max(1, parser.get<int>("interpreters")); i++) detectors.push_back(makeDetector());
+                auto tiled = std::make_unique<TiledDetector>(std::move(detectors), tiling);
+                runs[r].name = cv::format("%dx%d", tiling.cols, tiling.rows);
+                tiled->warmUp(clip[0].size());
+                runs[r].tiles = tiled->tileCount();  // laid out on the first frame
+                detector = std::move(tiled);
+            }
+
+            Detections detections;
+            for (const cv::Mat& frame : clip) {
+                auto start = std::chrono::steady_clock::now();
+                detector->detect(frame, detections);
+                runs[r].latency.add(elapsedMs(start));
+                runs[r].found.emplace_back(detections.begin(), detections.end());
+            }
+        }
+
+        // Every distinct face any configuration found on each frame
+        std::vector<std::vector<Detection>> reference(frames);
+        for (const RunResult& run : runs) {
+            for (int f = 0; f < frames; f++) {
+                for (const Detection& d : run.found[f]) {
+                    if (!matches(d, reference[f])) reference[f].push_back(d);
+                }
+            }
+        }
+
+        for (size_t r = 0; r < runs.size(); r++) {
+            int expected = 0, found = 0;
+            for (int f = 0; f < frames; f++) {
+                for (const Detection& ref : reference[f]) {
+                    expected++;
+                    found += matches(ref, runs[r].found[f]);
+                }
+            }
+            float recall = expected ? (float)found / expected : 1.f;
+            LatencySamples& latency = runs[r].latency;
+            double slowdown = latency.mean() / runs[0].latency.mean();
+            fprintf(stderr, "%s (%d tiles): recall %.3f, %.2f ms mean / %.2f ms p99 (%.2fx single)\n", runs[r].name.c_str(), runs[r].tiles,
+                            recall, latency.mean(), latency.percentile(99), slowdown);
+            report += cv::format("    \"%s\": {\"tiles\": %d, \"recall\": %.4f, \"faces_found\": %d, \"latency_ms_mean\": %.3f, \"latency_ms_p99\": %.3f, \"vs_single\": %.3f}%s\n",
+                                 runs[r].name.c_str(), runs[r].tiles, recall, found, latency.mean(), latency.percentile(99), slowdown,
+                                 r + 1 < runs.size() ? "," : "");
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+    report += "  }\n}\n";
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
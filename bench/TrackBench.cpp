@@ -0,0 +1,144 @@
+// Detector CPU time and box agreement with tracking at several detector cadences, against
+// running the detector on every frame
+
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <time.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "BenchUtil.h"
+#include "Detector.h"
+#include "Tracker.h"
+#include "VideoSource.h"
+
+// CPU time across every thread, so the interpreter's own threads count too
+static double processCpuMs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static float overlap(const Detection& a, const Detection& b) {
+    float w = std::min(a.x2, b.x2) - std::max(a.x1, b.x1);
+    float h = std::min(a.y2, b.y2) - std::max(a.y1, b.y1);
+    if (w <= 0 || h <= 0) return 0;
+    return w * h / ((a.x2 - a.x1) * (a.y2 - a.y1) + (b.x2 - b.x1) * (b.y2 - b.y1) - w * h);
+}
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{video v                 | ../res/face_test.mp4 | Clip to replay, looped as needed}"
+        "{model_path m            | ../res/detect_tpu.tflite | Path to the model}"
+        "{labels_path l           | ../res/labels.txt | Path to the labels}"
+        "{confidence_threshold c  | 0.5        | Filter out detections of score < confidence_threshold}"
+        "{use_tpu t               | true       | Use Coral accelerator for object detection}"
+        "{frames n                | 300        | Frames per run}"
+        "{cadences                | 2,3,5,8    | Detector cadences to compare, plus adaptive up to the largest}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    std::string video = parser.get<std::string>("video");
+    int frames = parser.get<int>("frames");
+    std::vector<int> cadences;
+    std::stringstream list(parser.get<std::string>("cadences"));
+    for (std::string item; std::getline(list, item, ',');) cadences.push_back(std::stoi(item));
+
+    std::string report = cv::format("{\n  \"clip\": \"%s\",\n  \"frames\": %d,\n  \"runs\": {\n", video.c_str(), frames);
+    try {
+        TfliteDetector detector(parser.get<std::string>("model_path"), parser.get<std::string>("labels_path"), parser.get<float>("confidence_threshold"), parser.get<bool>("use_tpu"));
+
+        // Every frame through the detector is the reference the tracked runs are scored against
+        std::vector<Detections> reference(frames);
+        double referenceMs;
+        {
+            FileVideoSource source(video, 0, Pacing::None, true);
+            cv::Mat frame;
+            double cpu = 0;
+            for (int i = 0; i < frames; i++) {
+                source.getFrame(frame);
+                double start = processCpuMs();
+                detector.detect(frame, reference[i]);
+                cpu += processCpuMs() - start;
+            }
+            referenceMs = cpu / frames;
+        }
+        fprintf(stderr, "every frame: %.3f ms CPU/frame\n", referenceMs);
+        report += cv::format("    \"every_frame\": {\"cpu_ms_per_frame\": %.3f, \"detector_runs\": %d, \"mean_iou\": 1.0},\n", referenceMs, frames);
+
+        // Fixed cadences, then adaptive, which is marked by a negative cadence
+        std::vector<int> runs = cadences;
+        if (!cadences.empty()) runs.push_back(-*std::max_element(cadences.begin(), cadences.end()));
+        for (size_t r = 0; r < runs.size(); r++) {
+            bool adaptive = runs[r] < 0;
+            int maxInterval = std::abs(runs[r]);
+            int interval = adaptive ? 1 : maxInterval;
+
+            FileVideoSource source(video, 0, Pacing::None, true);
+            Tracker tracker;
+            cv::Mat frame;
+            Detections detections;
+            double cpu = 0;
+            int runsOfDetector = 0;
+            int sinceDetect = interval;
+            double iouSum = 0;
+            int referenceBoxes = 0;
+            int extraBoxes = 0;
+            for (int i = 0; i < frames; i++) {
+                source.getFrame(frame);
+                double start = processCpuMs();
+                if (++sinceDetect >= interval) {
+                    sinceDetect = 0;
+                    detector.detect(frame, detections);
+                    tracker.update(detections);
+                    runsOfDetector++;
+                    if (adaptive) interval = tracker.stable() ? std::min(interval * 2, maxInterval) : 1;
+                } else {
+                    tracker.predict(detections);
+                }
+                cpu += processCpuMs() - start;
+
+                // Each reference box scores its best remaining overlap; a missed face scores 0
+                std::vector<char> used(detections.size(), 0);
+                for (const Detection& ref : reference[i]) {
+                    int best = -1;
+                    float bestIou = 0;
+                    for (size_t d = 0; d < detections.size(); d++) {
+                        float o = used[d] ? 0 : overlap(ref, detections[d]);
+                        if (o > bestIou) {
+                            best = d;
+                            bestIou = o;
+                        }
+                    }
+                    if (best >= 0) used[best] = 1;
+                    iouSum += bestIou;
+                    referenceBoxes++;
+                }
+                for (char u : used) extraBoxes += !u;
+            }
+            double cpuMs = cpu / frames;
+            double meanIou = referenceBoxes ? iouSum / referenceBoxes : 1;
+            std::string name = adaptive ? cv::format("adaptive_%d", maxInterval) : cv::format("every_%d", maxInterval);
+            fprintf(stderr, "%s: %.3f ms CPU/frame (%.1fx less), %d detector runs, mean IoU %.3f, %d extra boxes\n",
+                            name.c_str(), cpuMs, referenceMs / std::max(cpuMs, 1e-6), runsOfDetector, meanIou, extraBoxes);
+            report += cv::format("    \"%s\": {\"cpu_ms_per_frame\": %.3f, \"detector_runs\": %d, \"mean_iou\": %.4f, \"extra_boxes\": %d}%s\n",
+                                 name.c_str(), cpuMs, runsOfDetector, meanIou, extraBoxes, r + 1 < runs.size() ? "," : "");
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+    report += "  }\n}\n";
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Times the YUV420 convert-and-scale kernel on synthetic camera frames against resizing an
+// RGB888 frame and against converting the whole YUV frame first. Its agreement with OpenCV is
+// checked by tests/YuvTest.cpp
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "BenchUtil.h"
+#include "Preprocess.h"
+
+// A BGR frame as a camera would deliver it in YUV420: planes back to back, rows padded to stride
+struct CameraYuv {
+    std::vector<uint8_t> buffer;
+    YuvPlanes planes;
+};
+
+static CameraYuv toCameraYuv(const cv::Mat& bgr, int stride) {
+    cv::Mat i420;
+    cv::cvtColor(bgr, i420, cv::COLOR_BGR2YUV_I420);
+    int width = bgr.cols, height = bgr.rows;
+    CameraYuv yuv;
+    yuv.buffer.assign((size_t)stride * height * 3 / 2, 0);
+    const uint8_t* src = i420.ptr<uint8_t>(0);
+    uint8_t* y = yuv.buffer.data();
+    uint8_t* u = y + (size_t)stride * height;
+    uint8_t* v = u + (size_t)(stride / 2) * (height / 2);
+    for (int r = 0; r < height; r++) memcpy(y + (size_t)r * stride, src + (size_t)r * width, width);
+    src += (size_t)width * height;
+    for (int r = 0; r < height / 2; r++) memcpy(u + (size_t)r * (stride / 2), src + (size_t)r * (width / 2), width / 2);
+    src += (size_t)(width / 2) * (height / 2);
+    for (int r = 0; r < height / 2; r++) memcpy(v + (size_t)r * (stride / 2), src + (size_t)r * (width / 2), width / 2);
+    yuv.planes.y = y;
+    yuv.planes.u = u;
+    yuv.planes.v = v;
+    yuv.planes.width = width;
+    yuv.planes.height = height;
+    yuv.planes.yStride = stride;
+    yuv.planes.uvStride = stride / 2;
+    return yuv;
+}
+
+// Smooth colour gradients with sensor-like noise, so both flat areas and edges are covered
+static cv::Mat syntheticFrame(int width, int height) {
+    cv::Mat coarse(height / 16 + 1, width / 16 + 1, CV_8UC3);
+    cv::randu(coarse, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat frame, noise(height, width, CV_8UC3);
+    cv::resize(coarse, frame, cv::Size(width, height));
+    cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(16));
+    cv::add(frame, noise, frame);
+    return frame;
+}
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{sizes                   | 640x480,1296x972,1920x1080 | Camera frame sizes, widthxheight}"
+        "{pad                     | 64         | Bytes of row padding on top of the width, as camera strides have}"
+        "{input s                 | 300        | Model input width and height}"
+        "{iterations i            | 200        | Timed iterations per path and size}"
+        "{output o                | -          | Where to write the JSON report, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    ReportWriter writer(parser.get<std::string>("output"));
+
+    int input = parser.get<int>("input");
+    int iterations = parser.get<int>("iterations");
+    std::vector<cv::Size> sizes;
+    std::stringstream list(parser.get<std::string>("sizes"));
+    for (std::string item; std::getline(list, item, ',');) {
+        int width = 0, height = 0;
+        if (sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width < 2 || height < 2 || width % 2 || height % 2) {
+            std::cerr << "Error - Bad size " << item << ", expected even widthxheight" << std::endl;
+            return 1;
+        }
+        sizes.push_back(cv::Size(width, height));
+    }
+
+    std::vector<uint8_t> tensor(input * input * 3);
+    TensorResizer resizer;
+    YuvTensorResizer yuvResizer;
+
+    std::string report = cv::format("{\n  \"input\": %d,\n  \"iterations\": %d,\n  \"sizes\": {\n", input, iterations);
+    for (size_t s = 0; s < sizes.size(); s++) {
+        cv::Size size = sizes[s];
+        cv::Mat frame = syntheticFrame(size.width, size.height);
+        CameraYuv yuv = toCameraYuv(frame, size.width + parser.get<int>("pad"));
+
+        // What the RGB888 camera path costs once the frame is in memory, what converting a YUV
+        // frame up front would cost, and the fused kernel
+        LatencySamples rgbPath, convertFirst, fused;
+        cv::Mat bgr;
+        for (int i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            resizer.run(frame, tensor.data(), input, input, true, false);
+            rgbPath.add(elapsedMs(start));
+
+            start = std::chrono::steady_clock::now();
+            yuv.planes.toBgr(bgr);
+            resizer.run(bgr, tensor.data(), input, input, true, false);
+            convertFirst.add(elapsedMs(start));
+
+            start = std::chrono::steady_clock::now();
+            yuvResizer.run(yuv.planes, tensor.data(), input, input, true, false);
+            fused.add(elapsedMs(start));
+        }
+
+        // What the camera writes and the pipeline reads for every frame
+        double rgbBytes = (double)size.width * size.height * 3;
+        double yuvBytes = (double)size.width * size.height * 3 / 2;
+        fprintf(stderr, "%dx%d -> %dx%d: RGB888 resize %.3f ms, YUV convert then resize %.3f ms, YUV fused %.3f ms; %.2f MB vs %.2f MB a frame\n",
+                        size.width, size.height, input, input, rgbPath.mean(), convertFirst.mean(), fused.mean(), rgbBytes / 1e6, yuvBytes / 1e6);
+        report += cv::format("    \"%dx%d\": {\"rgb_resize_ms\": %.4f, \"yuv_convert_then_resize_ms\": %.4f, "
+                             "\"yuv_fused_ms\": %.4f, \"yuv_fused_p99_ms\": %.4f, \"rgb_bytes\": %.0f, \"yuv_bytes\": %.0f}%s\n",
+                             size.width, size.height, rgbPath.mean(), convertFirst.mean(),
+                             fused.mean(), fused.percentile(99), rgbBytes, yuvBytes, s + 1 < sizes.size() ? "," : "");
+    }
+    report += "  }\n}\n";
+
+    if (!writer.write(report)) return 1;
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Bounded lock-free multi-producer/single-consumer queue (Vyukov's sequenced ring) that
+// signals an eventfd on every push. Consumers can block in pop() or poll() fd() alongside
+// their other descriptors. The eventfd counts items (EFD_SEMAPHORE), so each pop() takes
+// one count and the fd stays readable while more are queued.
+template <typename T>
+class CompletionQueue {
+public:
+
+    explicit CompletionQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        _mask = size - 1;
+        _cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        _fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_fd < 0) {
+            throw std::runtime_error("CompletionQueue::CompletionQueue - Failed to create eventfd");
+        }
+    }
+
+    ~CompletionQueue() {
+        ::close(_fd);
+    }
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    // Safe from any thread. Returns false if the queue is full
+    bool push(T item) {
+        size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &_cells[pos & _mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        uint64_t one = 1;
+        ssize_t ret = write(_fd, &one, sizeof(one));
+        (void)ret; // only fails if the counter would overflow, and then the fd is readable anyway
+        return true;
+    }
+
+    // Consumer side only
+    bool tryPop(T& item) {
+        Cell* cell = &_cells[_dequeuePos & _mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        if (sequence != _dequeuePos + 1) return false;
+        item = std::move(cell->value);
+        cell->sequence.store(_dequeuePos + _mask + 1, std::memory_order_release);
+        _dequeuePos++;
+        return true;
+    }
+
+    // Waits up to timeoutMs for an item, or forever if timeoutMs is negative
+    bool pop(T& item, int timeoutMs) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (true) {
+            // Take one count before checking, so a push after the check always wakes the poll.
+            // Counts left by items taken with tryPop() only cost an extra pass here
+            uint64_t count;
+            ssize_t ret = read(_fd, &count, sizeof(count));
+            (void)ret;
+            if (tryPop(item)) return true;
+
+            int wait = -1;
+            if (timeoutMs >= 0) {
+                // Rounded up, so the wait never ends short of the deadline
+                auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                if (remaining <= 0) return false;
+                wait = (int)remaining;
+            }
+            pollfd pfd = { _fd, POLLIN, 0 };
+            poll(&pfd, 1, wait);
+        }
+    }
+
+    // Consumer side only
+    void clear() {
+        T item;
+        while (tryPop(item)) {}
+    }
+
+    // Readable whenever items may be waiting
+    int fd() const { return _fd; }
+
+private:
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    int _fd;
+
+    alignas(64) std::atomic<size_t> _enqueuePos{0};
+    alignas(64) size_t _dequeuePos = 0;
+
+};
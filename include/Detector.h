@@ -14,31 +14,142 @@
 #include "tensorflow/lite/kernels/register.h"
 #include "tensorflow/lite/string_util.h"
 #include <tensorflow/lite/model.h>
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
 #include <edgetpu.h>
 
+#include "FixedVector.h"
+#include "Preprocess.h"
+
+// Length of a face embedding (SFace)
+static const int kEmbeddingSize = 128;
+
 struct Detection {
     float x1, y1, x2, y2;
     float score;
     const char* label;
+
+    // Eyes, nose tip and mouth corners in frame pixels, when the detector provides them
+    bool hasLandmarks = false;
+    float landmarks[5][2];
+
+    // Same for every detection of one face while the Tracker follows it, -1 when untracked
+    int trackId = -1;
+
+    // Filled in by the Recognizer. The embedding is L2 normalised; name is null when nobody matched
+    bool hasEmbedding = false;
+    float embedding[kEmbeddingSize];
+    const char* name = nullptr;
+    float matchScore = 0;
 }; 
 
+// The label face backends give their boxes, and what a face model's labels file calls faces
+static const char kFaceLabel[] = "face";
+
+// Most faces one frame can carry. Kept inline so results move between stages without allocating
+static const int kMaxDetections = 32;
+typedef FixedVector<Detection, kMaxDetections> Detections;
+
+// A face detection backend. Each instance is used from one thread at a time
 class Detector {
 public:
 
-    Detector() {};
-    Detector(std::string modelPath, std::string labelsPath, double confidenceThresh=0.5, bool useTpu=false);
-    std::vector<Detection> detect(cv::Mat& src);
+    virtual ~Detector() {}
+    // Fills detections, replacing what was there; extra faces past kMaxDetections are dropped
+    virtual void detect(const cv::Mat& src, Detections& detections) = 0;
+    // detections[i] for frames[i]. Backends that can batch run up to maxBatch() frames through
+    // one inference; the default detects them one by one
+    virtual void detectBatch(const cv::Mat* frames, size_t count, Detections* detections);
+    // The same on YUV 4:2:0 camera frames. The default converts each to BGR and detects on
+    // that; backends that can scale straight from the planes override it
+    virtual void detectYuv(const YuvPlanes* frames, size_t count, Detections* detections);
+    virtual int maxBatch() const { return 1; }
+    // Short name for logs
+    virtual const char* name() const = 0;
+    // Whether boxes with this label can come out of detect()
+    virtual bool hasLabel(const char* label) const = 0;
+    // One inference on a synthetic frame, and one full batch where batching is on, so one-time
+    // setup costs aren't paid on a live one
+    void warmUp(cv::Size frameSize);
+
+    // Times every candidate on frames and returns the fastest whose face boxes cover at least
+    // accuracyFloor of the face boxes the first candidate (the reference) finds, at IoU 0.5.
+    // The reference always qualifies, and has to be able to find faces: anything else it
+    // detects says nothing about a face detector's recall
+    static std::unique_ptr<Detector> select(std::vector<std::unique_ptr<Detector>> candidates, const std::vector<cv::Mat>& frames,
+                                            float accuracyFloor);
+
+};
+
+// How a TFLite interpreter uses the CPU
+struct TfliteCpuConfig {
+    int threads = 3;       // <= 0 times Invoke at every count up to the core count at startup and keeps the fastest
+    bool xnnpack = true;   // run float and int8 ops through the XNNPACK delegate; ignored on the Edge TPU
+    int maxBatch = 1;      // frames detectBatch resizes the input to; models whose outputs can't batch stay at 1
+};
+
+// SSD-style TFLite models on the CPU or an Edge TPU, with boxes, classes, scores and count as outputs
+class TfliteDetector : public Detector {
+public:
+
+    // swapRB feeds BGR frames to an RGB model; letterbox keeps the aspect ratio by padding
+    TfliteDetector(std::string modelPath, std::string labelsPath, double confidenceThresh=0.5, bool useTpu=false, bool swapRB=true, bool letterbox=false,
+                   TfliteCpuConfig cpu = TfliteCpuConfig());
+    // An interpreter over an already loaded model, so several can share it. A null tpu builds a CPU interpreter
+    TfliteDetector(std::shared_ptr<tflite::FlatBufferModel> model, std::shared_ptr<edgetpu::EdgeTpuContext> tpu, std::vector<std::string> labels,
+                   double confidenceThresh=0.5, bool swapRB=true, bool letterbox=false, TfliteCpuConfig cpu = TfliteCpuConfig());
+    void detect(const cv::Mat& src, Detections& detections) override;
+    void detectBatch(const cv::Mat* frames, size_t count, Detections* detections) override;
+    // Scales and converts the planes straight into the input tensor
+    void detectYuv(const YuvPlanes* frames, size_t count, Detections* detections) override;
+    int maxBatch() const override { return _maxBatch; }
+    const char* name() const override { return _edgetpu_context ? "tflite-tpu" : "tflite"; }
+    bool hasLabel(const char* label) const override;
+
+    static std::shared_ptr<tflite::FlatBufferModel> loadModel(std::string modelPath);
+    static std::vector<std::string> loadLabels(std::string labelsPath);
 
 private:
 
-    std::unique_ptr<tflite::Interpreter> buildEdgeTpuInterpreter(const tflite::FlatBufferModel& model, edgetpu::EdgeTpuContext* edgetpu_context);
-    bool readFileContents(std::string fileName, std::vector<std::string>& lines);
+    std::unique_ptr<tflite::Interpreter> buildEdgeTpuInterpreter(const tflite::FlatBufferModel& model, edgetpu::EdgeTpuContext* edgetpu_context, int numThreads);
+    void buildCpuInterpreter(int numThreads, bool xnnpack);
+    // Rebuilds the CPU interpreter at each thread count and keeps the one with the fastest Invoke
+    int autotuneThreads(bool xnnpack);
+    static bool readFileContents(std::string fileName, std::vector<std::string>& lines);
+    // Resizes the input to batch frames. False if the interpreter or its outputs can't follow
+    bool resizeBatch(int batch);
+    Letterbox fillInput(const cv::Mat& src, int slot);
+    Letterbox fillInput(const YuvPlanes& src, int slot);
+    // Where a slot's uint8 pixels go: the tensor itself, or staging for a float model
+    uint8_t* slotPixels(int slot);
+    // Scales staged pixels into a float model's input
+    void normalizeSlot(int slot);
+    // Frames in batches of up to maxBatch, fill(frame, slot) loading each into the input
+    template <typename Fill>
+    void runBatches(size_t count, Detections* detections, Fill fill);
+    // Runs the model on the filled slots and decodes each frame's boxes
+    void invokeAndDecode(size_t count, Detections* detections);
 
-    std::unique_ptr<tflite::FlatBufferModel> _model;
+    std::shared_ptr<tflite::FlatBufferModel> _model;
+    // Declared before the interpreter so it outlives it
+    std::unique_ptr<TfLiteDelegate, void (*)(TfLiteDelegate*)> _delegate{nullptr, TfLiteXNNPackDelegateDelete};
     std::unique_ptr<tflite::Interpreter> _interpreter;
     std::shared_ptr<edgetpu::EdgeTpuContext> _edgetpu_context;
     std::vector<std::string> _labels;
 
     double _confidenceThresh;
+    bool _swapRB;
+    bool _letterbox;
+
+    // Model input geometry, read from the input tensor
+    int _inputWidth;
+    int _inputHeight;
+    TfLiteType _inputType;
+    int _maxBatch = 1;
+    int _batch = 1;  // what the input is sized for now
+    // One per batch slot, so slots fill in parallel
+    std::vector<TensorResizer> _resizers;
+    std::vector<YuvTensorResizer> _yuvResizers;
+    std::vector<Letterbox> _boxes;
+    std::vector<uint8_t> _scratch;  // staging for float models only
 
 };
\ No newline at end of file
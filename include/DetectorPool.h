@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Detector.h"
+#include "FrameResult.h"
+#include "SpscQueue.h"
+
+enum class Dispatch {
+    RoundRobin,
+    LeastLoaded
+};
+
+struct DetectorPoolConfig {
+    bool useTpus = true;            // one interpreter per Edge TPU found
+    int cpuInterpreters = 0;        // plus this many CPU interpreters; needs a model without the Edge TPU custom op
+    int threadsPerInterpreter = 1;
+    bool xnnpack = true;            // XNNPACK delegate on the CPU interpreters
+    Dispatch dispatch = Dispatch::LeastLoaded;
+    size_t workerDepth = 2;         // frames queued per interpreter
+    double confidenceThresh = 0.5;
+    bool swapRB = true;
+    bool letterbox = false;
+};
+
+// Runs several interpreters over one shared model, each on its own thread, and hands
+// results back in the order frames were submitted. submit() and next() may be called from
+// different threads, but each from only one.
+class DetectorPool {
+public:
+
+    DetectorPool(std::string modelPath, std::string labelsPath, DetectorPoolConfig config = DetectorPoolConfig());
+    ~DetectorPool();
+
+    // One synthetic frame of each size through every worker at once, each on its own
+    // interpreter. Only before the first submit(), while the workers have nothing to do
+    void warmUp(const std::vector<cv::Size>& sizes);
+
+    // Blocks while the chosen interpreter is busy or too many results are waiting. Returns false once closed
+    bool submit(FrameResult&& item);
+    // Sends a frame through to next() in order without running a detector on it
+    bool pass(FrameResult&& item);
+    // Next result in submission order. Returns false once closed and everything submitted is back
+    bool next(FrameResult& item);
+    // Stops accepting frames; frames already submitted still come out of next()
+    void close();
+
+    size_t size() const { return _workers.size(); }
+    const std::string& workerName(size_t i) const { return _workers[i]->name; }
+    uint64_t workerProcessed(size_t i) const { return _workers[i]->processed.load(std::memory_order_relaxed); }
+
+    bool failed() const { return _failed.load(std::memory_order_acquire); }
+    // The first worker error, copied out under the lock the workers set it under
+    std::string error() const;
+
+private:
+
+    struct Job {
+        uint64_t sequence = 0;
+        FrameResult item;
+    };
+
+    struct Worker {
+        std::string name;
+        std::unique_ptr<Detector> detector;
+        std::unique_ptr<SpscQueue<Job>> queue;
+        std::thread thread;
+        std::atomic<int> inFlight{0};
+        std::atomic<uint64_t> processed{0};
+    };
+
+    enum SlotState : uint8_t { Empty, Ready, Dropped };
+
+    void addWorker(std::string name, std::unique_ptr<Detector> detector);
+    void workerLoop(Worker& worker);
+    size_t pickWorker();
+    void complete(uint64_t sequence, FrameResult&& item, SlotState state);
+
+    DetectorPoolConfig _config;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    size_t _nextWorker = 0;
+
+    // Reorder buffer, indexed by sequence % size
+    std::vector<FrameResult> _slots;
+    std::vector<SlotState> _states;
+    uint64_t _submitted = 0;
+    uint64_t _delivered = 0;
+    bool _closed = false;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+    void fail(const std::string& error);
+
+    std::atomic<bool> _failed{false};
+    mutable std::mutex _errorMutex;
+    std::string _error;
+
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
@@ -8,11 +10,15 @@
 class Display {
 public:
 
-    Display();
-    bool show(cv::Mat& frame, std::vector<Detection>& detections, double fps);
+    Display(bool printDetections = true);
+    bool show(cv::Mat& frame, Detections& detections, double fps, const char* window = "Stream");
+    // Draws the overlay without putting it on screen
+    void visualize(cv::Mat& input, Detections& detections, double fps);
 
 private:
 
-    void visualize(cv::Mat& input, std::vector<Detection>& detections, double fps);
+    bool _printDetections;
+    // Label text, reused so drawing a frame doesn't allocate
+    std::string _text;
 
 };
\ No newline at end of file
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "FixedVector.h"
+#include "FrameResult.h"
+#include "SpscQueue.h"
+
+// The detection event log: every frame's detections, appended to a directory of segment files
+// named events-<first capture time in µs>.nvlog, for nameVaultLog to scan and export later.
+//
+// Segment layout, little endian as both the Pi and x86 are:
+//   EventSegmentHeader (one page) | records, each padded to 8 bytes
+// A record is an EventRecord followed by count LoggedDetections for a frame, or by count bytes
+// of text for a string the frames refer to by id. A string is written to a segment before the
+// first frame that uses it, so every segment reads on its own.
+//
+// Each record carries a checksum and is written before the header's used count takes it in,
+// so a crash or a power cut loses the tail of a segment but never garbles what came before.
+
+struct EventSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;  // where the records start
+    uint64_t capacity;     // bytes reserved for records when the segment was created
+    uint64_t used;         // bytes of complete records
+    int64_t minTimeUs;     // capture times, microseconds since the epoch
+    int64_t maxTimeUs;
+    uint64_t frames;
+    uint64_t detections;
+};
+
+enum class EventType : uint16_t {Frame = 1, String = 2};
+
+struct EventRecord {
+    uint32_t bytes;       // the whole record, padding included
+    uint16_t type;
+    uint16_t count;       // detections, or the string's length without its nul
+    uint32_t checksum;    // FNV-1a of the record apart from this field
+    uint16_t source;
+    uint16_t flags;       // kEventDetected
+    uint64_t frameIndex;  // the string's id for a string
+    int64_t timeUs;
+};
+
+// Compact detection: pixel coordinates and scores in 16 bits are plenty to search and plot by
+struct LoggedDetection {
+    uint16_t x1, y1, x2, y2;
+    uint16_t score;       // x 65535
+    uint16_t matchScore;  // x 65535
+    int32_t trackId;
+    uint32_t label;       // string ids, 0 for none
+    uint32_t name;
+};
+
+static_assert(sizeof(EventRecord) == 32, "EventRecord is part of the file format");
+static_assert(sizeof(LoggedDetection) == 24, "LoggedDetection is part of the file format");
+
+// The frame's detections came from the detector rather than the tracker
+static const uint16_t kEventDetected = 1;
+
+struct EventLogConfig {
+    size_t segmentBytes = 16 << 20;  // a segment is closed and a new one started once this is full
+    uint64_t maxBytes = 0;           // oldest segments are deleted past this much in the directory, 0 keeps all
+    size_t queueDepth = 256;         // frames waiting for the writer before new ones are dropped
+    bool emptyFrames = false;        // log frames without detections too
+    int syncIntervalMs = 5000;       // how often the writer syncs to storage, 0 leaves it to the kernel
+};
+
+// Appends results to the event log from a background thread. record() copies the detections
+// into a lock-free ring and returns; the writer polls the ring rather than waiting on it, so
+// the caller never has to wake it and the hot path makes no system calls. The writer copies
+// into a mapped, preallocated segment, so appending doesn't make any either.
+//
+// Labels and names are logged by pointer and read on the writer thread, so whatever they point
+// into (the detector's labels, the recognizer's vault) has to outlive stop().
+class EventLog {
+public:
+
+    // Creates dir if needed
+    EventLog(std::string dir, EventLogConfig config = EventLogConfig());
+    ~EventLog();
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+
+    void start();
+    // Writes what's queued, closes the segment and joins
+    void stop();
+    // Queues the frame's detections. Returns false if the writer fell behind and the frame was dropped
+    bool record(const FrameResult& result);
+
+    uint64_t logged() const { return _logged.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+    const std::string& dir() const { return _dir; }
+
+    // The segment files in dir in name order: oldest first, unless the clock was stepped in between
+    static std::vector<std::string> segments(const std::string& dir);
+
+    static const uint32_t kVersion = 1;
+
+private:
+
+    struct EventDetection {
+        float x1, y1, x2, y2;
+        float score;
+        float matchScore;
+        int trackId;
+        const char* label;
+        const char* name;
+    };
+
+    struct Event {
+        uint64_t index = 0;
+        int64_t steadyUs = 0;  // capture time on the steady clock; the writer puts it on the system clock
+        int source = 0;
+        bool detected = false;
+        FixedVector<EventDetection, kMaxDetections> detections;
+    };
+
+    void run();
+    void write(const Event& event);
+    uint32_t stringId(const char* text);
+    // Named by the first frame's capture time, on the steady clock like Event's
+    void openSegment(int64_t steadyUs);
+    void closeSegment();
+    void sync();
+    void enforceLimit();
+    // A record at the end of the segment, taken in by commit() once it's filled in
+    EventRecord* begin(EventType type, uint16_t count, size_t payload);
+    void commit(EventRecord* record);
+
+    std::string _dir;
+    EventLogConfig _config;
+    int64_t _clockOffsetUs = 0;  // system clock minus steady clock, refreshed by the writer at each segment and sync
+
+    SpscQueue<Event> _queue;
+    std::thread _thread;
+    std::atomic<bool> _stopping{false};
+    std::atomic<uint64_t> _logged{0};
+    std::atomic<uint64_t> _dropped{0};
+    bool _failed = false;
+
+    // The open segment, touched only by the writer
+    std::string _path;
+    int _fd = -1;
+    uint8_t* _base = nullptr;
+    EventSegmentHeader* _header = nullptr;
+    size_t _synced = 0;
+    std::unordered_map<const char*, uint32_t> _ids;  // strings already in the segment
+    std::vector<const char*> _newStrings;
+
+};
+
+// A segment mapped read-only. Opening one only reads its header, so a scan can pass over
+// segments outside the times it wants without touching their records.
+class EventSegment {
+public:
+
+    explicit EventSegment(std::string path);
+    ~EventSegment();
+    EventSegment(const EventSegment&) = delete;
+    EventSegment& operator=(const EventSegment&) = delete;
+
+    const EventSegmentHeader& header() const { return *_header; }
+    const std::string& path() const { return _path; }
+
+    // Steps to the next frame, taking in the strings on the way. Returns false at the end of
+    // what was written, or at a record that fails its checksum (the tail a crash cut off)
+    bool next(const EventRecord*& frame);
+    // The walk stopped early on a damaged record
+    bool damaged() const { return _damaged; }
+
+    const LoggedDetection* detections(const EventRecord* frame) const { return (const LoggedDetection*)(frame + 1); }
+    // Text of a string id seen so far, "" for none or unknown
+    const char* text(uint32_t id) const { return id < _strings.size() && _strings[id] ? _strings[id] : ""; }
+
+private:
+
+    std::string _path;
+    int _fd = -1;
+    uint8_t* _base = nullptr;
+    size_t _length = 0;
+    const EventSegmentHeader* _header = nullptr;
+    size_t _offset = 0;
+    size_t _end = 0;
+    bool _damaged = false;
+    std::vector<const char*> _strings;
+
+};
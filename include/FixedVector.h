@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// A vector with its storage inline and a fixed capacity, so filling, copying and moving one
+// never touches the heap. push_back on a full vector drops the item and returns false.
+template <typename T, size_t N>
+class FixedVector {
+public:
+
+    FixedVector() {}
+    FixedVector(const FixedVector& other) { *this = other; }
+    FixedVector& operator=(const FixedVector& other) {
+        // Only the live items are copied
+        _size = other._size;
+        std::copy(other._items, other._items + _size, _items);
+        return *this;
+    }
+
+    bool push_back(const T& item) {
+        if (_size == N) return false;
+        _items[_size++] = item;
+        return true;
+    }
+    void pop_back() { _size--; }
+    void clear() { _size = 0; }
+    // Grows with default items, clamped to the capacity
+    void resize(size_t size) {
+        size = std::min(size, N);
+        for (size_t i = _size; i < size; i++) _items[i] = T();
+        _size = size;
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    bool full() const { return _size == N; }
+    static constexpr size_t capacity() { return N; }
+
+    T& operator[](size_t i) { return _items[i]; }
+    const T& operator[](size_t i) const { return _items[i]; }
+    T& back() { return _items[_size - 1]; }
+    const T& back() const { return _items[_size - 1]; }
+    T* data() { return _items; }
+    const T* data() const { return _items; }
+    T* begin() { return _items; }
+    T* end() { return _items + _size; }
+    const T* begin() const { return _items; }
+    const T* end() const { return _items + _size; }
+
+private:
+
+    T _items[N];
+    size_t _size = 0;
+
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+
+#include <opencv2/core.hpp>
+
+#include "YuvPlanes.h"
+
+// A reusable claim on one lent-out frame buffer. Every lease on the buffer shares the claim,
+// and release() hands the buffer back to its lender when the last one lets go. Lenders
+// preallocate their claims, so leasing a frame never touches the heap.
+class FrameClaim {
+public:
+
+    virtual ~FrameClaim() {}
+    void retain() { _holders.fetch_add(1, std::memory_order_relaxed); }
+    void drop() {
+        if (_holders.fetch_sub(1, std::memory_order_acq_rel) == 1) release();
+    }
+    long holders() const { return _holders.load(std::memory_order_relaxed); }
+
+protected:
+
+    virtual void release() = 0;
+
+private:
+
+    std::atomic<long> _holders{0};
+
+};
+
+// A frame together with a shared claim on the buffer behind it. Copies share the claim,
+// and the buffer is given back to its owner when the last copy is released, so stages
+// can pass a camera buffer along without copying the pixels.
+class FrameLease {
+public:
+
+    FrameLease() {}
+    // A frame that owns its pixels, nothing to give back
+    explicit FrameLease(cv::Mat image);
+    // A view into a borrowed buffer, given back through claim when the last copy goes away
+    FrameLease(cv::Mat image, FrameClaim* claim, bool readOnly = true);
+    // A borrowed YUV 4:2:0 frame. image() is its luma plane; colour is converted on request
+    FrameLease(const YuvPlanes& planes, FrameClaim* claim);
+    FrameLease(const FrameLease& other);
+    FrameLease(FrameLease&& other);
+    FrameLease& operator=(const FrameLease& other);
+    FrameLease& operator=(FrameLease&& other);
+    ~FrameLease();
+
+    // The frame in BGR, or just the luma plane of a YUV frame
+    const cv::Mat& image() const { return _image; }
+    bool isYuv() const { return !_yuv.empty(); }
+    const YuvPlanes& yuv() const { return _yuv; }
+    // The frame in BGR whatever it came in as, converted into scratch only for YUV frames
+    const cv::Mat& bgr(cv::Mat& scratch) const;
+    // A BGR frame that can be drawn on, copied only if the buffer is read-only
+    cv::Mat writable() const;
+    // The same, copying into scratch so a reused buffer takes the copy
+    cv::Mat writable(cv::Mat& scratch) const;
+
+    bool empty() const { return _image.empty(); }
+    bool borrowed() const { return _claim != nullptr; }
+    long holders() const { return _claim ? _claim->holders() : 0; }
+    void reset();
+
+private:
+
+    cv::Mat _image;
+    YuvPlanes _yuv;
+    FrameClaim* _claim = nullptr;
+    bool _readOnly = false;
+
+};
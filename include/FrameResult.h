@@ -0,0 +1,18 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "Detector.h"
+#include "FrameLease.h"
+
+// A frame and whatever the stages so far found in it
+struct FrameResult {
+    uint64_t index = 0;  // per source
+    int source = 0;      // which of the pipeline's sources the frame came from
+    FrameLease frame;
+    Detections detections;
+    bool detected = false;  // detections came from the detector rather than the tracker
+    std::chrono::steady_clock::time_point captureTime;
+};
@@ -30,11 +30,15 @@
 #include <libcamera/formats.h>
 #include <libcamera/transform.h>
 
+#include "CompletionQueue.h"
+
 // using namespace libcamera;
 
 typedef struct {
-    uint8_t *imageData;
-    uint32_t size;
+    uint8_t *imageData;     // the first plane
+    uint8_t *planes[3];     // Y, U and V for YUV420, just the one for packed formats
+    uint32_t planeCount;
+    uint32_t size;          // bytes used across all planes
     uint64_t request;
 } LibcameraOutData;
 
@@ -43,11 +47,17 @@ class LibCamera {
         LibCamera(){};
         ~LibCamera(){};
         
-        int initCamera();
+        // index counts the cameras libcamera found, in its order
+        int initCamera(int index = 0);
         void configureStream(int width, int height, libcamera::PixelFormat format, int buffercount, int rotation);
         int startCamera();
         int resetCamera(int width, int height, libcamera::PixelFormat format, int buffercount, int rotation);
-        bool readFrame(LibcameraOutData *frameData);
+        // Waits up to timeoutMs for a completed request, forever if negative. Single consumer only
+        bool readFrame(LibcameraOutData *frameData, int timeoutMs = 0);
+        // Readable while completed requests are waiting; poll() it together with other fds
+        int frameFd() const;
+        // Buffers allocated when the camera started, each with its own request; may be more than configureStream() asked for
+        size_t bufferCount() const { return requests_.size(); }
         void returnFrameBuffer(LibcameraOutData frameData);
 
         void set(libcamera::ControlList controls);
@@ -67,7 +77,8 @@ class LibCamera {
 
         unsigned int cameraIndex_;
 	    uint64_t last_;
-        std::unique_ptr<libcamera::CameraManager> cm;
+        // libcamera allows one manager per process, so every LibCamera shares it
+        std::shared_ptr<libcamera::CameraManager> cm;
         std::shared_ptr<libcamera::Camera> camera_;
         bool camera_acquired_ = false;
         bool camera_started_ = false;
@@ -77,7 +88,8 @@ class LibCamera {
         // std::map<std::string, Stream *> stream_;
         std::map<int, std::pair<void *, unsigned int>> mappedBuffers_;
 
-        std::queue<libcamera::Request *> requestQueue;
+        // Filled from libcamera's callback thread, drained by readFrame
+        CompletionQueue<libcamera::Request *> requestQueue{64};
 
         libcamera::ControlList controls_;
         std::mutex control_mutex_;
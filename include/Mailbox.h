@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Bounded handoff where the newest items win, one slot unless asked for more. put() never
+// waits: when every slot is full it evicts the oldest item and hands that back, so the
+// caller can count it and let go of it outside the lock.
+template <typename T>
+class Mailbox {
+public:
+
+    explicit Mailbox(size_t capacity = 1) : _slots(capacity) {
+        if (capacity == 0) {
+            throw std::runtime_error("Mailbox::Mailbox - Capacity must be at least 1");
+        }
+    }
+
+    // Moves the oldest item the consumer hadn't taken into stale and sets displaced when
+    // there was no room. Returns false without storing anything once closed
+    bool put(T&& item, T& stale, bool& displaced) {
+        displaced = false;
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_closed) return false;
+        if (_count == _slots.size()) {
+            stale = std::move(_slots[_head]);
+            _head = (_head + 1) % _slots.size();
+            _count--;
+            displaced = true;
+        }
+        _slots[(_head + _count) % _slots.size()] = std::move(item);
+        _count++;
+        _cond.notify_one();
+        return true;
+    }
+
+    // Blocks until an item is available, oldest first. Returns false once the mailbox is closed and empty
+    bool take(T& item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return _count > 0 || _closed; });
+        if (_count == 0) return false;
+        pop(item);
+        return true;
+    }
+
+    bool tryTake(T& item) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_count == 0) return false;
+        pop(item);
+        return true;
+    }
+
+    // Wakes the consumer; items already in the slots can still be taken
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _cond.notify_all();
+    }
+
+    bool closed() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _closed;
+    }
+    bool full() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _count == _slots.size();
+    }
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _count;
+    }
+
+private:
+
+    void pop(T& item) {
+        item = std::move(_slots[_head]);
+        _slots[_head] = T(); // don't keep the moved-from item (and anything it references) alive
+        _head = (_head + 1) % _slots.size();
+        _count--;
+    }
+
+    std::vector<T> _slots;
+    size_t _head = 0;
+    size_t _count = 0;
+    bool _closed = false;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+
+};
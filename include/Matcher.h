@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "NameVault.h"
+
+struct Match {
+    uint32_t row;
+    float score;
+};
+
+struct MatcherConfig {
+    int threads = 1;              // threads the exact search splits the gallery over
+    size_t minRowsPerThread = 4096;  // smaller shards aren't worth waking a thread for
+    size_t ivfMinRows = 20000;    // build the approximate index for galleries at least this big
+    int ivfLists = 0;             // inverted lists, 0 for sqrt(rows)
+    int ivfProbe = 8;             // lists scanned per query
+};
+
+// Nearest neighbour search over a NameVault's embeddings by cosine similarity. The exact search
+// scans every row with a SIMD dot product on the stored int8 or fp16 rows (NEON on the Pi,
+// AVX2 on x86 when the CPU has it) and keeps a top-k heap per shard. Big galleries also get an
+// IVF index: rows are bucketed by k-means centroid and a query only scans the closest buckets.
+//
+// Not reentrant; one thread searches at a time.
+class Matcher {
+public:
+
+    Matcher(const NameVault& vault, MatcherConfig config = MatcherConfig());
+    ~Matcher();
+
+    // Best k rows for a normalised query, best first. Uses the index when there is one
+    void search(const float* query, int k, std::vector<Match>& matches);
+    void searchExact(const float* query, int k, std::vector<Match>& matches);
+    void searchApprox(const float* query, int k, std::vector<Match>& matches);
+
+    bool hasIndex() const { return !_lists.empty(); }
+    // Builds (or rebuilds) the IVF index with the given number of lists
+    void buildIndex(int lists);
+
+private:
+
+    void prepareQuery(const float* query);
+    void scan(const uint32_t* ids, size_t begin, size_t end, std::vector<float>& scores) const;
+    void scanShard(int shard);
+    void workerLoop(int shard);
+
+    const NameVault& _vault;
+    MatcherConfig _config;
+
+    // The current query, in the forms the kernels want
+    float _query[kEmbeddingSize];
+    int8_t _query8[kEmbeddingSize];
+    int16_t _query16[kEmbeddingSize];
+    float _queryScale = 1;
+    int _k = 1;
+
+    // Exact search shards; shard 0 runs on the caller
+    int _shards = 1;
+    std::vector<std::vector<Match>> _heaps;
+    std::vector<std::vector<float>> _scores;
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    uint64_t _generation = 0;
+    int _pending = 0;
+    bool _stop = false;
+
+    // IVF index
+    std::vector<float> _centroids;  // lists x kEmbeddingSize
+    std::vector<std::vector<uint32_t>> _lists;
+    std::vector<std::pair<float, int>> _probe;
+
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+// Always-on counters, gauges and latency histograms. Counters and histograms are kept per
+// thread and each thread only writes its own shard with relaxed loads and stores, so the
+// hot path never contends or locks. The exporter sums the shards when it renders.
+//
+// Metrics are meant to be declared once as statics. A name may carry Prometheus labels,
+// e.g. "namevault_frames_dropped_total{stage=\"capture\"}".
+
+class Counter {
+public:
+
+    Counter(const char* name, const char* help);
+    void add(uint64_t n = 1) const;
+    uint64_t value() const;
+
+private:
+
+    int _id;
+
+};
+
+class Gauge {
+public:
+
+    Gauge(const char* name, const char* help);
+    void set(double value) { _value.store(value, std::memory_order_relaxed); }
+    double value() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+
+    std::atomic<double> _value{0};
+
+};
+
+// Latency histogram with fixed buckets from 100 us to 1 s
+class Histogram {
+public:
+
+    Histogram(const char* name, const char* help);
+    void observe(std::chrono::steady_clock::duration elapsed) const;
+
+private:
+
+    int _id;
+
+};
+
+// Observes the time between construction and destruction
+class ScopedTimer {
+public:
+
+    explicit ScopedTimer(const Histogram& histogram) : _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { _histogram.observe(std::chrono::steady_clock::now() - _start); }
+
+private:
+
+    const Histogram& _histogram;
+    std::chrono::steady_clock::time_point _start;
+
+};
+
+// Every registered metric in the Prometheus text exposition format
+std::string renderMetrics();
+
+// Periodically rewrites a Prometheus text file (for node_exporter's textfile collector) and/or
+// serves the same text to anything that connects to a UNIX socket. Either path may be empty.
+class MetricsExporter {
+public:
+
+    MetricsExporter(std::string textFile, std::string socketPath, std::chrono::milliseconds interval);
+    ~MetricsExporter();
+
+private:
+
+    void loop();
+    void writeFile();
+    void serveClient();
+
+    std::string _textFile;
+    std::string _socketPath;
+    std::chrono::milliseconds _interval;
+
+    int _listenFd = -1;
+    int _wakeFd = -1;
+    std::atomic<bool> _running{true};
+    std::thread _thread;
+
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+struct MotionGateConfig {
+    bool enabled = false;
+    int cell = 8;               // frame pixels per side of one luma cell
+    int threshold = 10;         // luma change, 0-255, for a cell to count as changed
+    float sensitivity = 0.005;  // share of cells that have to change for the frame to count as motion
+    int refreshEvery = 30;      // frames after which the detector runs anyway
+    float adaptRate = 0.02;     // how fast the background follows slow changes such as daylight
+};
+
+// Decides whether a frame is worth running the detector on. Each frame is averaged down to
+// one luma value per cell (a vectorised column sum, then one pass per cell) and compared
+// against a running-average background, so sensor noise and slow lighting changes don't
+// count as motion. Costs well under a millisecond on a VGA frame. Forcing the detector to
+// run every refreshEvery frames is up to the caller, which knows when it last ran.
+class MotionGate {
+public:
+
+    MotionGate(MotionGateConfig config = MotionGateConfig());
+
+    // True when enough cells differ from the background. Every frame updates the background,
+    // so call it on all of them
+    bool changed(const cv::Mat& frame);
+    // Share of cells that differed in the last frame
+    float changedShare() const { return _changedShare; }
+
+private:
+
+    void downscale(const cv::Mat& frame);
+
+    MotionGateConfig _config;
+    int _cellsX = 0;
+    int _cellsY = 0;
+    int _channels = 0;
+    bool _primed = false;
+    float _changedShare = 0;
+
+    // Reused between frames
+    std::vector<uint16_t> _columnSums;  // one band of rows summed down the cell, per byte
+    std::vector<float> _luma;
+    std::vector<float> _background;
+
+};
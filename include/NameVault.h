@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Detector.h"
+
+// The on-disk identity store. The file is mmapped, so opening it parses nothing and a large
+// gallery lives in the page cache rather than on the heap.
+//
+// Layout, every section page aligned so rows are aligned for SIMD loads:
+//   VaultHeader | names (capacity x nameWidth, nul padded) | int8 row scales (capacity floats)
+//   | embeddings (capacity x rowBytes)
+//
+// Appends write the row and sync it before bumping the count in the header, so a crash
+// mid-enrollment leaves the vault as it was.
+
+enum class VaultFormat : uint32_t {Fp16 = 0, Int8 = 1};
+
+struct VaultHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t dim;
+    uint32_t nameWidth;
+    uint32_t rowBytes;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t namesOffset;
+    uint64_t scalesOffset;
+    uint64_t embeddingsOffset;
+    uint64_t fileSize;
+    uint32_t checksum;  // FNV-1a of everything above
+    uint32_t pad;
+};
+
+class NameVault {
+public:
+
+    NameVault() {};
+    // Maps and validates the vault. Validation only looks at the header, so it's O(1)
+    explicit NameVault(std::string path, bool writable=false);
+    ~NameVault();
+    NameVault(const NameVault&) = delete;
+    NameVault& operator=(const NameVault&) = delete;
+
+    // Writes an empty vault, or a copy of from with room for capacity rows, and renames it into
+    // place. A copy has to be made under from's lock, as append() does when it grows the vault
+    static void create(std::string path, VaultFormat format, size_t capacity, const NameVault* from=nullptr);
+
+    // Rows enrolled when the vault was opened; reopen to see later enrollments
+    size_t size() const { return _count; }
+    size_t capacity() const { return _header->capacity; }
+    VaultFormat format() const { return (VaultFormat)_header->format; }
+    size_t rowBytes() const { return _header->rowBytes; }
+
+    // The name in row i's slot. append() always leaves the slot's last byte nul; a slot without
+    // one was damaged, and reads as no name rather than running into the next slot
+    const char* name(size_t i) const {
+        const char* slot = (const char*)_base + _header->namesOffset + i * _header->nameWidth;
+        return slot[_header->nameWidth - 1] == '\0' ? slot : nullptr;
+    }
+    const void* row(size_t i) const { return _base + _header->embeddingsOffset + i * _header->rowBytes; }
+    const float* scales() const { return (const float*)(_base + _header->scalesOffset); }
+
+    // Cosine similarity of a normalised query with row i
+    float dot(size_t i, const float* query) const;
+    void decode(size_t i, float* embedding) const;
+
+    // Quantises and appends an identity, returning its row. Needs a writable vault with room,
+    // or grow to rewrite a full vault at twice the capacity first
+    size_t append(const std::string& name, const float* embedding, bool grow=false);
+    // Appends n identities (embeddings is n x kEmbeddingSize) with a single sync, returning the first row
+    size_t append(const std::string* names, const float* embeddings, size_t n, bool grow=false);
+
+    static const uint32_t kVersion = 1;
+    static const uint32_t kNameWidth = 64;
+
+private:
+
+    // Opens, maps and validates _path
+    void map();
+    void unmap();
+    // Takes the vault's lock, following the path to a new file if a grow replaced this one
+    void lock();
+    void writeRow(size_t i, const std::string& name, const float* embedding);
+
+    std::string _path;
+    int _fd = -1;
+    uint8_t* _base = nullptr;
+    size_t _length = 0;
+    bool _writable = false;
+    const VaultHeader* _header = nullptr;
+    size_t _count = 0;
+
+};
+
+// IEEE half precision, so fp16 vaults read the same on the Pi and on x86
+inline uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+    if (((x >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+    if (exp >= 31) return sign | 0x7c00;
+    if (exp <= 0) {
+        // Subnormal, or too small for even that
+        if (exp < -10) return sign;
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) half++;
+        return sign | half;
+    }
+    // Round to nearest even; a carry into the exponent is still the right answer
+    uint32_t half = sign | (exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+    return half;
+}
+
+inline float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0) {
+        float f = mant * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    uint32_t x = exp == 31 ? sign | 0x7f800000 | (mant << 13) : sign | ((exp + 112) << 23) | (mant << 13);
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "Detector.h"
+#include "DetectorPool.h"
+#include "FrameResult.h"
+#include "Mailbox.h"
+#include "Metrics.h"
+#include "MotionGate.h"
+#include "Recognizer.h"
+#include "SpscQueue.h"
+#include "Tracker.h"
+#include "VideoSource.h"
+
+struct PipelineConfig {
+    size_t captureDepth = 2;  // frames waiting for inference, per source
+    size_t resultDepth = 2;   // results waiting for the sink
+    DropPolicy captureDrop = DropPolicy::Block;
+    DropPolicy resultDrop = DropPolicy::Block;
+
+    // Capture overwrites a single-slot mailbox and inference always takes the newest frame, so
+    // results never fall behind the camera. Replaces captureDepth and captureDrop. With
+    // adaptiveFrameRate the source is slowed while frames keep going stale, no lower than
+    // minFrameRate, and sped back up once inference keeps up again
+    bool latestFrame = false;
+    bool adaptiveFrameRate = false;
+    double minFrameRate = 5;
+
+    // Tracking carries boxes across frames, so the detector only has to run every detectEvery
+    // frames. Adaptive cadence starts at every frame and doubles up to detectEvery while the
+    // tracks are stable
+    bool track = false;
+    int detectEvery = 1;
+    bool adaptiveCadence = false;
+    TrackerConfig tracker;
+
+    // Frames that barely differ from the background skip the detector, at most refreshEvery in
+    // a row. Without tracking they carry the last detector result
+    MotionGateConfig motionGate;
+
+    // Up to maxBatch frames, from any source, go through the detector in one call: the first
+    // one waiting plus whatever arrives in the next batchWaitMs. Only with a single Detector,
+    // and only worth it for one that batches (see Detector::maxBatch)
+    int maxBatch = 1;
+    double batchWaitMs = 5;
+};
+
+// Runs capture and inference on their own threads, connected to each other and to the
+// sink (whoever calls next()) by bounded SPSC queues, so a frame costs max(stage) rather
+// than sum(stages).
+//
+// Several sources can share one detector. Each gets its own capture thread, queue, tracker
+// and motion gate, and inference takes frames from them round robin, so a source that
+// captures faster than the others can't starve them. Results carry the index of the source
+// they came from.
+class Pipeline {
+public:
+
+    Pipeline(VideoSource& source, Detector& detector, PipelineConfig config = PipelineConfig());
+    // Inference fans out over the pool's interpreters; results still arrive in capture order
+    Pipeline(VideoSource& source, DetectorPool& pool, PipelineConfig config = PipelineConfig());
+    Pipeline(const std::vector<VideoSource*>& sources, Detector& detector, PipelineConfig config = PipelineConfig());
+    Pipeline(const std::vector<VideoSource*>& sources, DetectorPool& pool, PipelineConfig config = PipelineConfig());
+    ~Pipeline();
+
+    // Names the faces in every frame after detection. Set before start()
+    void setRecognizer(Recognizer* recognizer) { _recognizer = recognizer; }
+
+    void start();
+    void stop();
+
+    // Blocks for the next result. Returns false once the pipeline has stopped and drained
+    bool next(FrameResult& result);
+
+    bool failed() const { return _failed.load(std::memory_order_acquire); }
+    // Copied out under the lock the stages set it under
+    std::string error() const;
+
+    // Summed over every source
+    uint64_t captureDropped() const;
+    uint64_t resultDropped() const { return _resultDropped.load(std::memory_order_relaxed); }
+    uint64_t staleDropped() const;
+
+    size_t sourceCount() const { return _streams.size(); }
+    uint64_t captured(size_t source) const { return _streams[source]->captured.load(std::memory_order_relaxed); }
+    // Frames from this source that never reached inference, for whichever reason
+    uint64_t dropped(size_t source) const;
+
+private:
+
+    // Everything that belongs to one source: its capture thread, the frames it has waiting
+    // and the state that follows its scene from frame to frame
+    struct Stream {
+        Stream(VideoSource& source, size_t depth) : source(source), queue(depth) {}
+
+        VideoSource& source;
+        int id = 0;
+        std::thread thread;
+        SpscQueue<FrameResult> queue;
+        Mailbox<FrameResult> latest;
+
+        // Cadence is decided where frames go to the detector, tracking happens where they come back
+        std::unique_ptr<Tracker> tracker;
+        std::atomic<int> interval{1};
+        int sinceDetect = 0;
+        std::unique_ptr<MotionGate> gate;
+        Detections lastDetections;  // what gated frames show when there's no tracker
+
+        std::atomic<uint64_t> captured{0};
+        std::atomic<uint64_t> captureDropped{0};
+        std::atomic<uint64_t> staleDropped{0};
+
+        // Frame rate control, all on the capture thread but for taken
+        std::atomic<uint64_t> taken{0};
+        double nominalRate = 0;
+        Gauge* frameRate = nullptr;  // namevault_capture_frame_rate for this source
+        std::chrono::steady_clock::time_point windowStart;
+        uint64_t windowTaken = 0;
+        uint64_t windowDropped = 0;
+        int busyWindows = 0;
+        int calmWindows = 0;
+    };
+
+    void addStreams(const std::vector<VideoSource*>& sources);
+    void captureLoop(Stream& stream);
+    // Hands a captured frame to inference through the stream's queue or mailbox
+    bool handOff(Stream& stream, FrameResult&& item);
+    bool takeFrom(Stream& stream, FrameResult& item);
+    // The next frame from whichever source is due. Returns false once every source is closed
+    // and drained, or when nothing came by the deadline
+    bool nextCaptured(FrameResult& item, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+    void closeCaptured(Stream& stream);
+    void adaptFrameRate(Stream& stream);
+    void inferenceLoop();
+    // Fills _group with the next batch of frames
+    bool nextGroup(size_t maxBatch);
+    void dispatchLoop();
+    void collectLoop();
+    void fail(const std::string& error);
+    bool detectThisFrame(Stream& stream, const cv::Mat& frame);
+    void track(FrameResult& item);
+    void carryOver(FrameResult& item);
+    void recognize(FrameResult& item);
+
+    Detector* _detector = nullptr;
+    DetectorPool* _pool = nullptr;
+    Recognizer* _recognizer = nullptr;
+    PipelineConfig _config;
+
+    std::vector<std::unique_ptr<Stream>> _streams;
+    SpscQueue<FrameResult> _results;
+
+    // Capture threads ring this after every hand-off, so inference can sleep on all sources at once
+    std::mutex _readyMutex;
+    std::condition_variable _readyCond;
+    size_t _nextStream = 0;
+
+    // One batch on its way through the detector, reused between batches
+    std::vector<FrameResult> _group;
+    std::vector<cv::Mat> _batchFrames;
+    std::vector<size_t> _batchSlots;
+    // YUV frames go through the detector as a batch of their own
+    std::vector<YuvPlanes> _batchYuv;
+    std::vector<size_t> _yuvSlots;
+    std::vector<Detections> _batchDetections;
+    // Full-colour conversion of a YUV frame for the recognizer
+    cv::Mat _colour;
+
+    std::thread _inferenceThread;
+    std::thread _collectThread;
+    std::atomic<bool> _running{false};
+    std::atomic<bool> _failed{false};
+    mutable std::mutex _errorMutex;
+    std::string _error;
+
+    std::atomic<uint64_t> _resultDropped{0};
+
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "YuvPlanes.h"
+
+// Where the source image landed inside the model input, for mapping boxes back
+struct Letterbox {
+    float scaleX = 1.f;  // input pixels per source pixel
+    float scaleY = 1.f;
+    int padX = 0;
+    int padY = 0;
+};
+
+// Bilinear resize, optional letterboxing and optional R/B swap of an 8-bit 3-channel image
+// in a single pass, written straight into a packed HWC uint8 buffer such as a tensor.
+// Horizontal taps are table driven; the vertical blend is SIMD (NEON on aarch64, SSE2 on x86).
+class TensorResizer {
+public:
+
+    Letterbox run(const cv::Mat& src, uint8_t* dst, int dstWidth, int dstHeight, bool swapRB, bool letterbox);
+
+private:
+
+    void prepare(int srcWidth, int srcHeight, int dstWidth, int dstHeight, bool letterbox);
+    void horizontal(const uint8_t* srcRow, int16_t* out, bool swapRB) const;
+
+    // Geometry the tables were built for
+    int _srcWidth = 0, _srcHeight = 0, _dstWidth = 0, _dstHeight = 0;
+    bool _letterbox = false;
+    Letterbox _box;
+    int _innerWidth = 0, _innerHeight = 0;
+
+    std::vector<int> _xOffsets;       // byte offsets of the left tap, two per output pixel
+    std::vector<int16_t> _xWeights;   // Q7 weight of the right tap
+    std::vector<int> _yRows;          // top source row, two per output row
+    std::vector<int16_t> _yWeights;   // Q7 weight of the bottom row
+
+    // Horizontally filtered source rows in Q7, kept so neighbouring output rows can share them
+    std::vector<int16_t> _rows[2];
+    int _rowIndex[2] = {-1, -1};
+
+};
+
+// The same resize and letterbox straight from YUV 4:2:0 planes, so a camera can deliver 1.5
+// bytes a pixel instead of 3. Each plane is scaled on its own, chroma sampled as if replicated
+// to full size the way cv::cvtColor does it, and the scaled rows are converted to RGB, or BGR without swapRB, in the same pass, so only
+// model-sized pixels ever go through the colour conversion. The vertical blend and the colour
+// conversion are SIMD (NEON on aarch64, SSE2 on x86).
+class YuvTensorResizer {
+public:
+
+    Letterbox run(const YuvPlanes& src, uint8_t* dst, int dstWidth, int dstHeight, bool swapRB, bool letterbox);
+
+private:
+
+    // Horizontally filtered rows of one plane in Q7, the last two kept for neighbouring output rows
+    struct PlaneRows {
+        std::vector<int16_t> rows[2];
+        int index[2] = {-1, -1};
+    };
+
+    void prepare(int srcWidth, int srcHeight, int dstWidth, int dstHeight, bool letterbox);
+    const int16_t* fetch(PlaneRows& cache, const uint8_t* plane, int stride, int row, int keep, bool chroma);
+
+    int _srcWidth = 0, _srcHeight = 0, _dstWidth = 0, _dstHeight = 0;
+    bool _letterbox = false;
+    Letterbox _box;
+    int _innerWidth = 0, _innerHeight = 0;
+
+    // Taps over the luma plane; the chroma planes share the weights at half the offsets
+    std::vector<int> _xOffsets, _chromaXOffsets;
+    std::vector<int16_t> _xWeights;
+    std::vector<int> _yRows, _chromaYRows;
+    std::vector<int16_t> _yWeights;
+
+    PlaneRows _luma, _u, _v;
+    // One scaled output row per plane, ahead of the colour conversion
+    std::vector<uint8_t> _lumaLine, _uLine, _vLine;
+
+};
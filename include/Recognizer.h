@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/dnn.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "Detector.h"
+#include "Matcher.h"
+#include "NameVault.h"
+
+struct RecognitionCacheConfig {
+    bool enabled = false;
+    float confidentScore = 0.5;  // cached names at least this sure aren't checked again until they're old
+    int maxAge = 150;            // recognize() calls before a cached name is checked again
+    int shotWindow = 3;          // frames of a track to pick the best crop from
+};
+
+// Embeds every face a Detector found with SFace and matches the embeddings against a NameVault.
+// Only face boxes are faces: detections with landmarks or one of the recognized labels, so a
+// general model's people, cars and cups don't get names.
+// All the faces in a frame go through the network as one batch, so a crowded frame costs one
+// forward pass rather than one per face.
+//
+// With the cache on, tracked faces are recognized once and remembered by trackId. A track is
+// only embedded again when its name is unsure or old, and then from the best-quality crop of
+// its last few frames rather than whichever frame came up.
+class Recognizer {
+public:
+
+    Recognizer() {};
+    // matchThresh is the cosine similarity needed to call two faces the same person
+    Recognizer(std::string modelPath, float matchThresh=0.363, int maxBatch=16);
+
+    // Embeds and names every face in the frame
+    void recognize(const cv::Mat& frame, Detections& detections);
+    // A frame the detector skipped: names the tracked faces from the cache by trackId, without
+    // embedding anything. Also keeps the per-second gauges current on frames with no faces
+    void annotate(Detections& detections);
+
+    // Aligns on the landmarks when there are any, otherwise takes a square crop around the box
+    void alignCrop(const cv::Mat& frame, const Detection& detection, cv::Mat& face);
+
+    // Identities to match against; without one, faces get embeddings but no names
+    void setVault(const NameVault* vault, MatcherConfig config = MatcherConfig());
+    // Allocates the cache's slots and their crops up front
+    void setCache(RecognitionCacheConfig config);
+    // Detection labels that are faces, kFaceLabel by default. Empty takes every detection
+    void setLabels(std::vector<std::string> labels) { _labels = std::move(labels); }
+    // Whether recognize() would embed the detection
+    bool isFace(const Detection& detection) const;
+    // One forward pass on a synthetic face, so the first real one doesn't pay for setup
+    void warmUp();
+
+    // Sharpness (Laplacian variance) x size x frontalness (from landmarks), in [0, 1]
+    float faceQuality(const cv::Mat& face, const Detection& detection);
+
+    static const int kInputSize = 112;
+    // Tracks the cache remembers at once. A track whose slot another one took is just embedded again
+    static const int kCacheSlots = 2 * kMaxDetections;
+
+private:
+
+    // What the cache remembers about one track
+    struct CacheEntry {
+        int trackId = -1;
+        uint64_t recognizedAt = 0;
+        bool hasResult = false;
+        const char* name = nullptr;
+        float matchScore = 0;
+        float embedding[kEmbeddingSize];
+        int shots = 0;
+        float bestQuality = -1;
+        cv::Mat bestCrop;
+    };
+
+    void embedBatch(size_t first, size_t count, Detections& detections);
+    void match(Detection& detection);
+    // The track's slot, emptied first if it held another track
+    CacheEntry& cacheSlot(int trackId);
+    bool fresh(const CacheEntry& entry) const;
+    void applyCached(const CacheEntry& entry, Detection& detection) const;
+    cv::Mat& nextFace(size_t detection);
+    // Sets the gauges from the last second's counts once a second has gone by
+    void report();
+
+    cv::dnn::Net _net;
+    float _matchThresh;
+    int _maxBatch;
+    std::vector<std::string> _labels{kFaceLabel};
+
+    // Reused between frames so the steady state doesn't allocate. _faces[i] is the crop for detections[_pending[i]]
+    std::vector<cv::Mat> _faces;
+    std::vector<size_t> _pending;
+    cv::Mat _crop;
+    cv::Mat _gray;
+    cv::Mat _laplacian;
+    cv::Mat _transform;
+    std::vector<cv::Mat> _batch;
+    cv::Mat _blob;
+    cv::Mat _output;
+
+    // Names handed out in detections point into the vault's mapping
+    const NameVault* _vault = nullptr;
+    std::unique_ptr<Matcher> _matcher;
+    std::vector<Match> _matches;
+
+    RecognitionCacheConfig _cacheConfig;
+    std::vector<CacheEntry> _cache;  // kCacheSlots, indexed by a hash of the trackId
+    uint64_t _frame = 0;
+    // Counts over the current second
+    uint64_t _cacheHits = 0;
+    uint64_t _cacheLookups = 0;
+    uint64_t _embedded = 0;
+    std::chrono::steady_clock::time_point _windowStart = std::chrono::steady_clock::now();
+
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/videoio.hpp>
+
+#include "Display.h"
+#include "FrameResult.h"
+#include "Mailbox.h"
+#include "Metrics.h"
+
+// A consumer of pipeline results on its own thread, behind a bounded queue. push() never
+// waits: once depth results are waiting the oldest is dropped and counted, so however slow
+// the sink is (an X server, a disk) it can't hold up the pipeline.
+class Sink {
+public:
+
+    // droppedTotal is the sink kind's share of namevault_frames_dropped_total
+    Sink(std::string name, size_t depth, const Counter& droppedTotal);
+    virtual ~Sink();
+
+    void start();
+    // Lets the queued results drain, then joins. Subclasses call it from their destructor,
+    // before anything consume() uses goes away
+    void stop();
+    void push(FrameResult&& result, double fps);
+
+    // Whether consume() reads the pixels; sinks that don't are handed results without a frame
+    virtual bool needsPixels() const { return true; }
+    // Set by a sink that wants the run to end, such as a key pressed on the display
+    bool quitRequested() const { return _quit.load(std::memory_order_relaxed); }
+
+    const std::string& name() const { return _name; }
+    size_t depth() const { return _depth; }
+    uint64_t consumed() const { return _consumed.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+protected:
+
+    virtual void consume(FrameResult& result, double fps) = 0;
+    // On the sink's thread once the queue has drained
+    virtual void finish() {}
+
+    std::atomic<bool> _quit{false};
+
+private:
+
+    struct Entry {
+        FrameResult result;
+        double fps = 0;
+    };
+
+    void run();
+
+    std::string _name;
+    size_t _depth;
+    const Counter& _droppedTotal;
+    Mailbox<Entry> _queue;
+    std::thread _thread;
+    std::atomic<uint64_t> _consumed{0};
+    std::atomic<uint64_t> _dropped{0};
+    bool _failed = false;
+
+};
+
+// Draws the overlay and shows each source in its own window. A key press asks to quit
+class DisplaySink : public Sink {
+public:
+
+    DisplaySink(std::vector<std::string> windows, size_t depth = 2);
+    ~DisplaySink();
+
+protected:
+
+    void consume(FrameResult& result, double fps) override;
+    void finish() override;
+
+private:
+
+    std::vector<std::string> _windows;
+    Display _display;
+    cv::Mat _canvas;
+
+};
+
+// Writes the annotated frames of each source to a video file. Source 0 goes to path, the
+// others to path with -<source> before the extension. Files open on the first frame, sized to it
+class VideoFileSink : public Sink {
+public:
+
+    VideoFileSink(std::string path, double frameRate, std::string fourcc = "mp4v", size_t depth = 4);
+    ~VideoFileSink();
+
+protected:
+
+    void consume(FrameResult& result, double fps) override;
+    void finish() override;
+
+private:
+
+    std::string pathFor(int source) const;
+
+    std::string _path;
+    double _frameRate;
+    int _fourcc;
+    std::vector<std::unique_ptr<cv::VideoWriter>> _writers;
+    Display _display;
+    cv::Mat _canvas;
+
+};
+
+// Prints every detection, and who it is when recognized
+class ConsoleSink : public Sink {
+public:
+
+    explicit ConsoleSink(size_t depth = 8);
+    ~ConsoleSink();
+    bool needsPixels() const override { return false; }
+
+protected:
+
+    void consume(FrameResult& result, double fps) override;
+
+};
+
+// Hands every result to each sink. Sinks that draw get the pixels through a read-only lease;
+// a borrowed frame (a camera or decoder buffer) is first copied into a pooled buffer, so a
+// slow sink holds on to its own copies and never to the buffers capture needs back.
+class SinkSet {
+public:
+
+    SinkSet();
+    ~SinkSet();
+
+    void add(std::unique_ptr<Sink> sink);
+    void start();
+    void publish(const FrameResult& result, double fps);
+    // Drains and joins every sink
+    void stop();
+
+    bool quitRequested() const;
+    bool empty() const { return _sinks.empty(); }
+    size_t size() const { return _sinks.size(); }
+    const Sink& sink(size_t i) const { return *_sinks[i]; }
+
+private:
+
+    // A lease on a pooled copy of the result's frame, or a read-only share of an owned one
+    FrameLease pixelsFor(const FrameLease& frame);
+
+    std::vector<std::unique_ptr<Sink>> _sinks;
+    bool _anyPixels = false;
+
+    struct CopyPool;
+    std::shared_ptr<CopyPool> _copies;
+
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// What a producer does when the queue in front of the next stage is full
+enum class DropPolicy {
+    Block,      // wait for the consumer to make room
+    DropNewest  // discard the incoming item
+};
+
+// Bounded single-producer/single-consumer ring buffer. tryPush/tryPop are lock-free;
+// the blocking push/pop only touch the mutex when the other side is parked on it.
+template <typename T>
+class SpscQueue {
+public:
+
+    explicit SpscQueue(size_t capacity) : _slots(capacity), _capacity(capacity) {
+        if (capacity == 0) {
+            throw std::runtime_error("SpscQueue::SpscQueue - Capacity must be at least 1");
+        }
+    }
+
+    bool tryPush(T&& item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == _capacity) return false;
+        _slots[tail % _capacity] = std::move(item);
+        _tail.store(tail + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) return false;
+        T& slot = _slots[head % _capacity];
+        item = std::move(slot);
+        slot = T(); // don't keep the moved-from item (and anything it references) alive
+        _head.store(head + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    // Returns false if the item was dropped or the queue has been closed
+    bool push(T&& item, DropPolicy policy = DropPolicy::Block) {
+        while (!_closed.load(std::memory_order_acquire)) {
+            if (tryPush(std::move(item))) return true;
+            if (policy == DropPolicy::DropNewest) return false;
+            park([this] { return size() < _capacity; });
+        }
+        return false;
+    }
+
+    // Blocks until an item is available. Returns false once the queue is closed and drained
+    bool pop(T& item) {
+        while (true) {
+            if (tryPop(item)) return true;
+            if (_closed.load(std::memory_order_acquire)) return tryPop(item);
+            park([this] { return size() > 0; });
+        }
+    }
+
+    // Wakes every blocked producer and consumer; items already queued can still be popped
+    void close() {
+        _closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cond.notify_all();
+    }
+
+    bool closed() const { return _closed.load(std::memory_order_acquire); }
+    size_t size() const {
+        size_t head = _head.load(std::memory_order_acquire);
+        return _tail.load(std::memory_order_acquire) - head;
+    }
+    size_t capacity() const { return _capacity; }
+
+private:
+
+    template <typename Ready>
+    void park(Ready ready) {
+        _waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [&] { return ready() || _closed.load(std::memory_order_acquire); });
+        }
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wake() {
+        // Pairs with the fence in park() so a waiter either sees our index update or we see it waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_waiters.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _cond.notify_all();
+        }
+    }
+
+    std::vector<T> _slots;
+    const size_t _capacity;
+
+    alignas(64) std::atomic<size_t> _head{0};
+    alignas(64) std::atomic<size_t> _tail{0};
+    alignas(64) std::atomic<int> _waiters{0};
+    std::atomic<bool> _closed{false};
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+};
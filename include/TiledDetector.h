@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Detector.h"
+
+struct TilingConfig {
+    bool enabled = false;
+    int cols = 2;               // tiles across the frame
+    int rows = 2;               // tiles down the frame
+    float overlap = 0.2;        // share of a tile it has in common with its neighbour, so a face on a seam is whole in one of them
+    bool fullFrame = true;      // also detect on the whole frame, for faces bigger than a tile
+    float nmsThresh = 0.4;      // IoU above which two boxes are the same face
+    float containThresh = 0.7;  // share of a box inside a better one for it to be that face cut off by a seam
+};
+
+// Runs detectors over overlapping tiles of the full-resolution frame instead of the frame
+// squashed down to the model input, so faces a few metres away keep enough pixels to be found.
+// Tiles are views into the frame, shared out across the wrapped detectors, each on its own
+// thread (the first on the caller's) with its share in one detectBatch call. Boxes are mapped
+// back to frame pixels and duplicates from neighbouring tiles are merged by NMS; a box mostly
+// inside a better one grows that one to cover both, since it's usually the same face cut by a seam.
+// Only boxes with the same label are merged, so a face inside a person box stays a face.
+class TiledDetector : public Detector {
+public:
+
+    // Every detector runs tiles, so more of them means more tiles at once
+    TiledDetector(std::vector<std::unique_ptr<Detector>> detectors, TilingConfig config = TilingConfig());
+    ~TiledDetector();
+
+    void detect(const cv::Mat& src, Detections& detections) override;
+    const char* name() const override { return _name.c_str(); }
+    bool hasLabel(const char* label) const override { return _detectors[0]->hasLabel(label); }
+
+    size_t tileCount() const { return _tiles.size(); }
+
+private:
+
+    void layout(int width, int height);
+    void runShare(size_t worker);
+    void workerLoop(size_t worker);
+    void merge(Detections& detections);
+
+    std::vector<std::unique_ptr<Detector>> _detectors;
+    TilingConfig _config;
+    std::string _name;
+
+    // Tiles for the current frame size, the whole frame last when fullFrame is on
+    int _width = 0;
+    int _height = 0;
+    std::vector<cv::Rect> _tiles;
+    std::vector<cv::Mat> _views;
+    std::vector<Detections> _found;
+
+    // Every tile's boxes in frame pixels, best first, with the coordinates split out for the NMS kernel
+    std::vector<Detection> _candidates;
+    std::vector<int> _order;
+    std::vector<float> _x1, _y1, _x2, _y2, _area;
+    std::vector<uint8_t> _hits;
+    std::vector<uint8_t> _suppressed;
+
+    // Detectors 1..n-1 run on these; detector 0 runs on the caller
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    uint64_t _generation = 0;
+    int _pending = 0;
+    bool _stop = false;
+    std::string _error;
+
+};
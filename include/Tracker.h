@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+#include "Detector.h"
+
+struct TrackerConfig {
+    float iouThresh = 0.3;         // least overlap for a detection to continue a track
+    int maxMisses = 2;             // detector runs a track can go unmatched before it's dropped
+    float processNoise = 0.05;     // expected change in velocity per frame, as a fraction of box height
+    float measurementNoise = 0.1;  // detector jitter, as a fraction of box height
+    int firstId = 0;               // first track id; trackers sharing a recognizer need ranges that don't overlap
+};
+
+// Carries detections between detector runs. Boxes are associated to tracks greedily by IoU,
+// and each track runs a constant-velocity Kalman filter on its box centre and size (one
+// decoupled two-state filter per axis), so on frames the detector skips, the boxes keep moving
+// with the faces. Every call is one frame.
+class Tracker {
+public:
+
+    Tracker(TrackerConfig config = TrackerConfig());
+
+    // A frame the detector ran on: associates, corrects the filters and sets trackId on each detection
+    void update(Detections& detections);
+    // A frame without the detector: replaces detections with every live track's predicted box
+    void predict(Detections& detections);
+    // Carries what recognition filled in after update() (name, score, embedding) into the
+    // tracks, matched by trackId, so the frames predict() fills in keep the names
+    void annotate(const Detections& detections);
+
+    size_t activeTracks() const { return _tracks.size(); }
+    // The last update neither started nor lost a track and every match overlapped well,
+    // so the detector can afford to run less often
+    bool stable() const { return _stable; }
+
+private:
+
+    // Position and velocity along one axis
+    struct Axis {
+        float p, v;
+        float p00, p01, p11;
+        void init(float z, float r);
+        void predict(float q);
+        void correct(float z, float r);
+    };
+
+    struct Track {
+        int id;
+        int misses;
+        int hits;
+        Axis cx, cy, w, h;
+        Detection last;  // everything but the box is carried over from the last match
+    };
+
+    void step();
+    static float iou(const Detection& a, const Detection& b);
+    void boxOf(const Track& track, Detection& d) const;
+
+    TrackerConfig _config;
+    std::vector<Track> _tracks;
+    int _nextId = 0;
+    bool _stable = false;
+
+    // Reused each frame, reserved up front for the most tracks there can be
+    std::vector<Detection> _predicted;
+    std::vector<std::pair<float, std::pair<int, int>>> _pairs;
+    std::vector<char> _trackUsed;
+    std::vector<char> _detectionUsed;
+
+};
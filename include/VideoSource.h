@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <memory>
+#include <thread>
 
 #include <opencv2/videoio.hpp>
 
+#include "FrameLease.h"
+#include "SpscQueue.h"
+
 #ifdef CROSSCOMPILING
 #include "LibCamera.h"
 #endif
@@ -15,12 +21,24 @@ public:
     virtual ~VideoSource() {}
     cv::Size getSize();
     virtual void getFrame(cv::Mat& frame) = 0;
-    virtual void returnFrame() {}
+    // The next frame without copying it where the source allows; the default wraps getFrame
+    virtual FrameLease acquireFrame();
+
+    double frameRate() const { return _frameRate; }
+    // Asks the source to capture at fps from now on. Returns false where the rate is fixed
+    virtual bool setFrameRate(double /*fps*/) { return false; }
+    // Hand out only the newest frame, recycling any that came in while the caller was busy
+    void setLatestOnly(bool latest) { _latestOnly = latest; }
+    // Frames recycled unseen because a newer one was ready
+    uint64_t staleDropped() const { return _staleDropped.load(std::memory_order_relaxed); }
 
 protected:
 
     uint32_t _frameWidth;
     uint32_t _frameHeight;
+    double _frameRate = 0;
+    std::atomic<bool> _latestOnly{false};
+    std::atomic<uint64_t> _staleDropped{0};
 
 };
 
@@ -29,31 +47,76 @@ protected:
 class LibCameraVideoSource : public VideoSource {
 public:
 
-    LibCameraVideoSource(int width, int height, int fps);
+    // bufferCount is the camera buffers asked for; the camera may allocate more, and the number
+    // it does allocate bounds how many leases can be held at once across all pipeline stages.
+    // cameraIndex picks among the attached cameras. yuv captures YUV420, half the bytes of
+    // RGB888, and hands out leases whose image() is the luma plane
+    LibCameraVideoSource(int width, int height, int fps, int bufferCount = 8, int cameraIndex = 0, bool yuv = false);
     ~LibCameraVideoSource();
     void getFrame(cv::Mat& frame) override;
-    void returnFrame() override;
+    FrameLease acquireFrame() override;
+    // Takes effect from the next request queued, through FrameDurationLimits
+    bool setFrameRate(double fps) override;
 
 private:
 
     uint32_t _stride;
+    bool _yuv;
 
     LibCamera _cam;
-    LibcameraOutData _frameData;
+    // One preallocated claim per camera buffer. Shared with the leases, so ones that outlive
+    // the source don't requeue into a closed camera
+    struct CameraLeases;
+    std::shared_ptr<CameraLeases> _leases;
 
 };
 
 #endif
 
+enum class Pacing {
+    Deadline,    // one frame per 1/frameRate on an absolute schedule
+    Timestamp,   // follow the container's presentation timestamps
+    Unthrottled, // decode as fast as possible on a prefetch thread
+    None         // decode on the caller's thread as soon as asked, for timing the decode itself
+};
+
 class FileVideoSource : public VideoSource {
 public:
 
-    FileVideoSource(std::string path, int frameRate);
+    // frameRate <= 0 uses the rate stored in the container. Frames are decoded into a pool of
+    // bufferCount reused buffers; leases past that get a buffer of their own
+    FileVideoSource(std::string path, int frameRate, Pacing pacing = Pacing::Deadline, bool loop = false, size_t prefetchDepth = 4,
+                    size_t bufferCount = 12);
+    ~FileVideoSource();
     void getFrame(cv::Mat& frame) override;
+    FrameLease acquireFrame() override;
 
 private:
 
+    void decode(cv::Mat& frame);
+    // Decodes into a pooled buffer when one is free
+    FrameLease decodeLease();
+    // Waits out the rest of the frame period
+    void pace();
+    void prefetchLoop();
+
     cv::VideoCapture _cap;
-    int _frameRate;
+    Pacing _pacing;
+    bool _loop;
+
+    bool _started = false;
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::steady_clock::time_point _deadline;
+    double _firstPts = -1;
+    double _loopOffset = 0;
+    double _lastPts = 0;
+
+    struct FramePool;
+    std::shared_ptr<FramePool> _pool;
+
+    std::unique_ptr<SpscQueue<FrameLease>> _prefetched;
+    std::thread _prefetchThread;
+    std::atomic<bool> _prefetching{false};
+    std::string _prefetchError;
 
 };
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <opencv2/dnn.hpp>
+
+#include "Detector.h"
+#include "Preprocess.h"
+
+struct YunetConfig {
+    float scoreThresh = 0.6;   // sqrt(class x objectness) needed to keep a face
+    float nmsThresh = 0.3;     // IoU above which the weaker of two faces is suppressed
+    int inputWidth = 320;      // frames are scaled to this width; the height follows the aspect ratio
+    int topK = 500;            // candidates kept for NMS, best first
+};
+
+// The face-specific YuNet model (res/face_detection_yunet_2023mar.onnx) on OpenCV DNN.
+// YuNet is anchor-free: every cell of its stride 8, 16 and 32 feature maps predicts one face
+// as offsets from the cell, plus five landmarks. The decode and NMS are done here, into
+// buffers reused between frames.
+class YunetDetector : public Detector {
+public:
+
+    YunetDetector(std::string modelPath, YunetConfig config = YunetConfig());
+    void detect(const cv::Mat& src, Detections& detections) override;
+    const char* name() const override { return "yunet"; }
+    bool hasLabel(const char* label) const override { return strcmp(label, kFaceLabel) == 0; }
+
+private:
+
+    struct Candidate {
+        float score;
+        float x1, y1, x2, y2;
+        float landmarks[5][2];
+    };
+
+    // Sizes the network input for frames of this size
+    void prepare(int srcWidth, int srcHeight);
+    void decode();
+
+    cv::dnn::Net _net;
+    YunetConfig _config;
+
+    // Output indices of cls, obj, bbox and kps for each stride
+    static const int kStrides[3];
+    int _outputIndex[3][4];
+    std::vector<std::string> _outputNames;
+
+    int _srcWidth = 0;
+    int _srcHeight = 0;
+    int _inputWidth = 0;
+    int _inputHeight = 0;
+
+    // Reused between frames
+    TensorResizer _resizer;
+    cv::Mat _input;
+    cv::Mat _blob;
+    std::vector<cv::Mat> _outputs;
+    std::vector<Candidate> _candidates;
+    std::vector<int> _order;
+    std::vector<char> _suppressed;
+
+};
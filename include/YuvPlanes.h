@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+#include <opencv2/core.hpp>
+
+// A planar YUV 4:2:0 (I420) image in borrowed memory: full-size luma, then U and V at half
+// the width and height. Y, U and V are BT.601 video range, as cameras and cv::cvtColor use them
+struct YuvPlanes {
+    const uint8_t* y = nullptr;
+    const uint8_t* u = nullptr;
+    const uint8_t* v = nullptr;
+    int width = 0;
+    int height = 0;
+    int yStride = 0;   // bytes between luma rows
+    int uvStride = 0;  // bytes between chroma rows, the same for U and V
+
+    bool empty() const { return !y; }
+    // The luma plane as a grey image, without copying
+    cv::Mat luma() const { return cv::Mat(height, width, CV_8UC1, (void*)y, yStride); }
+    // Full-resolution BGR, for stages that need colour
+    void toBgr(cv::Mat& dst) const;
+};
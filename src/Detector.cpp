@@ -1,61 +1,188 @@
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <stdio.h>
+#include <thread>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tensorflow/lite/allocation.h"
 
 #include "Detector.h"
+#include "Metrics.h"
 
-Detector::Detector(std::string modelPath, std::string labelsPath, double confidenceThresh, bool useTpu) {
+static Histogram preprocessSeconds("namevault_detect_preprocess_seconds", "Resizing a frame into the input tensor");
+static Histogram invokeSeconds("namevault_detect_invoke_seconds", "Interpreter Invoke");
+static Histogram postprocessSeconds("namevault_detect_postprocess_seconds", "Decoding detections from the output tensors");
+static Counter detectionsTotal("namevault_detections_total{backend=\"tflite\"}", "Detections above the confidence threshold");
 
-    _confidenceThresh = confidenceThresh;
+static std::shared_ptr<edgetpu::EdgeTpuContext> openTpu() {
+    std::shared_ptr<edgetpu::EdgeTpuContext> context = edgetpu::EdgeTpuManager::GetSingleton()->OpenDevice();
+    if (!context) {
+        throw std::runtime_error("TfliteDetector::TfliteDetector - Failed to open Coral TPU Accelerator");
+    }
+    printf("Opened Coral TPU Accelerator\n");
+    return context;
+}
 
-    printf("Creating detector with %s\n", modelPath.c_str());
+TfliteDetector::TfliteDetector(std::string modelPath, std::string labelsPath, double confidenceThresh, bool useTpu, bool swapRB, bool letterbox,
+                               TfliteCpuConfig cpu)
+    : TfliteDetector(loadModel(modelPath), useTpu ? openTpu() : nullptr, loadLabels(labelsPath), confidenceThresh, swapRB, letterbox, cpu) {}
 
-    // Load model
-    _model = tflite::FlatBufferModel::BuildFromFile(modelPath.c_str());
+TfliteDetector::TfliteDetector(std::shared_ptr<tflite::FlatBufferModel> model, std::shared_ptr<edgetpu::EdgeTpuContext> tpu, std::vector<std::string> labels,
+                               double confidenceThresh, bool swapRB, bool letterbox, TfliteCpuConfig cpu) {
+
+    _model = model;
+    _edgetpu_context = tpu;
+    _labels = std::move(labels);
+    _confidenceThresh = confidenceThresh;
+    _swapRB = swapRB;
+    _letterbox = letterbox;
 
     // Build the interpreter
-    if (useTpu) {
-        _edgetpu_context = edgetpu::EdgeTpuManager::GetSingleton()->OpenDevice();
-        printf("Opened Coral TPU Accelerator\n");
-        _interpreter = buildEdgeTpuInterpreter(*_model, _edgetpu_context.get());
+    if (_edgetpu_context) {
+        _interpreter = buildEdgeTpuInterpreter(*_model, _edgetpu_context.get(), std::max(1, cpu.threads));
+        _interpreter->SetAllowFp16PrecisionForFp32(true);
+    } else if (cpu.threads > 0) {
+        buildCpuInterpreter(cpu.threads, cpu.xnnpack);
     } else {
-        tflite::ops::builtin::BuiltinOpResolver resolver;
-        tflite::InterpreterBuilder(*_model.get(), resolver)(&_interpreter);
-        if (tflite::InterpreterBuilder(*_model.get(), resolver)(&_interpreter) != kTfLiteOk) {
-            throw std::runtime_error("Detector::Detector - Failed to build interpreter");
+        int threads = autotuneThreads(cpu.xnnpack);
+        printf("Detector CPU interpreter tuned to %d threads\n", threads);
+    }
+
+    const TfLiteTensor* input = _interpreter->input_tensor(0);
+    if (input->dims->size != 4 || input->dims->data[3] != 3) {
+        throw std::runtime_error("TfliteDetector::TfliteDetector - Expected an NHWC input tensor with 3 channels");
+    }
+    _inputHeight = input->dims->data[1];
+    _inputWidth = input->dims->data[2];
+    _inputType = input->type;
+    if (_inputType != kTfLiteFloat32 && _inputType != kTfLiteUInt8) {
+        throw std::runtime_error("TfliteDetector::TfliteDetector - Only uint8 and float32 model inputs are supported");
+    }
+
+    // Edge TPU models are compiled for one input shape
+    if (!_edgetpu_context && cpu.maxBatch > 1) {
+        if (resizeBatch(cpu.maxBatch)) {
+            _maxBatch = cpu.maxBatch;
+            printf("Detector batches up to %d frames\n", _maxBatch);
+        } else {
+            printf("Detector model can't batch, frames go through one at a time\n");
         }
-        if (_interpreter->AllocateTensors() != kTfLiteOk) {
-            throw std::runtime_error("Detector::Detector - Failed to allocate tensors");
+        if (!resizeBatch(1)) {
+            throw std::runtime_error("TfliteDetector::TfliteDetector - Failed to restore a batch of one");
         }
-        _interpreter->SetNumThreads(3);
     }
-    _interpreter->SetAllowFp16PrecisionForFp32(true);
+    _resizers.resize(_maxBatch);
+    _yuvResizers.resize(_maxBatch);
+    _boxes.resize(_maxBatch);
+    if (_inputType == kTfLiteFloat32) _scratch.resize(_maxBatch * _inputWidth * _inputHeight * 3);
+}
+
+std::shared_ptr<tflite::FlatBufferModel> TfliteDetector::loadModel(std::string modelPath) {
+    printf("Creating detector with %s\n", modelPath.c_str());
+    std::shared_ptr<tflite::FlatBufferModel> model = tflite::FlatBufferModel::BuildFromFile(modelPath.c_str());
+    if (!model) {
+        throw std::runtime_error("TfliteDetector::loadModel - Could not load " + modelPath);
+    }
+    // BuildFromFile maps the file rather than reading it. Have the kernel read it in now, in the
+    // background, instead of one page fault at a time during the first Invoke
+    const tflite::Allocation* allocation = model->allocation();
+    if (allocation && allocation->base()) {
+        long page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)allocation->base() & ~(uintptr_t)(page - 1);
+        madvise((void*)start, (uintptr_t)allocation->base() + allocation->bytes() - start, MADV_WILLNEED);
+    }
+    return model;
+}
 
-	// Read labels file
-	if(!readFileContents(labelsPath, _labels)) {
-        throw std::runtime_error("Detector::Detector - Could not load labels file");
+std::vector<std::string> TfliteDetector::loadLabels(std::string labelsPath) {
+    std::vector<std::string> labels;
+	if(!readFileContents(labelsPath, labels)) {
+        throw std::runtime_error("TfliteDetector::TfliteDetector - Could not load labels file");
 	}
+    return labels;
 }
 
-std::unique_ptr<tflite::Interpreter> Detector::buildEdgeTpuInterpreter(const tflite::FlatBufferModel& model, edgetpu::EdgeTpuContext* edgetpu_context) {
+std::unique_ptr<tflite::Interpreter> TfliteDetector::buildEdgeTpuInterpreter(const tflite::FlatBufferModel& model, edgetpu::EdgeTpuContext* edgetpu_context, int numThreads) {
     tflite::ops::builtin::BuiltinOpResolver resolver;
     resolver.AddCustom(edgetpu::kCustomOp, edgetpu::RegisterCustomOp());
     std::unique_ptr<tflite::Interpreter> interpreter;
     if (tflite::InterpreterBuilder(model, resolver)(&interpreter) != kTfLiteOk) {
-        throw std::runtime_error("Detector::buildEdgeTpuInterpreter - Failed to build interpreter");
+        throw std::runtime_error("TfliteDetector::buildEdgeTpuInterpreter - Failed to build interpreter");
     }
     // Bind given context with interpreter.
     interpreter->SetExternalContext(kTfLiteEdgeTpuContext, edgetpu_context);
-    interpreter->SetNumThreads(3);
+    interpreter->SetNumThreads(numThreads);
     if (interpreter->AllocateTensors() != kTfLiteOk) {
-        throw std::runtime_error("Detector::buildEdgeTpuInterpreter - Failed to allocate tensors");
+        throw std::runtime_error("TfliteDetector::buildEdgeTpuInterpreter - Failed to allocate tensors");
     }
     return interpreter;
 }
 
-bool Detector::readFileContents(std::string fileName, std::vector<std::string>& lines) {
+void TfliteDetector::buildCpuInterpreter(int numThreads, bool xnnpack) {
+    _interpreter.reset();
+    _delegate.reset();
+
+    tflite::ops::builtin::BuiltinOpResolver resolver;
+    if (tflite::InterpreterBuilder(*_model, resolver)(&_interpreter) != kTfLiteOk) {
+        throw std::runtime_error("TfliteDetector::buildCpuInterpreter - Failed to build interpreter");
+    }
+    _interpreter->SetNumThreads(numThreads);
+    _interpreter->SetAllowFp16PrecisionForFp32(true);
+
+    if (xnnpack) {
+        TfLiteXNNPackDelegateOptions options = TfLiteXNNPackDelegateOptionsDefault();
+        options.num_threads = numThreads;
+        // Quantized kernels are opt-in, and older runtimes don't have them at all
+#ifdef TFLITE_XNNPACK_DELEGATE_FLAG_QS8
+        options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QS8;
+#endif
+#ifdef TFLITE_XNNPACK_DELEGATE_FLAG_QU8
+        options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QU8;
+#endif
+        _delegate.reset(TfLiteXNNPackDelegateCreate(&options));
+        if (!_delegate || _interpreter->ModifyGraphWithDelegate(_delegate.get()) != kTfLiteOk) {
+            printf("XNNPACK could not take the model, using the builtin kernels\n");
+            buildCpuInterpreter(numThreads, false);
+            return;
+        }
+    }
+
+    if (_interpreter->AllocateTensors() != kTfLiteOk) {
+        throw std::runtime_error("TfliteDetector::buildCpuInterpreter - Failed to allocate tensors");
+    }
+}
+
+int TfliteDetector::autotuneThreads(bool xnnpack) {
+    const int kRuns = 5;
+    int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    int best = 1;
+    double bestMs = 0;
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        buildCpuInterpreter(threads, xnnpack);
+        // The first Invoke sets up the kernels' scratch space
+        _interpreter->Invoke();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kRuns; i++) _interpreter->Invoke();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / kRuns;
+        printf("Detector Invoke with %d threads: %.2f ms\n", threads, ms);
+        // Another thread has to earn its keep, or it's better left to the other stages
+        if (threads == 1 || ms < bestMs * 0.95) {
+            best = threads;
+            bestMs = ms;
+        }
+    }
+    if (best != maxThreads) buildCpuInterpreter(best, xnnpack);
+    return best;
+}
+
+bool TfliteDetector::readFileContents(std::string fileName, std::vector<std::string>& lines) {
 	std::ifstream in(fileName.c_str());
 	if(!in.is_open()) return false;
 
@@ -68,45 +195,222 @@ bool Detector::readFileContents(std::string fileName, std::vector<std::string>&
 	return true;
 }
 
-std::vector<Detection> Detector::detect(cv::Mat& src) {
+bool TfliteDetector::resizeBatch(int batch) {
+    if (_interpreter->ResizeInputTensor(_interpreter->inputs()[0], {batch, _inputHeight, _inputWidth, 3}) != kTfLiteOk ||
+        _interpreter->AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    // SSD post-processing, for one, only ever produces a single frame's worth
+    for (int i = 0; i < 4; i++) {
+        if (_interpreter->tensor(_interpreter->outputs()[i])->dims->data[0] != batch) return false;
+    }
+    _batch = batch;
+    return true;
+}
+
+uint8_t* TfliteDetector::slotPixels(int slot) {
+    size_t slotSize = _inputWidth * _inputHeight * 3;
+    // Resize and swizzle straight into the tensor
+    if (_inputType == kTfLiteUInt8) return _interpreter->typed_input_tensor<uint8_t>(0) + slot * slotSize;
+    return _scratch.data() + slot * slotSize;
+}
+
+void TfliteDetector::normalizeSlot(int slot) {
+    if (_inputType == kTfLiteUInt8) return;
+    size_t slotSize = _inputWidth * _inputHeight * 3;
+    const uint8_t* scratch = _scratch.data() + slot * slotSize;
+    float* input = _interpreter->typed_input_tensor<float>(0) + slot * slotSize;
+    for (size_t i = 0; i < slotSize; i++) {
+        input[i] = (scratch[i] - 127.5f) / 127.5f;
+    }
+}
+
+Letterbox TfliteDetector::fillInput(const cv::Mat& src, int slot) {
+    Letterbox box = _resizers[slot].run(src, slotPixels(slot), _inputWidth, _inputHeight, _swapRB, _letterbox);
+    normalizeSlot(slot);
+    return box;
+}
+
+Letterbox TfliteDetector::fillInput(const YuvPlanes& src, int slot) {
+    Letterbox box = _yuvResizers[slot].run(src, slotPixels(slot), _inputWidth, _inputHeight, _swapRB, _letterbox);
+    normalizeSlot(slot);
+    return box;
+}
 
-    cv::Mat image;
-    int cam_width = src.cols;
-    int cam_height = src.rows;
+template <typename Fill>
+void TfliteDetector::runBatches(size_t count, Detections* detections, Fill fill) {
+    for (size_t first = 0; first < count; first += _maxBatch) {
+        size_t n = std::min(count - first, (size_t)_maxBatch);
+        // Changing the batch reallocates the tensors, so a steady batch size is the cheap case
+        if ((int)n != _batch && !resizeBatch(n)) {
+            throw std::runtime_error("TfliteDetector::detectBatch - Failed to resize the input to " + std::to_string(n) + " frames");
+        }
 
-    // copy image to input as input tensor
-    cv::resize(src, image, cv::Size(300,300));
-    memcpy(_interpreter->typed_input_tensor<uchar>(0), image.data, image.total() * image.elemSize());
+        {
+            ScopedTimer timer(preprocessSeconds);
+            if (n == 1) {
+                _boxes[0] = fill(first, 0);
+            } else {
+                cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+                    for (int i = range.start; i < range.end; i++) _boxes[i] = fill(first + i, i);
+                });
+            }
+        }
+        invokeAndDecode(n, detections + first);
+    }
+}
+
+void TfliteDetector::detect(const cv::Mat& src, Detections& detections) {
+    detectBatch(&src, 1, &detections);
+}
 
+void TfliteDetector::detectBatch(const cv::Mat* frames, size_t count, Detections* detections) {
+    runBatches(count, detections, [&](size_t frame, int slot) { return fillInput(frames[frame], slot); });
+}
+
+void TfliteDetector::detectYuv(const YuvPlanes* frames, size_t count, Detections* detections) {
+    runBatches(count, detections, [&](size_t frame, int slot) { return fillInput(frames[frame], slot); });
+}
+
+void TfliteDetector::invokeAndDecode(size_t count, Detections* detections) {
 //        cout << "tensors size: " << _interpreter->tensors_size() << "\n";
 //        cout << "nodes size: " << _interpreter->nodes_size() << "\n";
 //        cout << "inputs: " << _interpreter->inputs().size() << "\n";
 //        cout << "input(0) name: " << _interpreter->GetInputName(0) << "\n";
 //        cout << "outputs: " << _interpreter->outputs().size() << "\n";
 
-    _interpreter->Invoke(); // run the model
+    {
+        ScopedTimer timer(invokeSeconds);
+        _interpreter->Invoke(); // run the model
+    }
+
+    ScopedTimer timer(postprocessSeconds);
+
+    // Outputs are [batch, boxes, ...], one frame's worth after another
+    const TfLiteTensor* scoresTensor = _interpreter->tensor(_interpreter->outputs()[2]);
+    const int perFrame = scoresTensor->dims->size > 1 ? scoresTensor->dims->data[1] : scoresTensor->dims->data[0];
+    for (size_t f = 0; f < count; f++) {
+        const float* detection_locations = _interpreter->tensor(_interpreter->outputs()[0])->data.f + f * perFrame * 4;
+        const float* detection_classes = _interpreter->tensor(_interpreter->outputs()[1])->data.f + f * perFrame;
+        const float* detection_scores = scoresTensor->data.f + f * perFrame;
+        const int num_detections = std::min(perFrame, (int)_interpreter->tensor(_interpreter->outputs()[3])->data.f[f]);
+        const Letterbox& box = _boxes[f];
+
+        //there are ALWAYS 10 detections no matter how many objects are detectable
+
+        detections[f].clear();
+        for (int i = 0; i < num_detections; i++) {
+            if (detection_scores[i] > _confidenceThresh){
+                int det_index = (int) detection_classes[i] + 1;
+                // Boxes are normalised to the model input, map them back through the letterbox
+                Detection d;
+                d.y1 = (detection_locations[4*i] * _inputHeight - box.padY) / box.scaleY;
+                d.x1 = (detection_locations[4*i+1] * _inputWidth - box.padX) / box.scaleX;
+                d.y2 = (detection_locations[4*i+2] * _inputHeight - box.padY) / box.scaleY;
+                d.x2 = (detection_locations[4*i+3] * _inputWidth - box.padX) / box.scaleX;
+
+                d.score = detection_scores[i];
+                d.label = _labels[det_index].c_str();
+                if (!detections[f].push_back(d)) break;
+            }
+        }
+        detectionsTotal.add(detections[f].size());
+    }
+}
 
-    const float* detection_locations = _interpreter->tensor(_interpreter->outputs()[0])->data.f;
-    const float* detection_classes=_interpreter->tensor(_interpreter->outputs()[1])->data.f;
-    const float* detection_scores = _interpreter->tensor(_interpreter->outputs()[2])->data.f;
-    const int num_detections = *_interpreter->tensor(_interpreter->outputs()[3])->data.f;
+void Detector::detectBatch(const cv::Mat* frames, size_t count, Detections* detections) {
+    for (size_t i = 0; i < count; i++) detect(frames[i], detections[i]);
+}
 
-    //there are ALWAYS 10 detections no matter how many objects are detectable
+void Detector::detectYuv(const YuvPlanes* frames, size_t count, Detections* detections) {
+    std::vector<cv::Mat> colour(count);
+    for (size_t i = 0; i < count; i++) frames[i].toBgr(colour[i]);
+    detectBatch(colour.data(), count, detections);
+}
+void Detector::warmUp(cv::Size frameSize) {
+    // What's in the frame doesn't matter, only that every kernel, delegate and TPU upload has run once
+    cv::Mat frame(frameSize, CV_8UC3, cv::Scalar(128, 128, 128));
+    Detections detections;
+    detect(frame, detections);
+    // Left sized for a full batch, which is what a loaded pipeline sends
+    if (maxBatch() > 1) {
+        std::vector<cv::Mat> frames(maxBatch(), frame);
+        std::vector<Detections> batch(maxBatch());
+        detectBatch(frames.data(), frames.size(), batch.data());
+    }
+}
 
-    std::vector<Detection> detections;
-    for (int i = 0; i < num_detections; i++) {
-        if (detection_scores[i] > _confidenceThresh){
-            int det_index = (int) detection_classes[i] + 1;
-            Detection d;
-            d.y1 = detection_locations[4*i] * cam_height;
-            d.x1 = detection_locations[4*i+1] * cam_width;
-            d.y2 = detection_locations[4*i+2] * cam_height;
-            d.x2 = detection_locations[4*i+3] * cam_width;
+bool TfliteDetector::hasLabel(const char* label) const {
+    for (const std::string& l : _labels) {
+        if (l == label) return true;
+    }
+    return false;
+}
+
+static bool isFace(const Detection& d) {
+    return d.label && strcmp(d.label, kFaceLabel) == 0;
+}
 
-            d.score = detection_scores[i];
-            d.label = _labels[det_index].c_str();
-            detections.push_back(d);
+static float overlap(const Detection& a, const Detection& b) {
+    float w = std::min(a.x2, b.x2) - std::max(a.x1, b.x1);
+    float h = std::min(a.y2, b.y2) - std::max(a.y1, b.y1);
+    if (w <= 0 || h <= 0) return 0;
+    return w * h / ((a.x2 - a.x1) * (a.y2 - a.y1) + (b.x2 - b.x1) * (b.y2 - b.y1) - w * h);
+}
+
+std::unique_ptr<Detector> Detector::select(std::vector<std::unique_ptr<Detector>> candidates, const std::vector<cv::Mat>& frames,
+                                           float accuracyFloor) {
+    if (candidates.empty()) {
+        throw std::runtime_error("Detector::select - No detectors to choose from");
+    }
+    if (candidates.size() == 1 || frames.empty()) return std::move(candidates[0]);
+    if (!candidates[0]->hasLabel(kFaceLabel)) {
+        throw std::runtime_error(std::string("Detector::select - The reference detector ") + candidates[0]->name()
+                                 + " has no \"" + kFaceLabel + "\" label, so it can't measure face recall; choose a backend instead");
+    }
+
+    // What the reference finds is the stand-in for ground truth
+    std::vector<Detections> reference(frames.size());
+    for (size_t f = 0; f < frames.size(); f++) candidates[0]->detect(frames[f], reference[f]);
+
+    size_t best = 0;
+    double bestMs = 0;
+    Detections detections;
+    for (size_t c = 0; c < candidates.size(); c++) {
+        Detector& detector = *candidates[c];
+        // The first run pays for lazy initialisation, so it isn't timed
+        detector.detect(frames[0], detections);
+
+        double ms = 0;
+        int found = 0;
+        int expected = 0;
+        for (size_t f = 0; f < frames.size(); f++) {
+            auto start = std::chrono::steady_clock::now();
+            detector.detect(frames[f], detections);
+            ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            for (const Detection& ref : reference[f]) {
+                if (!isFace(ref)) continue;
+                expected++;
+                for (const Detection& d : detections) {
+                    if (isFace(d) && overlap(ref, d) >= 0.5) {
+                        found++;
+                        break;
+                    }
+                }
+            }
+        }
+        ms /= frames.size();
+        // Frames without faces say nothing about accuracy
+        float recall = expected ? (float)found / expected : 1.f;
+        bool qualifies = c == 0 || recall >= accuracyFloor;
+        printf("Detector %s: %.2f ms/frame, recall %.2f against %s%s\n", detector.name(), ms, recall, candidates[0]->name(),
+               qualifies ? "" : " (below the accuracy floor)");
+        if (qualifies && (c == 0 || ms < bestMs)) {
+            best = c;
+            bestMs = ms;
         }
     }
-    return detections;
-}
\ No newline at end of file
+    printf("Selected detector %s\n", candidates[best]->name());
+    return std::move(candidates[best]);
+}
@@ -0,0 +1,198 @@
+#include <stdexcept>
+#include <stdio.h>
+
+#include "DetectorPool.h"
+
+DetectorPool::DetectorPool(std::string modelPath, std::string labelsPath, DetectorPoolConfig config) {
+
+    _config = config;
+
+    // Interpreters share the model; only their tensors and contexts are per worker
+    std::shared_ptr<tflite::FlatBufferModel> model = TfliteDetector::loadModel(modelPath);
+    std::vector<std::string> labels = TfliteDetector::loadLabels(labelsPath);
+    TfliteCpuConfig cpu;
+    cpu.threads = _config.threadsPerInterpreter;
+    cpu.xnnpack = _config.xnnpack;
+
+    if (_config.useTpus) {
+        edgetpu::EdgeTpuManager* manager = edgetpu::EdgeTpuManager::GetSingleton();
+        for (const edgetpu::EdgeTpuManager::DeviceEnumerationRecord& record : manager->EnumerateEdgeTpu()) {
+            std::shared_ptr<edgetpu::EdgeTpuContext> context = manager->OpenDevice(record.type, record.path);
+            if (!context) {
+                printf("Could not open Edge TPU %s\n", record.path.c_str());
+                continue;
+            }
+            addWorker("tpu:" + record.path, std::make_unique<TfliteDetector>(model, context, labels, _config.confidenceThresh,
+                                                                              _config.swapRB, _config.letterbox, cpu));
+        }
+    }
+    for (int i = 0; i < _config.cpuInterpreters; i++) {
+        addWorker("cpu:" + std::to_string(i), std::make_unique<TfliteDetector>(model, nullptr, labels, _config.confidenceThresh,
+                                                                                _config.swapRB, _config.letterbox, cpu));
+    }
+    if (_workers.empty()) {
+        throw std::runtime_error("DetectorPool::DetectorPool - No Edge TPUs found and no CPU interpreters requested");
+    }
+
+    // Room for everything that can be in flight, plus as much again finished and waiting on an earlier frame
+    size_t capacity = 2 * _workers.size() * (_config.workerDepth + 1);
+    _slots.resize(capacity);
+    _states.assign(capacity, Empty);
+
+    for (std::unique_ptr<Worker>& worker : _workers) {
+        worker->thread = std::thread(&DetectorPool::workerLoop, this, std::ref(*worker));
+    }
+}
+
+DetectorPool::~DetectorPool() {
+    close();
+    for (std::unique_ptr<Worker>& worker : _workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+
+void DetectorPool::addWorker(std::string name, std::unique_ptr<Detector> detector) {
+    printf("Detector pool worker %zu on %s\n", _workers.size(), name.c_str());
+    std::unique_ptr<Worker> worker = std::make_unique<Worker>();
+    worker->name = name;
+    worker->detector = std::move(detector);
+    worker->queue = std::make_unique<SpscQueue<Job>>(_config.workerDepth);
+    _workers.push_back(std::move(worker));
+}
+
+size_t DetectorPool::pickWorker() {
+    size_t n = _workers.size();
+    size_t start = _nextWorker++ % n;
+    if (_config.dispatch == Dispatch::RoundRobin) return start;
+
+    // Fewest frames queued or running; ties go round robin so idle workers all get used
+    size_t best = start;
+    int bestLoad = _workers[start]->inFlight.load();
+    for (size_t i = 1; i < n; i++) {
+        size_t candidate = (start + i) % n;
+        int load = _workers[candidate]->inFlight.load();
+        if (load < bestLoad) {
+            best = candidate;
+            bestLoad = load;
+        }
+    }
+    return best;
+}
+
+bool DetectorPool::submit(FrameResult&& item) {
+    uint64_t sequence;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return _closed || _submitted - _delivered < _slots.size(); });
+        if (_closed) return false;
+        sequence = _submitted++;
+    }
+
+    Worker& worker = *_workers[pickWorker()];
+    worker.inFlight.fetch_add(1);
+    if (!worker.queue->push(Job{sequence, std::move(item)})) {
+        // Closed while we waited; next() still has to step over this sequence number
+        worker.inFlight.fetch_sub(1);
+        complete(sequence, FrameResult(), Dropped);
+        return false;
+    }
+    return true;
+}
+
+bool DetectorPool::pass(FrameResult&& item) {
+    uint64_t sequence;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return _closed || _submitted - _delivered < _slots.size(); });
+        if (_closed) return false;
+        sequence = _submitted++;
+    }
+    complete(sequence, std::move(item), Ready);
+    return true;
+}
+
+bool DetectorPool::next(FrameResult& item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        if (_delivered == _submitted) {
+            if (_closed) return false;
+            _cond.wait(lock);
+            continue;
+        }
+        size_t slot = _delivered % _slots.size();
+        if (_states[slot] == Empty) {
+            _cond.wait(lock);
+            continue;
+        }
+        SlotState state = _states[slot];
+        item = std::move(_slots[slot]);
+        _slots[slot] = FrameResult();
+        _states[slot] = Empty;
+        _delivered++;
+        _cond.notify_all();
+        if (state == Ready) return true;
+    }
+}
+
+void DetectorPool::close() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _cond.notify_all();
+    }
+    for (std::unique_ptr<Worker>& worker : _workers) {
+        worker->queue->close();
+    }
+}
+
+void DetectorPool::complete(uint64_t sequence, FrameResult&& item, SlotState state) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t slot = sequence % _slots.size();
+    _slots[slot] = std::move(item);
+    _states[slot] = state;
+    _cond.notify_all();
+}
+
+void DetectorPool::fail(const std::string& error) {
+    // The message is in place before failed() can say so; only the first failure is kept
+    std::lock_guard<std::mutex> lock(_errorMutex);
+    if (_failed.load(std::memory_order_relaxed)) return;
+    _error = error;
+    _failed.store(true, std::memory_order_release);
+}
+
+std::string DetectorPool::error() const {
+    std::lock_guard<std::mutex> lock(_errorMutex);
+    return _error;
+}
+
+void DetectorPool::warmUp(const std::vector<cv::Size>& sizes) {
+    std::vector<std::thread> threads;
+    for (std::unique_ptr<Worker>& worker : _workers) {
+        threads.emplace_back([this, &sizes, w = worker.get()]() {
+            try {
+                for (const cv::Size& size : sizes) w->detector->warmUp(size);
+            } catch (std::runtime_error& e) {
+                fail(w->name + ": " + e.what());
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+}
+
+void DetectorPool::workerLoop(Worker& worker) {
+    Job job;
+    while (worker.queue->pop(job)) {
+        try {
+            const FrameLease& frame = job.item.frame;
+            if (frame.isYuv()) worker.detector->detectYuv(&frame.yuv(), 1, &job.item.detections);
+            else worker.detector->detect(frame.image(), job.item.detections);
+        } catch (std::runtime_error& e) {
+            fail(worker.name + ": " + e.what());
+        }
+        worker.processed.fetch_add(1, std::memory_order_relaxed);
+        worker.inFlight.fetch_sub(1);
+        complete(job.sequence, std::move(job.item), Ready);
+        job = Job();
+    }
+}
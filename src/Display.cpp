@@ -4,14 +4,16 @@
 
 #include "Display.h"
 
-Display::Display() {}
+Display::Display(bool printDetections) : _printDetections(printDetections) {
+    _text.reserve(128);
+}
 
-bool Display::show(cv::Mat& frame, std::vector<Detection>& detections, double fps) {
+bool Display::show(cv::Mat& frame, Detections& detections, double fps, const char* window) {
     // Draw results on the input image
     visualize(frame, detections, fps);
 
     // Visualize results
-    cv::imshow("Stream", frame);
+    cv::imshow(window, frame);
 
     int key = cv::waitKey(1);
     
@@ -19,18 +21,28 @@ bool Display::show(cv::Mat& frame, std::vector<Detection>& detections, double fp
     return false;
 }
 
-void Display::visualize(cv::Mat& input, std::vector<Detection>& detections, double fps) {
-    std::string fpsString = cv::format("FPS : %.2f", (float)fps);
-    for (Detection d : detections) {
+void Display::visualize(cv::Mat& input, Detections& detections, double fps) {
+    char line[128];
+    for (const Detection& d : detections) {
         // Print results
-        printf("Detection of %s, score: %f\n", d.label, d.score);
+        if (_printDetections)
+            printf("Detection of %s, score: %f, name: %s\n", d.label, d.score, d.name ? d.name : "-");
 
         // Draw bounding box
         cv::Rect rec((int)d.x1, (int)d.y1, (int)(d.x2 - d.x1), (int)(d.y2 - d.y1));
         rectangle(input, rec, cv::Scalar(0, 0, 255), 2);
-        // Draw label
-        putText(input, cv::format("%s", d.label), cv::Point2i(d.x1, d.y1-5), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 0, 255), 1);
+        // Draw label, or who it is when the recognizer found them in the gallery
+        if (d.name)
+            snprintf(line, sizeof(line), "%s %.2f", d.name, d.matchScore);
+        else if (d.trackId >= 0)
+            snprintf(line, sizeof(line), "%s #%d", d.label, d.trackId);
+        else
+            snprintf(line, sizeof(line), "%s", d.label);
+        _text.assign(line);
+        putText(input, _text, cv::Point2i(d.x1, d.y1-5), cv::FONT_HERSHEY_SIMPLEX, 0.5, d.name ? cv::Scalar(0, 255, 0) : cv::Scalar(0, 0, 255), 1);
 
     }
-    putText(input, fpsString, cv::Point(0, 15), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 2);
+    snprintf(line, sizeof(line), "FPS : %.2f", (float)fps);
+    _text.assign(line);
+    putText(input, _text, cv::Point(0, 15), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 2);
 }
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "EventLog.h"
+#include "Metrics.h"
+
+static Counter eventsLogged("namevault_events_logged_total", "Frames written to the event log");
+static Counter eventsDropped("namevault_frames_dropped_total{stage=\"event_log\"}", "Frames dropped because the next stage was full");
+static Counter segmentsWritten("namevault_event_segments_total", "Event log segments started");
+
+static const char kMagic[8] = {'N', 'V', 'E', 'V', 'E', 'N', 'T', '\0'};
+static const size_t kPage = 4096;
+// How long the writer sleeps when the ring is empty; frames wait at most this long to be written
+static const std::chrono::milliseconds kPollInterval(20);
+// Labels and names are far shorter; this keeps the worst case frame well inside a segment
+static const size_t kMaxText = 255;
+
+static size_t recordBytes(size_t payload) {
+    return (sizeof(EventRecord) + payload + 7) / 8 * 8;
+}
+
+static uint32_t recordChecksum(const EventRecord* record) {
+    const uint8_t* bytes = (const uint8_t*)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < record->bytes; i++) {
+        if (i == offsetof(EventRecord, checksum)) i += sizeof(record->checksum);
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint16_t toPixel(float v) {
+    return (uint16_t)std::min(65535L, std::max(0L, std::lround(v)));
+}
+
+static uint16_t toUnit(float v) {
+    return (uint16_t)std::lround(std::min(1.0f, std::max(0.0f, v)) * 65535);
+}
+
+static int64_t clockOffsetUs() {
+    auto system = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch());
+    auto steady = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch());
+    return (system - steady).count();
+}
+
+EventLog::EventLog(std::string dir, EventLogConfig config)
+    : _dir(std::move(dir)), _config(config), _queue(std::max<size_t>(1, config.queueDepth)) {
+
+    // Room for a frame with every detection and all its strings, whatever was asked for
+    _config.segmentBytes = std::max<size_t>(_config.segmentBytes, 64 << 10);
+    if (mkdir(_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("EventLog::EventLog - Could not create " + _dir);
+    }
+    if (access(_dir.c_str(), W_OK) != 0) {
+        throw std::runtime_error("EventLog::EventLog - Can't write to " + _dir);
+    }
+}
+
+EventLog::~EventLog() {
+    stop();
+}
+
+void EventLog::start() {
+    _thread = std::thread(&EventLog::run, this);
+}
+
+void EventLog::stop() {
+    _stopping.store(true, std::memory_order_release);
+    if (_thread.joinable()) _thread.join();
+}
+
+bool EventLog::record(const FrameResult& result) {
+    if (!_config.emptyFrames && result.detections.empty()) return true;
+
+    Event event;
+    event.index = result.index;
+    event.steadyUs = std::chrono::duration_cast<std::chrono::microseconds>(result.captureTime.time_since_epoch()).count();
+    event.source = result.source;
+    event.detected = result.detected;
+    for (const Detection& d : result.detections) {
+        event.detections.push_back({d.x1, d.y1, d.x2, d.y2, d.score, d.matchScore, d.trackId, d.label, d.name});
+    }
+    if (!_queue.tryPush(std::move(event))) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        eventsDropped.add();
+        return false;
+    }
+    return true;
+}
+
+void EventLog::run() {
+    Event event;
+    auto lastSync = std::chrono::steady_clock::now();
+    while (true) {
+        // Checked before draining, so whatever was queued before stop() still gets written
+        bool stopping = _stopping.load(std::memory_order_acquire);
+        while (_queue.tryPop(event)) {
+            if (_failed) continue;
+            try {
+                write(event);
+            } catch (std::runtime_error& e) {
+                _failed = true;
+                std::cout << "Error - event log stopped: " << e.what() << std::endl;
+            }
+        }
+        if (stopping) break;
+        if (_config.syncIntervalMs > 0 && _base
+            && std::chrono::steady_clock::now() - lastSync >= std::chrono::milliseconds(_config.syncIntervalMs)) {
+            sync();
+            lastSync = std::chrono::steady_clock::now();
+        }
+        // Polling rather than parking on the queue, so record() never has to wake this thread
+        std::this_thread::sleep_for(kPollInterval);
+    }
+    closeSegment();
+}
+
+uint32_t EventLog::stringId(const char* text) {
+    auto it = _ids.find(text);
+    return it == _ids.end() ? 0 : it->second;
+}
+
+void EventLog::write(const Event& event) {
+    // What the frame takes, with the strings it uses that the segment doesn't have yet
+    auto needed = [&]() {
+        _newStrings.clear();
+        size_t bytes = recordBytes(event.detections.size() * sizeof(LoggedDetection));
+        for (const EventDetection& d : event.detections) {
+            for (const char* text : {d.label, d.name}) {
+                if (!text || _ids.count(text) || std::find(_newStrings.begin(), _newStrings.end(), text) != _newStrings.end()) continue;
+                _newStrings.push_back(text);
+                bytes += recordBytes(std::min(strlen(text), kMaxText) + 1);
+            }
+        }
+        return bytes;
+    };
+
+    if (!_base) openSegment(event.steadyUs);
+    size_t bytes = needed();
+    if (_header->used + bytes > _header->capacity) {
+        closeSegment();
+        openSegment(event.steadyUs);
+        bytes = needed();
+    }
+    // After any new segment, so the offset is the one the segment was named with
+    int64_t timeUs = event.steadyUs + _clockOffsetUs;
+
+    for (const char* text : _newStrings) {
+        size_t length = std::min(strlen(text), kMaxText);
+        uint32_t id = _ids.size() + 1;
+        EventRecord* record = begin(EventType::String, length, length + 1);
+        record->frameIndex = id;
+        memcpy(record + 1, text, length);
+        commit(record);
+        _ids[text] = id;
+    }
+
+    EventRecord* record = begin(EventType::Frame, event.detections.size(), event.detections.size() * sizeof(LoggedDetection));
+    record->source = event.source;
+    record->flags = event.detected ? kEventDetected : 0;
+    record->frameIndex = event.index;
+    record->timeUs = timeUs;
+    LoggedDetection* logged = (LoggedDetection*)(record + 1);
+    for (size_t i = 0; i < event.detections.size(); i++) {
+        const EventDetection& d = event.detections[i];
+        logged[i] = {toPixel(d.x1), toPixel(d.y1), toPixel(d.x2), toPixel(d.y2), toUnit(d.score), toUnit(d.matchScore),
+                     d.trackId, d.label ? stringId(d.label) : 0, d.name ? stringId(d.name) : 0};
+    }
+    commit(record);
+
+    _header->minTimeUs = std::min(_header->minTimeUs, timeUs);
+    _header->maxTimeUs = std::max(_header->maxTimeUs, timeUs);
+    _header->frames++;
+    _header->detections += event.detections.size();
+    _logged.fetch_add(1, std::memory_order_relaxed);
+    eventsLogged.add();
+}
+
+EventRecord* EventLog::begin(EventType type, uint16_t count, size_t payload) {
+    EventRecord* record = (EventRecord*)(_base + _header->headerBytes + _header->used);
+    size_t bytes = recordBytes(payload);
+    // The padding too, so the checksum covers known bytes
+    memset(record, 0, bytes);
+    record->bytes = bytes;
+    record->type = (uint16_t)type;
+    record->count = count;
+    return record;
+}
+
+void EventLog::commit(EventRecord* record) {
+    record->checksum = recordChecksum(record);
+    std::atomic_thread_fence(std::memory_order_release);
+    _header->used += record->bytes;
+}
+
+void EventLog::openSegment(int64_t steadyUs) {
+    // NTP stepping the clock after boot is usual on a Pi without an RTC, so the offset is
+    // taken again here and at each sync rather than once for the log's lifetime
+    _clockOffsetUs = clockOffsetUs();
+    int64_t timeUs = steadyUs + _clockOffsetUs;
+
+    // Named by the first capture time, zero padded so the names sort by time
+    char name[64];
+    int fd = -1;
+    for (int attempt = 0; fd < 0; attempt++) {
+        snprintf(name, sizeof(name), "/events-%017lld.nvlog", (long long)std::max<int64_t>(0, timeUs) + attempt);
+        fd = open((_dir + name).c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && (errno != EEXIST || attempt == 16)) {
+            throw std::runtime_error("EventLog::openSegment - Could not create " + _dir + name);
+        }
+    }
+    std::string path = _dir + name;
+
+    // Reserving the blocks up front means a full card fails here, not as a SIGBUS mid-copy
+    size_t length = kPage + _config.segmentBytes;
+    void* base = MAP_FAILED;
+    if (posix_fallocate(fd, 0, length) == 0) {
+        base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (base == MAP_FAILED) {
+        close(fd);
+        unlink(path.c_str());
+        throw std::runtime_error("EventLog::openSegment - Could not reserve " + std::to_string(length) + " bytes for " + path);
+    }
+
+    _path = path;
+    _fd = fd;
+    _base = (uint8_t*)base;
+    _header = (EventSegmentHeader*)_base;
+    memset(_header, 0, sizeof(EventSegmentHeader));
+    memcpy(_header->magic, kMagic, sizeof(kMagic));
+    _header->version = kVersion;
+    _header->headerBytes = kPage;
+    _header->capacity = _config.segmentBytes;
+    _header->minTimeUs = INT64_MAX;
+    _header->maxTimeUs = INT64_MIN;
+    _synced = 0;
+    _ids.clear();
+    segmentsWritten.add();
+
+    enforceLimit();
+}
+
+void EventLog::closeSegment() {
+    if (!_base) return;
+    sync();
+    size_t used = _header->headerBytes + _header->used;
+    munmap(_base, kPage + _config.segmentBytes);
+    // Gives back the part of the reservation that wasn't needed
+    if (ftruncate(_fd, used) != 0 || fsync(_fd) != 0) {
+        std::cout << "Error - Could not trim " << _path << std::endl;
+    }
+    close(_fd);
+    _fd = -1;
+    _base = nullptr;
+    _header = nullptr;
+}
+
+void EventLog::sync() {
+    size_t end = _header->headerBytes + _header->used;
+    size_t from = _synced / kPage * kPage;
+    if (end > from) msync(_base + from, end - from, MS_SYNC);
+    // And the header, for the used count
+    msync(_base, kPage, MS_SYNC);
+    _synced = end;
+    _clockOffsetUs = clockOffsetUs();
+}
+
+void EventLog::enforceLimit() {
+    if (!_config.maxBytes) return;
+    struct File {
+        std::string path;
+        uint64_t size;
+        int64_t newestUs;
+    };
+    std::vector<File> files;
+    uint64_t total = 0;
+    for (const std::string& path : segments(_dir)) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) continue;
+        total += st.st_size;
+        if (path == _path) continue;
+        // A segment's names follow the clock when it was opened, which may since have been
+        // stepped, so age goes by the last frame in it, or by mtime when that can't be read
+        int64_t newestUs = (int64_t)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+        EventSegmentHeader header;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+                && memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.frames > 0) {
+                newestUs = header.maxTimeUs;
+            }
+            close(fd);
+        }
+        files.push_back({path, (uint64_t)st.st_size, newestUs});
+    }
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.newestUs < b.newestUs; });
+    // Oldest first, never the one being written
+    for (size_t i = 0; i < files.size() && total > _config.maxBytes; i++) {
+        if (unlink(files[i].path.c_str()) == 0) total -= files[i].size;
+    }
+}
+
+std::vector<std::string> EventLog::segments(const std::string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        throw std::runtime_error("EventLog::segments - Could not read " + dir);
+    }
+    std::vector<std::string> paths;
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() > 13 && name.compare(0, 7, "events-") == 0 && name.compare(name.size() - 6, 6, ".nvlog") == 0) {
+            paths.push_back(dir + "/" + name);
+        }
+    }
+    closedir(d);
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+EventSegment::EventSegment(std::string path) : _path(std::move(path)) {
+
+    _fd = open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0) {
+        throw std::runtime_error("EventSegment::EventSegment - Could not open " + _path);
+    }
+    struct stat st;
+    if (fstat(_fd, &st) < 0 || (size_t)st.st_size < sizeof(EventSegmentHeader)) {
+        close(_fd);
+        throw std::runtime_error("EventSegment::EventSegment - " + _path + " is too small to be a segment");
+    }
+    _length = st.st_size;
+    void* base = mmap(nullptr, _length, PROT_READ, MAP_SHARED, _fd, 0);
+    if (base == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("EventSegment::EventSegment - Could not map " + _path);
+    }
+    _base = (uint8_t*)base;
+    _header = (const EventSegmentHeader*)_base;
+
+    const char* problem = nullptr;
+    if (memcmp(_header->magic, kMagic, sizeof(kMagic)) != 0) problem = "bad magic";
+    else if (_header->version != EventLog::kVersion) problem = "unsupported version";
+    else if (_header->headerBytes < sizeof(EventSegmentHeader) || _header->headerBytes > _length) problem = "bad header size";
+    if (problem) {
+        munmap(_base, _length);
+        close(_fd);
+        throw std::runtime_error("EventSegment::EventSegment - " + _path + ": " + problem);
+    }
+    // A segment still being written, or one a crash left behind, can claim more than is there
+    _offset = _header->headerBytes;
+    _end = _offset + std::min<uint64_t>(_header->used, _length - _offset);
+    _strings.assign(1, nullptr);
+
+    madvise(_base, _length, MADV_SEQUENTIAL);
+}
+
+EventSegment::~EventSegment() {
+    if (_base) munmap(_base, _length);
+    if (_fd >= 0) close(_fd);
+}
+
+bool EventSegment::next(const EventRecord*& frame) {
+    while (_offset + sizeof(EventRecord) <= _end) {
+        const EventRecord* record = (const EventRecord*)(_base + _offset);
+        bool ok = record->bytes >= sizeof(EventRecord) && record->bytes % 8 == 0 && _offset + record->bytes <= _end
+               && record->checksum == recordChecksum(record);
+        if (ok && record->type == (uint16_t)EventType::Frame) {
+            ok = sizeof(EventRecord) + record->count * sizeof(LoggedDetection) <= record->bytes;
+        } else if (ok && record->type == (uint16_t)EventType::String) {
+            ok = sizeof(EventRecord) + record->count + 1 <= record->bytes && record->frameIndex < (1 << 20)
+              && ((const char*)(record + 1))[record->count] == '\0';
+        }
+        if (!ok) {
+            _damaged = true;
+            _offset = _end;
+            return false;
+        }
+        _offset += record->bytes;
+
+        if (record->type == (uint16_t)EventType::Frame) {
+            frame = record;
+            return true;
+        }
+        if (record->type == (uint16_t)EventType::String) {
+            // Written with its nul, so the text can be used straight from the mapping
+            if (record->frameIndex >= _strings.size()) _strings.resize(record->frameIndex + 1, nullptr);
+            _strings[record->frameIndex] = (const char*)(record + 1);
+        }
+        // Other types are skipped, so later versions can add some
+    }
+    return false;
+}
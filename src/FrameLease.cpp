@@ -0,0 +1,87 @@
+#include "FrameLease.h"
+
+FrameLease::FrameLease(cv::Mat image) : _image(image) {}
+
+FrameLease::FrameLease(cv::Mat image, FrameClaim* claim, bool readOnly) : _image(image), _claim(claim), _readOnly(readOnly) {
+    if (_claim) _claim->retain();
+}
+
+FrameLease::FrameLease(const YuvPlanes& planes, FrameClaim* claim) : _image(planes.luma()), _yuv(planes), _claim(claim), _readOnly(true) {
+    if (_claim) _claim->retain();
+}
+
+FrameLease::FrameLease(const FrameLease& other) : _image(other._image), _yuv(other._yuv), _claim(other._claim), _readOnly(other._readOnly) {
+    if (_claim) _claim->retain();
+}
+
+FrameLease::FrameLease(FrameLease&& other) : _image(std::move(other._image)), _yuv(other._yuv), _claim(other._claim), _readOnly(other._readOnly) {
+    other._yuv = YuvPlanes();
+    other._claim = nullptr;
+    other._readOnly = false;
+}
+
+FrameLease& FrameLease::operator=(const FrameLease& other) {
+    if (this == &other) return *this;
+    // Take the new claim before dropping the old one, in case they're the same buffer
+    if (other._claim) other._claim->retain();
+    FrameClaim* old = _claim;
+    _image = other._image;
+    _yuv = other._yuv;
+    _claim = other._claim;
+    _readOnly = other._readOnly;
+    if (old) old->drop();
+    return *this;
+}
+
+FrameLease& FrameLease::operator=(FrameLease&& other) {
+    if (this == &other) return *this;
+    FrameClaim* old = _claim;
+    _image = std::move(other._image);
+    _yuv = other._yuv;
+    _claim = other._claim;
+    _readOnly = other._readOnly;
+    other._yuv = YuvPlanes();
+    other._claim = nullptr;
+    other._readOnly = false;
+    if (old) old->drop();
+    return *this;
+}
+
+FrameLease::~FrameLease() {
+    // Let go of the pixels before the buffer can be handed out again
+    _image.release();
+    if (_claim) _claim->drop();
+}
+
+const cv::Mat& FrameLease::bgr(cv::Mat& scratch) const {
+    if (_yuv.empty()) return _image;
+    _yuv.toBgr(scratch);
+    return scratch;
+}
+
+cv::Mat FrameLease::writable() const {
+    if (!_yuv.empty()) {
+        cv::Mat colour;
+        _yuv.toBgr(colour);
+        return colour;
+    }
+    return _readOnly ? _image.clone() : _image;
+}
+
+cv::Mat FrameLease::writable(cv::Mat& scratch) const {
+    if (!_yuv.empty()) {
+        _yuv.toBgr(scratch);
+        return scratch;
+    }
+    if (!_readOnly) return _image;
+    _image.copyTo(scratch);
+    return scratch;
+}
+
+void FrameLease::reset() {
+    _image.release();
+    _yuv = YuvPlanes();
+    if (_claim) _claim->drop();
+    _claim = nullptr;
+    _readOnly = false;
+}
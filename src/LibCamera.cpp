@@ -6,16 +6,37 @@
 using namespace libcamera;
 using namespace std::placeholders;
 
-int LibCamera::initCamera() {
+static std::shared_ptr<CameraManager> sharedManager(int &ret) {
+    static std::mutex mutex;
+    static std::weak_ptr<CameraManager> shared;
+    std::lock_guard<std::mutex> lock(mutex);
+    ret = 0;
+    std::shared_ptr<CameraManager> manager = shared.lock();
+    if (manager)
+        return manager;
+    manager = std::make_shared<CameraManager>();
+    ret = manager->start();
+    if (ret)
+        return nullptr;
+    shared = manager;
+    return manager;
+}
+
+int LibCamera::initCamera(int index) {
     int ret;
-    cm = std::make_unique<CameraManager>();
-    ret = cm->start();
+    cm = sharedManager(ret);
     if (ret){
         std::cout << "Failed to start camera manager: "
               << ret << std::endl;
         return ret;
     }
-    cameraId = cm->cameras()[0]->id();
+    if (index < 0 || index >= (int)cm->cameras().size()) {
+        std::cerr << "Camera " << index << " not found, "
+              << cm->cameras().size() << " attached" << std::endl;
+        return 1;
+    }
+    cameraIndex_ = index;
+    cameraId = cm->cameras()[index]->id();
     camera_ = cm->get(cameraId);
     if (!camera_) {
         std::cerr << "Camera " << cameraId << " not found" << std::endl;
@@ -94,6 +115,11 @@ int LibCamera::startCapture() {
         std::cout << "Allocated " << nbuffers << " buffers\n";
     }
 
+    if (nbuffers > 64) {
+        std::cerr << "Too many buffers for the request queue" << std::endl;
+        return -ENOMEM;
+    }
+
     for (unsigned int i = 0; i < nbuffers; i++) {
         std::unique_ptr<Request> request = camera_->createRequest();
         if (!request) {
@@ -113,11 +139,18 @@ int LibCamera::startCapture() {
                       << std::endl;
                 return ret;
             }
+            // Multi-planar formats such as YUV420 put every plane in one dmabuf at its own
+            // offset, so each fd is mapped once, far enough to cover all its planes
+            std::map<int, unsigned int> spans;
             for (const FrameBuffer::Plane &plane : buffer->planes()) {
-                void *memory = mmap(NULL, plane.length, PROT_READ, MAP_SHARED,
-                            plane.fd.get(), 0);
-                mappedBuffers_[plane.fd.get()] =
-                    std::make_pair(memory, plane.length);
+                unsigned int &span = spans[plane.fd.get()];
+                span = std::max(span, plane.offset + plane.length);
+            }
+            for (const auto &span : spans) {
+                void *memory = mmap(NULL, span.second, PROT_READ, MAP_SHARED,
+                            span.first, 0);
+                mappedBuffers_[span.first] =
+                    std::make_pair(memory, span.second);
             }
         }
 
@@ -179,6 +212,7 @@ void LibCamera::requestComplete(Request *request) {
 }
 
 void LibCamera::processRequest(Request *request) {
+    // Can't fail, the queue has room for every request we created
     requestQueue.push(request);
 }
 
@@ -189,31 +223,36 @@ void LibCamera::returnFrameBuffer(LibcameraOutData frameData) {
     queueRequest(req);
 }
 
-bool LibCamera::readFrame(LibcameraOutData *frameData){
+int LibCamera::frameFd() const {
+    return requestQueue.fd();
+}
+
+bool LibCamera::readFrame(LibcameraOutData *frameData, int timeoutMs){
+    // The queue only supports one consumer at a time
     std::lock_guard<std::mutex> lock(free_requests_mutex_);
-    // int w, h, stride;
-    if (!requestQueue.empty()){
-        Request *request = this->requestQueue.front();
+    Request *request = nullptr;
+    if (requestQueue.pop(request, timeoutMs)){
 
         const Request::BufferMap &buffers = request->buffers();
         for (auto it = buffers.begin(); it != buffers.end(); ++it) {
             FrameBuffer *buffer = it->second;
+            frameData->size = 0;
+            frameData->planeCount = std::min<size_t>(buffer->planes().size(), 3);
             for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
                 const FrameBuffer::Plane &plane = buffer->planes()[i];
                 const FrameMetadata::Plane &meta = buffer->metadata().planes()[i];
-                
-                void *data = mappedBuffers_[plane.fd.get()].first;
+
+                uint8_t *data = (uint8_t *)mappedBuffers_[plane.fd.get()].first + plane.offset;
                 int length = std::min(meta.bytesused, plane.length);
 
-                frameData->size = length;
-                frameData->imageData = (uint8_t *)data;
+                frameData->size += length;
+                if (i < 3) frameData->planes[i] = data;
             }
+            frameData->imageData = frameData->planes[0];
         }
-        this->requestQueue.pop();
         frameData->request = (uint64_t)request;
         return true;
     } else {
-        Request *request = nullptr;
         frameData->request = (uint64_t)request;
         return false;
     }
@@ -242,8 +281,7 @@ void LibCamera::stopCamera() {
         }
         camera_->requestCompleted.disconnect(this, &LibCamera::requestComplete);
     }
-    while (!requestQueue.empty())
-        requestQueue.pop();
+    requestQueue.clear();
 
     for (auto &iter : mappedBuffers_)
 	{
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MATCHER_NEON
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCHER_X86
+#endif
+
+#include "Matcher.h"
+
+// Each kernel scores rows[ids[j]] (or rows[j] without ids) for j in [begin, end) into scores
+struct ScanArgs {
+    const uint8_t* rows;
+    size_t rowBytes;
+    const float* rowScales;
+    const uint32_t* ids;
+};
+
+typedef void (*ScanInt8)(const ScanArgs& args, size_t begin, size_t end, const int8_t* q8, const int16_t* q16, float qScale, float* scores);
+typedef void (*ScanFp16)(const ScanArgs& args, size_t begin, size_t end, const float* q, float* scores);
+
+static void scanInt8Scalar(const ScanArgs& args, size_t begin, size_t end, const int8_t* q8, const int16_t* /*q16*/, float qScale, float* scores) {
+    for (size_t j = begin; j < end; j++) {
+        size_t r = args.ids ? args.ids[j] : j;
+        const int8_t* row = (const int8_t*)(args.rows + r * args.rowBytes);
+        int32_t sum = 0;
+        for (int k = 0; k < kEmbeddingSize; k++) sum += row[k] * q8[k];
+        scores[j - begin] = sum * qScale * args.rowScales[r];
+    }
+}
+
+static void scanFp16Scalar(const ScanArgs& args, size_t begin, size_t end, const float* q, float* scores) {
+    for (size_t j = begin; j < end; j++) {
+        size_t r = args.ids ? args.ids[j] : j;
+        const uint16_t* row = (const uint16_t*)(args.rows + r * args.rowBytes);
+        float sum = 0;
+        for (int k = 0; k < kEmbeddingSize; k++) sum += halfToFloat(row[k]) * q[k];
+        scores[j - begin] = sum;
+    }
+}
+
+#if defined(MATCHER_NEON)
+
+static inline int32_t sumLanes(int32x4_t v) {
+#if defined(__aarch64__)
+    return vaddvq_s32(v);
+#else
+    int32x2_t s = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+    return vget_lane_s32(vpadd_s32(s, s), 0);
+#endif
+}
+
+static void scanInt8Neon(const ScanArgs& args, size_t begin, size_t end, const int8_t* q8, const int16_t* /*q16*/, float qScale, float* scores) {
+    int8x16_t q[kEmbeddingSize / 16];
+    for (int k = 0; k < kEmbeddingSize / 16; k++) q[k] = vld1q_s8(q8 + 16 * k);
+    for (size_t j = begin; j < end; j++) {
+        size_t r = args.ids ? args.ids[j] : j;
+        const int8_t* row = (const int8_t*)(args.rows + r * args.rowBytes);
+        // Two int8 products fit an int16 (2 * 127 * 127), then widen pairwise into int32
+        int32x4_t acc = vdupq_n_s32(0);
+        for (int k = 0; k < kEmbeddingSize / 16; k++) {
+            int8x16_t a = vld1q_s8(row + 16 * k);
+            int16x8_t p = vmull_s8(vget_low_s8(a), vget_low_s8(q[k]));
+            p = vmlal_s8(p, vget_high_s8(a), vget_high_s8(q[k]));
+            acc = vpadalq_s16(acc, p);
+        }
+        scores[j - begin] = sumLanes(acc) * qScale * args.rowScales[r];
+    }
+}
+
+#if defined(__aarch64__)
+static void scanFp16Neon(const ScanArgs& args, size_t begin, size_t end, const float* q, float* scores) {
+    for (size_t j = begin; j < end; j++) {
+        size_t r = args.ids ? args.ids[j] : j;
+        const uint16_t* row = (const uint16_t*)(args.rows + r * args.rowBytes);
+        float32x4_t acc0 = vdupq_n_f32(0);
+        float32x4_t acc1 = vdupq_n_f32(0);
+        for (int k = 0; k < kEmbeddingSize; k += 8) {
+            float32x4_t a0 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + k)));
+            float32x4_t a1 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + k + 4)));
+            acc0 = vfmaq_f32(acc0, a0, vld1q_f32(q + k));
+            acc1 = vfmaq_f32(acc1, a1, vld1q_f32(q + k + 4));
+        }
+        scores[j - begin] = vaddvq_f32(vaddq_f32(acc0, acc1));
+    }
+}
+#endif
+
+#elif defined(MATCHER_X86)
+
+__attribute__((target("avx2")))
+static void scanInt8Avx2(const ScanArgs& args, size_t begin, size_t end, const int8_t* /*q8*/, const int16_t* q16, float qScale, float* scores) {
+    for (size_t j = begin; j < end; j++) {
+        size_t r = args.ids ? args.ids[j] : j;
+        const int8_t* row = (const int8_t*)(args.rows + r * args.rowBytes);
+        // Widen 16 int8 to int16 and let madd pair them up into int32
+        __m256i acc = _mm256_setzero_si256();
+        for (int k = 0; k < kEmbeddingSize; k += 16) {
+            __m256i a = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)(row + k)));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(q16 + k));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a, b));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        scores[j - begin] = _mm_cvtsi128_si32(s) * qScale * args.rowScales[r];
+    }
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void scanFp16Avx2(const ScanArgs& args, size_t begin, size_t end, const float* q, float* scores) {
+    for (size_t j = begin; j < end; j++) {
+        size_t r = args.ids ? args.ids[j] : j;
+        const uint16_t* row = (const uint16_t*)(args.rows + r * args.rowBytes);
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        for (int k = 0; k < kEmbeddingSize; k += 16) {
+            acc0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((const __m128i*)(row + k))), _mm256_loadu_ps(q + k), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((const __m128i*)(row + k + 8))), _mm256_loadu_ps(q + k + 8), acc1);
+        }
+        __m256 acc = _mm256_add_ps(acc0, acc1);
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        scores[j - begin] = _mm_cvtss_f32(s);
+    }
+}
+
+#endif
+
+// Picked once for the CPU we're on
+static ScanInt8 scanInt8Kernel() {
+#if defined(MATCHER_NEON)
+    return scanInt8Neon;
+#elif defined(MATCHER_X86)
+    if (__builtin_cpu_supports("avx2")) return scanInt8Avx2;
+#endif
+    return scanInt8Scalar;
+}
+
+static ScanFp16 scanFp16Kernel() {
+#if defined(MATCHER_NEON) && defined(__aarch64__)
+    return scanFp16Neon;
+#elif defined(MATCHER_X86)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) return scanFp16Avx2;
+#endif
+    return scanFp16Scalar;
+}
+
+static const ScanInt8 kScanInt8 = scanInt8Kernel();
+static const ScanFp16 kScanFp16 = scanFp16Kernel();
+
+static bool worse(const Match& a, const Match& b) {
+    return a.score > b.score;
+}
+
+// Keeps the k best of scores in a min-heap, so most rows are rejected with one compare
+static void pushTopK(std::vector<Match>& heap, int k, const uint32_t* ids, size_t begin, const std::vector<float>& scores, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        float score = scores[j];
+        if ((int)heap.size() == k) {
+            if (score <= heap.front().score) continue;
+            std::pop_heap(heap.begin(), heap.end(), worse);
+            heap.pop_back();
+        }
+        heap.push_back({ids ? ids[begin + j] : (uint32_t)(begin + j), score});
+        std::push_heap(heap.begin(), heap.end(), worse);
+    }
+}
+
+Matcher::Matcher(const NameVault& vault, MatcherConfig config) : _vault(vault), _config(config) {
+
+    size_t rows = _vault.size();
+    _shards = std::max(1, std::min(_config.threads, (int)(rows / std::max<size_t>(1, _config.minRowsPerThread))));
+    _heaps.resize(_shards);
+    _scores.resize(_shards);
+    for (int i = 1; i < _shards; i++) {
+        _workers.emplace_back(&Matcher::workerLoop, this, i);
+    }
+
+    if (rows >= _config.ivfMinRows) {
+        buildIndex(_config.ivfLists > 0 ? _config.ivfLists : (int)std::lround(std::sqrt((double)rows)));
+    }
+}
+
+Matcher::~Matcher() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& worker : _workers) worker.join();
+}
+
+void Matcher::prepareQuery(const float* query) {
+    memcpy(_query, query, sizeof(_query));
+    if (_vault.format() != VaultFormat::Int8) return;
+
+    // Quantised like the rows, so the inner loop stays in integers
+    float maxAbs = 0;
+    for (int k = 0; k < kEmbeddingSize; k++) maxAbs = std::max(maxAbs, std::fabs(query[k]));
+    _queryScale = maxAbs > 0 ? maxAbs / 127 : 1;
+    for (int k = 0; k < kEmbeddingSize; k++) {
+        _query8[k] = (int8_t)std::lround(query[k] / _queryScale);
+        _query16[k] = _query8[k];
+    }
+}
+
+void Matcher::scan(const uint32_t* ids, size_t begin, size_t end, std::vector<float>& scores) const {
+    if (scores.size() < end - begin) scores.resize(end - begin);
+    ScanArgs args = {(const uint8_t*)_vault.row(0), _vault.rowBytes(), _vault.scales(), ids};
+    if (_vault.format() == VaultFormat::Int8) {
+        kScanInt8(args, begin, end, _query8, _query16, _queryScale, scores.data());
+    } else {
+        kScanFp16(args, begin, end, _query, scores.data());
+    }
+}
+
+void Matcher::scanShard(int shard) {
+    size_t rows = _vault.size();
+    size_t begin = rows * shard / _shards;
+    size_t end = rows * (shard + 1) / _shards;
+    std::vector<Match>& heap = _heaps[shard];
+    heap.clear();
+    // Scored in blocks so the score buffer stays in L1
+    const size_t kBlock = 1024;
+    for (size_t b = begin; b < end; b += kBlock) {
+        size_t e = std::min(end, b + kBlock);
+        scan(nullptr, b, e, _scores[shard]);
+        pushTopK(heap, _k, nullptr, b, _scores[shard], e - b);
+    }
+}
+
+void Matcher::workerLoop(int shard) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [&] { return _stop || _generation != seen; });
+        if (_stop) return;
+        seen = _generation;
+        lock.unlock();
+        scanShard(shard);
+        lock.lock();
+        if (--_pending == 0) _done.notify_one();
+    }
+}
+
+void Matcher::search(const float* query, int k, std::vector<Match>& matches) {
+    if (hasIndex()) {
+        searchApprox(query, k, matches);
+    } else {
+        searchExact(query, k, matches);
+    }
+}
+
+void Matcher::searchExact(const float* query, int k, std::vector<Match>& matches) {
+    matches.clear();
+    if (_vault.size() == 0 || k <= 0) return;
+    prepareQuery(query);
+    _k = k;
+
+    if (_shards > 1) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending = _shards - 1;
+        _generation++;
+    }
+    _wake.notify_all();
+    scanShard(0);
+    if (_shards > 1) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _pending == 0; });
+    }
+
+    for (const std::vector<Match>& heap : _heaps) {
+        matches.insert(matches.end(), heap.begin(), heap.end());
+    }
+    std::sort(matches.begin(), matches.end(), worse);
+    if ((int)matches.size() > k) matches.resize(k);
+}
+
+void Matcher::searchApprox(const float* query, int k, std::vector<Match>& matches) {
+    if (!hasIndex()) {
+        searchExact(query, k, matches);
+        return;
+    }
+    matches.clear();
+    if (k <= 0) return;
+    prepareQuery(query);
+
+    // Closest centroids first
+    int lists = _lists.size();
+    _probe.resize(lists);
+    for (int c = 0; c < lists; c++) {
+        const float* centroid = &_centroids[c * kEmbeddingSize];
+        float score = 0;
+        for (int d = 0; d < kEmbeddingSize; d++) score += centroid[d] * query[d];
+        _probe[c] = {score, c};
+    }
+    int probe = std::min(lists, std::max(1, _config.ivfProbe));
+    std::partial_sort(_probe.begin(), _probe.begin() + probe, _probe.end(), std::greater<std::pair<float, int>>());
+
+    std::vector<Match>& heap = _heaps[0];
+    heap.clear();
+    for (int p = 0; p < probe; p++) {
+        const std::vector<uint32_t>& ids = _lists[_probe[p].second];
+        scan(ids.data(), 0, ids.size(), _scores[0]);
+        pushTopK(heap, k, ids.data(), 0, _scores[0], ids.size());
+    }
+    matches = heap;
+    std::sort(matches.begin(), matches.end(), worse);
+}
+
+void Matcher::buildIndex(int lists) {
+    size_t rows = _vault.size();
+    lists = std::max(1, std::min(lists, (int)rows));
+    _centroids.clear();
+    _lists.clear();
+    if (rows == 0) return;
+
+    // Spherical k-means on a strided sample, then every row goes to its nearest centroid
+    size_t samples = std::min(rows, (size_t)lists * 64);
+    std::vector<float> sample(samples * kEmbeddingSize);
+    for (size_t i = 0; i < samples; i++) {
+        _vault.decode(i * rows / samples, &sample[i * kEmbeddingSize]);
+    }
+    _centroids.resize(lists * kEmbeddingSize);
+    for (int c = 0; c < lists; c++) {
+        memcpy(&_centroids[c * kEmbeddingSize], &sample[(size_t)c * samples / lists * kEmbeddingSize], kEmbeddingSize * sizeof(float));
+    }
+
+    auto nearest = [&](const float* v) {
+        int best = 0;
+        float bestScore = -2;
+        for (int c = 0; c < lists; c++) {
+            const float* centroid = &_centroids[c * kEmbeddingSize];
+            float score = 0;
+            for (int d = 0; d < kEmbeddingSize; d++) score += centroid[d] * v[d];
+            if (score > bestScore) {
+                best = c;
+                bestScore = score;
+            }
+        }
+        return best;
+    };
+
+    std::vector<float> sums(lists * kEmbeddingSize);
+    for (int iteration = 0; iteration < 10; iteration++) {
+        std::fill(sums.begin(), sums.end(), 0.f);
+        for (size_t i = 0; i < samples; i++) {
+            const float* v = &sample[i * kEmbeddingSize];
+            float* sum = &sums[nearest(v) * kEmbeddingSize];
+            for (int d = 0; d < kEmbeddingSize; d++) sum[d] += v[d];
+        }
+        for (int c = 0; c < lists; c++) {
+            float* sum = &sums[c * kEmbeddingSize];
+            float norm = 0;
+            for (int d = 0; d < kEmbeddingSize; d++) norm += sum[d] * sum[d];
+            // An empty list keeps its old centroid
+            if (norm == 0) continue;
+            norm = 1 / std::sqrt(norm);
+            for (int d = 0; d < kEmbeddingSize; d++) _centroids[c * kEmbeddingSize + d] = sum[d] * norm;
+        }
+    }
+
+    _lists.resize(lists);
+    float v[kEmbeddingSize];
+    for (size_t i = 0; i < rows; i++) {
+        _vault.decode(i, v);
+        _lists[nearest(v)].push_back(i);
+    }
+    printf("Matcher indexed %zu identities into %d lists\n", rows, lists);
+}
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Metrics.h"
+
+static const int kMaxCounters = 64;
+static const int kMaxHistograms = 32;
+
+// Upper bounds in seconds; the last bucket is +Inf
+static const double kBucketBounds[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0};
+static const int kBuckets = sizeof(kBucketBounds) / sizeof(kBucketBounds[0]) + 1;
+
+namespace {
+
+struct HistogramShard {
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sumNs;
+};
+
+struct Shard {
+    std::atomic<uint64_t> counters[kMaxCounters];
+    HistogramShard histograms[kMaxHistograms];
+};
+
+struct MetricInfo {
+    std::string name;
+    std::string help;
+};
+
+struct Registry {
+    std::mutex mutex;
+    // Shards outlive their threads so counts from finished threads aren't lost
+    std::vector<Shard*> shards;
+    std::vector<MetricInfo> counters;
+    std::vector<MetricInfo> histograms;
+    std::vector<std::pair<MetricInfo, const Gauge*>> gauges;
+};
+
+}
+
+static Registry& registry() {
+    static Registry registry;
+    return registry;
+}
+
+static Shard& localShard() {
+    thread_local Shard* shard = nullptr;
+    if (!shard) {
+        shard = new Shard();
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.shards.push_back(shard);
+    }
+    return *shard;
+}
+
+// Only the owning thread writes a shard, so a plain load and store is enough and avoids a locked add
+static inline void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+Counter::Counter(const char* name, const char* help) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.counters.size() >= kMaxCounters) {
+        throw std::runtime_error("Counter::Counter - Too many counters");
+    }
+    _id = r.counters.size();
+    r.counters.push_back({name, help});
+}
+
+void Counter::add(uint64_t n) const {
+    bump(localShard().counters[_id], n);
+}
+
+uint64_t Counter::value() const {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    uint64_t total = 0;
+    for (Shard* shard : r.shards) total += shard->counters[_id].load(std::memory_order_relaxed);
+    return total;
+}
+
+Gauge::Gauge(const char* name, const char* help) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.gauges.push_back({{name, help}, this});
+}
+
+Histogram::Histogram(const char* name, const char* help) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.histograms.size() >= kMaxHistograms) {
+        throw std::runtime_error("Histogram::Histogram - Too many histograms");
+    }
+    _id = r.histograms.size();
+    r.histograms.push_back({name, help});
+}
+
+void Histogram::observe(std::chrono::steady_clock::duration elapsed) const {
+    HistogramShard& h = localShard().histograms[_id];
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    double seconds = ns * 1e-9;
+    int bucket = 0;
+    while (bucket < kBuckets - 1 && seconds > kBucketBounds[bucket]) bucket++;
+    bump(h.buckets[bucket], 1);
+    bump(h.count, 1);
+    bump(h.sumNs, ns);
+}
+
+static std::string family(const std::string& name) {
+    return name.substr(0, name.find('{'));
+}
+
+std::string renderMetrics() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::string out;
+    char line[512];
+
+    // Labelled series of one family have to sit together under a single HELP/TYPE
+    std::vector<size_t> order(r.counters.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return family(r.counters[a].name) < family(r.counters[b].name); });
+    std::string last;
+    for (size_t id : order) {
+        const MetricInfo& info = r.counters[id];
+        if (family(info.name) != last) {
+            last = family(info.name);
+            snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n", last.c_str(), info.help.c_str(), last.c_str());
+            out += line;
+        }
+        uint64_t total = 0;
+        for (Shard* shard : r.shards) total += shard->counters[id].load(std::memory_order_relaxed);
+        snprintf(line, sizeof(line), "%s %llu\n", info.name.c_str(), (unsigned long long)total);
+        out += line;
+    }
+
+    order.resize(r.gauges.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return family(r.gauges[a].first.name) < family(r.gauges[b].first.name); });
+    last.clear();
+    for (size_t id : order) {
+        const auto& gauge = r.gauges[id];
+        if (family(gauge.first.name) != last) {
+            last = family(gauge.first.name);
+            snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s gauge\n", last.c_str(), gauge.first.help.c_str(), last.c_str());
+            out += line;
+        }
+        snprintf(line, sizeof(line), "%s %g\n", gauge.first.name.c_str(), gauge.second->value());
+        out += line;
+    }
+
+    for (size_t id = 0; id < r.histograms.size(); id++) {
+        const char* name = r.histograms[id].name.c_str();
+        uint64_t buckets[kBuckets] = {0};
+        uint64_t count = 0;
+        uint64_t sumNs = 0;
+        for (Shard* shard : r.shards) {
+            HistogramShard& h = shard->histograms[id];
+            for (int b = 0; b < kBuckets; b++) buckets[b] += h.buckets[b].load(std::memory_order_relaxed);
+            count += h.count.load(std::memory_order_relaxed);
+            sumNs += h.sumNs.load(std::memory_order_relaxed);
+        }
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, r.histograms[id].help.c_str(), name);
+        out += line;
+        uint64_t cumulative = 0;
+        for (int b = 0; b < kBuckets - 1; b++) {
+            cumulative += buckets[b];
+            snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name, kBucketBounds[b], (unsigned long long)cumulative);
+            out += line;
+        }
+        cumulative += buckets[kBuckets - 1];
+        snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n",
+                 name, (unsigned long long)cumulative, name, sumNs * 1e-9, name, (unsigned long long)count);
+        out += line;
+    }
+    return out;
+}
+
+MetricsExporter::MetricsExporter(std::string textFile, std::string socketPath, std::chrono::milliseconds interval)
+    : _textFile(textFile), _socketPath(socketPath), _interval(interval) {
+
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakeFd < 0) {
+        throw std::runtime_error("MetricsExporter::MetricsExporter - Failed to create eventfd");
+    }
+
+    if (!_socketPath.empty()) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (_socketPath.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("MetricsExporter::MetricsExporter - Socket path too long");
+        }
+        strcpy(addr.sun_path, _socketPath.c_str());
+        _listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(_socketPath.c_str());
+        if (_listenFd < 0 || bind(_listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listenFd, 4) < 0) {
+            throw std::runtime_error("MetricsExporter::MetricsExporter - Could not listen on " + _socketPath);
+        }
+    }
+
+    _thread = std::thread(&MetricsExporter::loop, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    _running = false;
+    uint64_t one = 1;
+    ssize_t ret = write(_wakeFd, &one, sizeof(one));
+    (void)ret;
+    if (_thread.joinable()) _thread.join();
+    if (_listenFd >= 0) {
+        close(_listenFd);
+        unlink(_socketPath.c_str());
+    }
+    close(_wakeFd);
+}
+
+void MetricsExporter::loop() {
+    auto nextWrite = std::chrono::steady_clock::now();
+    while (_running) {
+        auto now = std::chrono::steady_clock::now();
+        if (!_textFile.empty() && now >= nextWrite) {
+            writeFile();
+            nextWrite = now + _interval;
+        }
+
+        pollfd fds[2] = {{_wakeFd, POLLIN, 0}, {_listenFd, POLLIN, 0}};
+        int timeout = -1;
+        if (!_textFile.empty()) {
+            timeout = (int)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(nextWrite - now).count());
+        }
+        if (poll(fds, _listenFd >= 0 ? 2 : 1, timeout) > 0 && (fds[1].revents & POLLIN)) {
+            serveClient();
+        }
+    }
+    // Leave the final numbers behind
+    if (!_textFile.empty()) writeFile();
+}
+
+void MetricsExporter::writeFile() {
+    // Write then rename, so a collector never reads a half-written file
+    std::string tmp = _textFile + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f) return;
+    std::string text = renderMetrics();
+    fwrite(text.data(), 1, text.size(), f);
+    fclose(f);
+    rename(tmp.c_str(), _textFile.c_str());
+}
+
+void MetricsExporter::serveClient() {
+    int fd = accept4(_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return;
+    std::string text = renderMetrics();
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+    }
+    close(fd);
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MOTION_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MOTION_SSE2
+#endif
+
+#include "MotionGate.h"
+
+// A uint16 column sum holds 257 rows of 255, so cells stay well inside that
+static const int kMaxCell = 64;
+
+// sums[i] += row[i], widening bytes to uint16
+static void accumulateRow(const uint8_t* row, uint16_t* sums, int n) {
+    int i = 0;
+#if defined(MOTION_NEON)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(row + i);
+        vst1q_u16(sums + i, vaddw_u8(vld1q_u16(sums + i), vget_low_u8(v)));
+        vst1q_u16(sums + i + 8, vaddw_u8(vld1q_u16(sums + i + 8), vget_high_u8(v)));
+    }
+#elif defined(MOTION_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i lo = _mm_loadu_si128((const __m128i*)(sums + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(sums + i + 8));
+        _mm_storeu_si128((__m128i*)(sums + i), _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128((__m128i*)(sums + i + 8), _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero)));
+    }
+#endif
+    for (; i < n; i++) sums[i] += row[i];
+}
+
+MotionGate::MotionGate(MotionGateConfig config) : _config(config) {
+    _config.cell = std::min(kMaxCell, std::max(1, _config.cell));
+}
+
+void MotionGate::downscale(const cv::Mat& frame) {
+    if (frame.depth() != CV_8U || (frame.channels() != 1 && frame.channels() != 3)) {
+        throw std::runtime_error("MotionGate::downscale - Expected an 8-bit grey or BGR frame");
+    }
+    int cell = _config.cell;
+    int cellsX = frame.cols / cell;
+    int cellsY = frame.rows / cell;
+    if (cellsX != _cellsX || cellsY != _cellsY || frame.channels() != _channels) {
+        // New geometry; the old background means nothing now
+        _cellsX = cellsX;
+        _cellsY = cellsY;
+        _channels = frame.channels();
+        _columnSums.resize(_cellsX * cell * _channels);
+        _luma.resize(_cellsX * _cellsY);
+        _background.resize(_cellsX * _cellsY);
+        _primed = false;
+    }
+
+    // Remainder pixels past the last whole cell are left out
+    int rowBytes = _cellsX * cell * _channels;
+    float scale = 1.f / (cell * cell);
+    for (int cy = 0; cy < _cellsY; cy++) {
+        std::fill(_columnSums.begin(), _columnSums.end(), 0);
+        for (int y = 0; y < cell; y++) accumulateRow(frame.ptr<uint8_t>(cy * cell + y), _columnSums.data(), rowBytes);
+
+        float* out = &_luma[cy * _cellsX];
+        const uint16_t* sums = _columnSums.data();
+        if (_channels == 1) {
+            for (int cx = 0; cx < _cellsX; cx++, sums += cell) {
+                uint32_t total = 0;
+                for (int x = 0; x < cell; x++) total += sums[x];
+                out[cx] = total * scale;
+            }
+        } else {
+            for (int cx = 0; cx < _cellsX; cx++, sums += 3 * cell) {
+                uint32_t b = 0, g = 0, r = 0;
+                for (int x = 0; x < cell; x++) {
+                    b += sums[3 * x];
+                    g += sums[3 * x + 1];
+                    r += sums[3 * x + 2];
+                }
+                // BT.601 luma, and a sum of lumas is the luma of the sums
+                out[cx] = (29 * b + 150 * g + 77 * r) * (scale / 256);
+            }
+        }
+    }
+}
+
+bool MotionGate::changed(const cv::Mat& frame) {
+    downscale(frame);
+    size_t cells = _luma.size();
+    if (!_primed || cells == 0) {
+        std::copy(_luma.begin(), _luma.end(), _background.begin());
+        _primed = true;
+        _changedShare = 1;
+        return true;
+    }
+
+    size_t moved = 0;
+    float threshold = _config.threshold;
+    float rate = _config.adaptRate;
+    for (size_t i = 0; i < cells; i++) {
+        float diff = _luma[i] - _background[i];
+        moved += std::fabs(diff) > threshold;
+        _background[i] += diff * rate;
+    }
+    _changedShare = (float)moved / cells;
+
+    return _changedShare >= _config.sensitivity;
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "NameVault.h"
+
+static const char kMagic[8] = {'N', 'V', 'A', 'U', 'L', 'T', '\0', '\0'};
+static const size_t kPage = 4096;
+
+static size_t alignUp(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+// offset + count * width into end, false if any of it overflows
+static bool sectionEnd(uint64_t offset, uint64_t count, uint64_t width, uint64_t& end) {
+    uint64_t bytes;
+    return !__builtin_mul_overflow(count, width, &bytes) && !__builtin_add_overflow(offset, bytes, &end);
+}
+
+static uint32_t headerChecksum(const VaultHeader& header) {
+    const uint8_t* bytes = (const uint8_t*)&header;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(VaultHeader, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+NameVault::NameVault(std::string path, bool writable) {
+    _path = path;
+    _writable = writable;
+    map();
+}
+
+void NameVault::map() {
+
+    const std::string& path = _path;
+    _fd = open(path.c_str(), (_writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (_fd < 0) {
+        throw std::runtime_error("NameVault::NameVault - Could not open " + path);
+    }
+    struct stat st;
+    if (fstat(_fd, &st) < 0 || (size_t)st.st_size < sizeof(VaultHeader)) {
+        unmap();
+        throw std::runtime_error("NameVault::NameVault - " + path + " is too small to be a vault");
+    }
+    _length = st.st_size;
+    void* base = mmap(nullptr, _length, PROT_READ | (_writable ? PROT_WRITE : 0), MAP_SHARED, _fd, 0);
+    if (base == MAP_FAILED) {
+        unmap();
+        throw std::runtime_error("NameVault::NameVault - Could not map " + path);
+    }
+    _base = (uint8_t*)base;
+    _header = (const VaultHeader*)_base;
+
+    // Everything is checked against the header and the file size, never by walking the rows'
+    // embeddings. The checksum is no defence against a header someone rewrote, so the sizes are checked
+    // for overflow before anything is computed from them
+    const VaultHeader& h = *_header;
+    size_t elemBytes = h.format == (uint32_t)VaultFormat::Int8 ? 1 : 2;
+    uint64_t namesEnd = 0, scalesEnd = 0, embeddingsEnd = 0;
+    bool sized = sectionEnd(h.namesOffset, h.capacity, h.nameWidth, namesEnd)
+              && sectionEnd(h.scalesOffset, h.capacity, sizeof(float), scalesEnd)
+              && sectionEnd(h.embeddingsOffset, h.capacity, h.rowBytes, embeddingsEnd);
+    const char* problem = nullptr;
+    if (memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) problem = "bad magic";
+    else if (h.version != kVersion) problem = "unsupported version";
+    else if (h.checksum != headerChecksum(h)) problem = "header checksum mismatch";
+    else if (h.format > (uint32_t)VaultFormat::Int8) problem = "unknown format";
+    else if (h.dim != kEmbeddingSize) problem = "embedding size doesn't match the recognizer";
+    else if (h.nameWidth != kNameWidth) problem = "unsupported name width";
+    else if (h.rowBytes < h.dim * elemBytes || h.rowBytes % 64 != 0) problem = "bad row size";
+    else if (h.count > h.capacity) problem = "count beyond capacity";
+    else if (h.fileSize != _length) problem = "file size doesn't match the header";
+    else if (!sized || h.namesOffset < sizeof(VaultHeader)
+             || namesEnd > h.scalesOffset
+             || scalesEnd > h.embeddingsOffset
+             || h.embeddingsOffset % 64 != 0
+             || embeddingsEnd > h.fileSize) problem = "sections overlap or overrun the file";
+    if (problem) {
+        std::string message = "NameVault::NameVault - " + path + ": " + problem;
+        unmap();
+        throw std::runtime_error(message);
+    }
+    _count = h.count;
+
+    // Matching reads every row front to back
+    madvise(_base, _length, MADV_SEQUENTIAL);
+}
+
+NameVault::~NameVault() {
+    unmap();
+}
+
+void NameVault::unmap() {
+    if (_base) munmap(_base, _length);
+    if (_fd >= 0) close(_fd);
+    _base = nullptr;
+    _header = nullptr;
+    _fd = -1;
+}
+
+void NameVault::lock() {
+    while (true) {
+        flock(_fd, LOCK_EX);
+        struct stat ours, current;
+        if (fstat(_fd, &ours) == 0 && stat(_path.c_str(), &current) == 0
+            && ours.st_ino == current.st_ino && ours.st_dev == current.st_dev) return;
+        // Another enroller grew the vault and renamed the copy over this file while we waited.
+        // Rows appended here would be lost with the old inode, so follow it to the new file
+        unmap();
+        map();
+    }
+}
+
+void NameVault::create(std::string path, VaultFormat format, size_t capacity, const NameVault* from) {
+
+    // The live count rather than the one from when from was opened; the caller holds its lock
+    size_t count = from ? from->_header->count : 0;
+    capacity = std::max(capacity, count);
+
+    VaultHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.format = (uint32_t)format;
+    h.dim = kEmbeddingSize;
+    h.nameWidth = kNameWidth;
+    h.rowBytes = alignUp(kEmbeddingSize * (format == VaultFormat::Int8 ? 1 : 2), 64);
+    h.capacity = capacity;
+    h.count = count;
+    h.namesOffset = kPage;
+    h.scalesOffset = alignUp(h.namesOffset + capacity * h.nameWidth, kPage);
+    h.embeddingsOffset = alignUp(h.scalesOffset + capacity * sizeof(float), kPage);
+    h.fileSize = alignUp(h.embeddingsOffset + capacity * h.rowBytes, kPage);
+    h.checksum = headerChecksum(h);
+
+    // Built beside the vault and renamed over it, so readers only ever see a complete file
+    std::string tmp = path + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("NameVault::create - Could not create " + tmp);
+    }
+    bool ok = ftruncate(fd, h.fileSize) == 0 && pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+    if (ok && from && count) {
+        if (from->format() != format) {
+            close(fd);
+            unlink(tmp.c_str());
+            throw std::runtime_error("NameVault::create - Can't change the format of an existing vault");
+        }
+        ok = pwrite(fd, from->_base + from->_header->namesOffset, count * h.nameWidth, h.namesOffset) == (ssize_t)(count * h.nameWidth)
+          && pwrite(fd, from->scales(), count * sizeof(float), h.scalesOffset) == (ssize_t)(count * sizeof(float))
+          && pwrite(fd, from->row(0), count * h.rowBytes, h.embeddingsOffset) == (ssize_t)(count * h.rowBytes);
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw std::runtime_error("NameVault::create - Could not write " + path);
+    }
+}
+
+float NameVault::dot(size_t i, const float* query) const {
+    float sum = 0;
+    if (format() == VaultFormat::Int8) {
+        const int8_t* r = (const int8_t*)row(i);
+        for (int k = 0; k < kEmbeddingSize; k++) sum += r[k] * query[k];
+        return sum * scales()[i];
+    }
+    const uint16_t* r = (const uint16_t*)row(i);
+    for (int k = 0; k < kEmbeddingSize; k++) sum += halfToFloat(r[k]) * query[k];
+    return sum;
+}
+
+void NameVault::decode(size_t i, float* embedding) const {
+    if (format() == VaultFormat::Int8) {
+        const int8_t* r = (const int8_t*)row(i);
+        for (int k = 0; k < kEmbeddingSize; k++) embedding[k] = r[k] * scales()[i];
+        return;
+    }
+    const uint16_t* r = (const uint16_t*)row(i);
+    for (int k = 0; k < kEmbeddingSize; k++) embedding[k] = halfToFloat(r[k]);
+}
+
+size_t NameVault::append(const std::string& name, const float* embedding, bool grow) {
+    return append(&name, embedding, 1, grow);
+}
+
+size_t NameVault::append(const std::string* names, const float* embeddings, size_t n, bool grow) {
+    if (!_writable) {
+        throw std::runtime_error("NameVault::append - Vault was opened read-only");
+    }
+    for (size_t j = 0; j < n; j++) {
+        if (names[j].empty() || names[j].size() >= kNameWidth) {
+            throw std::runtime_error("NameVault::append - Names must be 1 to " + std::to_string(kNameWidth - 1) + " characters");
+        }
+    }
+
+    // Enrollments from several processes take turns, and the count is only read under the lock
+    lock();
+    VaultHeader* h = (VaultHeader*)_base;
+    size_t first = h->count;
+    while (first + n > h->capacity) {
+        if (!grow) {
+            flock(_fd, LOCK_UN);
+            throw std::runtime_error("NameVault::append - Vault is full");
+        }
+        // Copied and renamed over while the lock is held, so no other enroller's rows are
+        // left behind; they follow to the new file when they next take the lock
+        try {
+            create(_path, format(), std::max<size_t>(h->capacity * 2, first + n), this);
+        } catch (std::runtime_error&) {
+            flock(_fd, LOCK_UN);
+            throw;
+        }
+        unmap();
+        map();
+        lock();
+        h = (VaultHeader*)_base;
+        first = h->count;
+    }
+    for (size_t j = 0; j < n; j++) {
+        writeRow(first + j, names[j], embeddings + j * kEmbeddingSize);
+    }
+
+    // The rows have to be on disk before the count that makes them visible
+    msync(_base, _length, MS_SYNC);
+    h->count = first + n;
+    h->checksum = headerChecksum(*h);
+    msync(_base, kPage, MS_SYNC);
+    flock(_fd, LOCK_UN);
+
+    _count = first + n;
+    return first;
+}
+
+void NameVault::writeRow(size_t i, const std::string& name, const float* embedding) {
+    const VaultHeader* h = _header;
+    uint8_t* nameSlot = _base + h->namesOffset + i * h->nameWidth;
+    memset(nameSlot, 0, h->nameWidth);
+    memcpy(nameSlot, name.data(), name.size());
+
+    // Normalised first, so every row's dot product is a cosine similarity
+    float norm = 0;
+    for (int k = 0; k < kEmbeddingSize; k++) norm += embedding[k] * embedding[k];
+    norm = norm > 0 ? 1 / std::sqrt(norm) : 0;
+
+    uint8_t* r = _base + h->embeddingsOffset + i * h->rowBytes;
+    float* scale = (float*)(_base + h->scalesOffset) + i;
+    if (format() == VaultFormat::Int8) {
+        // Symmetric per-row scale
+        float maxAbs = 0;
+        for (int k = 0; k < kEmbeddingSize; k++) maxAbs = std::max(maxAbs, std::fabs(embedding[k] * norm));
+        *scale = maxAbs > 0 ? maxAbs / 127 : 1;
+        for (int k = 0; k < kEmbeddingSize; k++) {
+            ((int8_t*)r)[k] = (int8_t)std::lround(embedding[k] * norm / *scale);
+        }
+    } else {
+        *scale = 1;
+        for (int k = 0; k < kEmbeddingSize; k++) ((uint16_t*)r)[k] = floatToHalf(embedding[k] * norm);
+    }
+}
@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+
+#include "Metrics.h"
+#include "Pipeline.h"
+
+static Histogram captureSeconds("namevault_capture_seconds", "Waiting for and acquiring a frame from the source");
+static Counter framesCaptured("namevault_frames_captured_total", "Frames taken from the source");
+static Counter captureDroppedTotal("namevault_frames_dropped_total{stage=\"capture\"}", "Frames dropped because the next stage was full");
+static Counter resultDroppedTotal("namevault_frames_dropped_total{stage=\"result\"}", "Frames dropped because the next stage was full");
+static Counter staleDroppedTotal("namevault_frames_dropped_total{stage=\"stale\"}", "Frames dropped because the next stage was full");
+static Gauge capturedDepth("namevault_queue_depth{queue=\"captured\"}", "Frames waiting in a pipeline queue");
+static Counter detectorRuns("namevault_detector_runs_total", "Frames the detector ran on");
+static Counter framesTracked("namevault_frames_tracked_total", "Frames whose boxes came from the tracker alone");
+static Counter framesGated("namevault_frames_gated_total", "Frames the motion gate kept from the detector");
+static Gauge resultsDepth("namevault_queue_depth{queue=\"results\"}", "Frames waiting in a pipeline queue");
+
+// Labelled by source index. Made as sources are added rather than as statics, since there's no
+// limit on how many there are, but kept for the process like the statics are
+static Gauge* captureFrameRate(int source) {
+    static std::mutex mutex;
+    static std::deque<Gauge> gauges;
+    std::lock_guard<std::mutex> lock(mutex);
+    while ((int)gauges.size() <= source) {
+        std::string name = "namevault_capture_frame_rate{source=\"" + std::to_string(gauges.size()) + "\"}";
+        gauges.emplace_back(name.c_str(), "Frame rate the source was last asked to capture at");
+    }
+    return &gauges[source];
+}
+
+Pipeline::Pipeline(VideoSource& source, Detector& detector, PipelineConfig config)
+    : Pipeline(std::vector<VideoSource*>{&source}, detector, config) {}
+
+Pipeline::Pipeline(VideoSource& source, DetectorPool& pool, PipelineConfig config)
+    : Pipeline(std::vector<VideoSource*>{&source}, pool, config) {}
+
+Pipeline::Pipeline(const std::vector<VideoSource*>& sources, Detector& detector, PipelineConfig config)
+    : _detector(&detector), _config(config), _results(config.resultDepth) {
+    addStreams(sources);
+}
+
+Pipeline::Pipeline(const std::vector<VideoSource*>& sources, DetectorPool& pool, PipelineConfig config)
+    : _pool(&pool), _config(config), _results(config.resultDepth) {
+    addStreams(sources);
+}
+
+void Pipeline::addStreams(const std::vector<VideoSource*>& sources) {
+    if (sources.empty()) {
+        throw std::runtime_error("Pipeline::Pipeline - Needs at least one source");
+    }
+    for (VideoSource* source : sources) {
+        auto stream = std::make_unique<Stream>(*source, _config.captureDepth);
+        stream->id = _streams.size();
+        stream->frameRate = captureFrameRate(stream->id);
+        if (_config.track) {
+            // Track ids stay unique across sources, since the recognizer caches names by them
+            TrackerConfig tracker = _config.tracker;
+            tracker.firstId = stream->id << 20;
+            stream->tracker = std::make_unique<Tracker>(tracker);
+        }
+        if (_config.motionGate.enabled) stream->gate = std::make_unique<MotionGate>(_config.motionGate);
+        stream->interval = _config.adaptiveCadence ? 1 : std::max(1, _config.detectEvery);
+        _streams.push_back(std::move(stream));
+    }
+}
+
+Pipeline::~Pipeline() {
+    stop();
+}
+
+void Pipeline::start() {
+    if (_running.exchange(true)) return;
+    for (auto& stream : _streams) {
+        if (_config.latestFrame) {
+            stream->source.setLatestOnly(true);
+            stream->nominalRate = stream->source.frameRate();
+            stream->frameRate->set(stream->nominalRate);
+        }
+        stream->thread = std::thread(&Pipeline::captureLoop, this, std::ref(*stream));
+    }
+    if (_pool) {
+        _inferenceThread = std::thread(&Pipeline::dispatchLoop, this);
+        _collectThread = std::thread(&Pipeline::collectLoop, this);
+    } else {
+        _inferenceThread = std::thread(&Pipeline::inferenceLoop, this);
+    }
+}
+
+void Pipeline::stop() {
+    _running.store(false);
+    for (auto& stream : _streams) closeCaptured(*stream);
+    _results.close();
+    if (_pool) _pool->close();
+    if (_inferenceThread.joinable()) _inferenceThread.join();
+    if (_collectThread.joinable()) _collectThread.join();
+    // Release anything still queued: capture may be waiting on a camera buffer one of these holds
+    FrameResult item;
+    if (_pool) {
+        while (_pool->next(item)) {}
+    }
+    for (auto& stream : _streams) {
+        while (stream->queue.tryPop(item)) {}
+        while (stream->latest.tryTake(item)) {}
+    }
+    while (_results.tryPop(item)) {}
+    item = FrameResult();
+    for (auto& stream : _streams) {
+        if (stream->thread.joinable()) stream->thread.join();
+    }
+}
+
+bool Pipeline::next(FrameResult& result) {
+    bool ok = _results.pop(result);
+    resultsDepth.set(_results.size());
+    return ok;
+}
+
+uint64_t Pipeline::captureDropped() const {
+    uint64_t total = 0;
+    for (auto& stream : _streams) total += stream->captureDropped.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t Pipeline::staleDropped() const {
+    uint64_t total = 0;
+    for (auto& stream : _streams) total += stream->staleDropped.load(std::memory_order_relaxed) + stream->source.staleDropped();
+    return total;
+}
+
+uint64_t Pipeline::dropped(size_t source) const {
+    const Stream& stream = *_streams[source];
+    return stream.captureDropped.load(std::memory_order_relaxed) + stream.staleDropped.load(std::memory_order_relaxed) + stream.source.staleDropped();
+}
+
+void Pipeline::fail(const std::string& error) {
+    // The message is in place before failed() can say so; only the first failure is kept
+    std::lock_guard<std::mutex> lock(_errorMutex);
+    if (_failed.load(std::memory_order_relaxed)) return;
+    _error = error;
+    _failed.store(true, std::memory_order_release);
+}
+
+std::string Pipeline::error() const {
+    std::lock_guard<std::mutex> lock(_errorMutex);
+    return _error;
+}
+
+bool Pipeline::detectThisFrame(Stream& stream, const cv::Mat& frame) {
+    bool due = !stream.tracker || stream.sinceDetect + 1 >= stream.interval.load(std::memory_order_relaxed);
+    // The gate sees every frame to keep its background current
+    bool still = stream.gate && !stream.gate->changed(frame);
+    if (due && (!still || stream.sinceDetect + 1 >= _config.motionGate.refreshEvery)) {
+        stream.sinceDetect = 0;
+        return true;
+    }
+    if (due) framesGated.add();
+    stream.sinceDetect++;
+    return false;
+}
+
+void Pipeline::track(FrameResult& item) {
+    Stream& stream = *_streams[item.source];
+    if (!stream.tracker) return;
+    if (!item.detected) {
+        stream.tracker->predict(item.detections);
+        framesTracked.add();
+        if (_recognizer) _recognizer->annotate(item.detections);
+        return;
+    }
+    stream.tracker->update(item.detections);
+    if (_config.adaptiveCadence) {
+        int interval = stream.tracker->stable() ? std::min(stream.interval.load() * 2, std::max(1, _config.detectEvery)) : 1;
+        stream.interval.store(interval, std::memory_order_relaxed);
+    }
+}
+
+void Pipeline::recognize(FrameResult& item) {
+    // Only crops need colour, so a YUV frame is converted when there are faces to crop
+    if (item.detections.empty()) {
+        _recognizer->annotate(item.detections);
+        return;
+    }
+    _recognizer->recognize(item.frame.bgr(_colour), item.detections);
+    // The tracker took its copies before there were names; the frames it fills in need them
+    Stream& stream = *_streams[item.source];
+    if (stream.tracker) stream.tracker->annotate(item.detections);
+}
+
+void Pipeline::carryOver(FrameResult& item) {
+    Stream& stream = *_streams[item.source];
+    // The tracker already fills in frames the detector skipped
+    if (stream.tracker || !stream.gate) return;
+    if (item.detected) stream.lastDetections = item.detections;
+    else item.detections = stream.lastDetections;
+}
+
+bool Pipeline::handOff(Stream& stream, FrameResult&& item) {
+    if (!_config.latestFrame) {
+        if (stream.queue.push(std::move(item), _config.captureDrop)) return true;
+        if (stream.queue.closed()) return false;
+        stream.captureDropped.fetch_add(1, std::memory_order_relaxed);
+        captureDroppedTotal.add();
+        return true;
+    }
+    FrameResult stale;
+    bool displaced;
+    if (!stream.latest.put(std::move(item), stale, displaced)) return false;
+    // The displaced frame goes back to the source here, on the capture thread
+    if (displaced) {
+        stream.staleDropped.fetch_add(1, std::memory_order_relaxed);
+        staleDroppedTotal.add();
+    }
+    return true;
+}
+
+bool Pipeline::takeFrom(Stream& stream, FrameResult& item) {
+    if (!_config.latestFrame) return stream.queue.tryPop(item);
+    if (!stream.latest.tryTake(item)) return false;
+    stream.taken.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool Pipeline::nextCaptured(FrameResult& item, std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(_readyMutex);
+    while (true) {
+        // Round robin from the source after the last one served
+        bool open = false;
+        for (size_t n = 0; n < _streams.size(); n++) {
+            size_t i = (_nextStream + n) % _streams.size();
+            Stream& stream = *_streams[i];
+            if (takeFrom(stream, item)) {
+                _nextStream = i + 1;
+                size_t waiting = 0;
+                for (auto& s : _streams) waiting += _config.latestFrame ? s->latest.full() : s->queue.size();
+                capturedDepth.set(waiting);
+                return true;
+            }
+            if (!(_config.latestFrame ? stream.latest.closed() : stream.queue.closed())) open = true;
+        }
+        if (!open) return false;
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+            _readyCond.wait(lock);
+        } else if (_readyCond.wait_until(lock, deadline) == std::cv_status::timeout) {
+            return false;
+        }
+    }
+}
+
+void Pipeline::closeCaptured(Stream& stream) {
+    stream.queue.close();
+    stream.latest.close();
+    std::lock_guard<std::mutex> lock(_readyMutex);
+    _readyCond.notify_all();
+}
+
+void Pipeline::adaptFrameRate(Stream& stream) {
+    auto now = std::chrono::steady_clock::now();
+    if (stream.windowStart == std::chrono::steady_clock::time_point()) {
+        stream.windowStart = now;
+        return;
+    }
+    double seconds = std::chrono::duration<double>(now - stream.windowStart).count();
+    if (seconds < 1) return;
+
+    uint64_t taken = stream.taken.load(std::memory_order_relaxed);
+    uint64_t dropped = stream.staleDropped.load(std::memory_order_relaxed) + stream.source.staleDropped();
+    uint64_t windowTaken = taken - stream.windowTaken;
+    uint64_t windowDropped = dropped - stream.windowDropped;
+    stream.windowStart = now;
+    stream.windowTaken = taken;
+    stream.windowDropped = dropped;
+
+    // A few stale frames are just jitter; a fifth of them for two windows running is overload
+    double rate = stream.source.frameRate();
+    double target = rate;
+    if (windowDropped * 5 > windowTaken + windowDropped) {
+        stream.calmWindows = 0;
+        if (++stream.busyWindows >= 2) {
+            stream.busyWindows = 0;
+            // What inference kept up with, plus some headroom so it still gets the newest frame
+            target = std::max(_config.minFrameRate, windowTaken / seconds * 1.2);
+            if (target > rate * 0.9) target = rate;
+        }
+    } else if (windowDropped == 0) {
+        stream.busyWindows = 0;
+        if (++stream.calmWindows >= 5 && rate < stream.nominalRate) {
+            stream.calmWindows = 0;
+            target = std::min(stream.nominalRate, rate * 1.25);
+        }
+    } else {
+        stream.busyWindows = 0;
+        stream.calmWindows = 0;
+    }
+
+    if (target != rate && stream.source.setFrameRate(target)) {
+        printf("Source %d capture frame rate %.1f -> %.1f fps\n", stream.id, rate, target);
+        stream.frameRate->set(target);
+    }
+}
+
+void Pipeline::captureLoop(Stream& stream) {
+    uint64_t index = 0;
+    while (_running.load()) {
+        FrameResult item;
+        try {
+            ScopedTimer timer(captureSeconds);
+            // Leased frames stay checked out of the source until every stage is done with them
+            item.frame = stream.source.acquireFrame();
+        } catch (std::runtime_error& e) {
+            fail(e.what());
+            break;
+        }
+        framesCaptured.add();
+        stream.captured.fetch_add(1, std::memory_order_relaxed);
+        item.index = index++;
+        item.source = stream.id;
+        item.captureTime = std::chrono::steady_clock::now();
+        if (!handOff(stream, std::move(item))) break;
+        {
+            std::lock_guard<std::mutex> lock(_readyMutex);
+        }
+        _readyCond.notify_one();
+        if (_config.latestFrame && _config.adaptiveFrameRate) adaptFrameRate(stream);
+    }
+    closeCaptured(stream);
+}
+
+bool Pipeline::nextGroup(size_t maxBatch) {
+    _group.clear();
+    FrameResult item;
+    if (!nextCaptured(item)) return false;
+    _group.push_back(std::move(item));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)(_config.batchWaitMs * 1000));
+    while (_group.size() < maxBatch && nextCaptured(item, deadline)) _group.push_back(std::move(item));
+    return true;
+}
+
+void Pipeline::inferenceLoop() {
+    size_t maxBatch = std::max(1, std::min(_config.maxBatch, _detector->maxBatch()));
+    _group.reserve(maxBatch);
+    _batchFrames.reserve(maxBatch);
+    _batchSlots.reserve(maxBatch);
+    _batchYuv.reserve(maxBatch);
+    _yuvSlots.reserve(maxBatch);
+    _batchDetections.resize(maxBatch);
+
+    bool running = true;
+    while (running && nextGroup(maxBatch)) {
+        try {
+            _batchFrames.clear();
+            _batchSlots.clear();
+            _batchYuv.clear();
+            _yuvSlots.clear();
+            for (size_t i = 0; i < _group.size(); i++) {
+                FrameResult& item = _group[i];
+                // The luma plane of a YUV frame is all the motion gate needs
+                item.detected = detectThisFrame(*_streams[item.source], item.frame.image());
+                if (!item.detected) continue;
+                if (item.frame.isYuv()) {
+                    _batchYuv.push_back(item.frame.yuv());
+                    _yuvSlots.push_back(i);
+                } else {
+                    _batchFrames.push_back(item.frame.image());
+                    _batchSlots.push_back(i);
+                }
+            }
+            if (!_batchFrames.empty()) {
+                _detector->detectBatch(_batchFrames.data(), _batchFrames.size(), _batchDetections.data());
+                for (size_t k = 0; k < _batchSlots.size(); k++) _group[_batchSlots[k]].detections = _batchDetections[k];
+                detectorRuns.add(_batchFrames.size());
+                // Don't hold on to the frames past the batch
+                _batchFrames.clear();
+            }
+            if (!_batchYuv.empty()) {
+                _detector->detectYuv(_batchYuv.data(), _batchYuv.size(), _batchDetections.data());
+                for (size_t k = 0; k < _yuvSlots.size(); k++) _group[_yuvSlots[k]].detections = _batchDetections[k];
+                detectorRuns.add(_batchYuv.size());
+                _batchYuv.clear();
+            }
+            for (FrameResult& item : _group) {
+                track(item);
+                // Tracked frames carry the names from the last frame the detector ran on
+                if (_recognizer && item.detected) recognize(item);
+                carryOver(item);
+            }
+        } catch (std::runtime_error& e) {
+            fail(e.what());
+            break;
+        }
+        for (FrameResult& item : _group) {
+            if (!_results.push(std::move(item), _config.resultDrop)) {
+                if (_results.closed()) {
+                    running = false;
+                    break;
+                }
+                _resultDropped.fetch_add(1, std::memory_order_relaxed);
+                resultDroppedTotal.add();
+            }
+            resultsDepth.set(_results.size());
+        }
+    }
+    _batchFrames.clear();
+    _group.clear();
+    // Unblock the capture threads if we bailed out early
+    for (auto& stream : _streams) closeCaptured(*stream);
+    _results.close();
+}
+
+void Pipeline::dispatchLoop() {
+    FrameResult item;
+    while (nextCaptured(item)) {
+        item.detected = detectThisFrame(*_streams[item.source], item.frame.image());
+        if (item.detected) {
+            detectorRuns.add();
+            if (!_pool->submit(std::move(item))) break;
+        } else {
+            if (!_pool->pass(std::move(item))) break;
+        }
+    }
+    for (auto& stream : _streams) closeCaptured(*stream);
+    _pool->close();
+}
+
+void Pipeline::collectLoop() {
+    FrameResult item;
+    while (_pool->next(item)) {
+        if (_pool->failed()) {
+            fail(_pool->error());
+            break;
+        }
+        // Tracking and recognition run here, after the reorder, so they see every frame in order
+        track(item);
+        if (_recognizer && item.detected) {
+            try {
+                recognize(item);
+            } catch (std::runtime_error& e) {
+                fail(e.what());
+                break;
+            }
+        }
+        carryOver(item);
+        if (!_results.push(std::move(item), _config.resultDrop)) {
+            if (_results.closed()) break;
+            _resultDropped.fetch_add(1, std::memory_order_relaxed);
+            resultDroppedTotal.add();
+        }
+        resultsDepth.set(_results.size());
+    }
+    // Unblock the dispatcher if we bailed out early
+    _pool->close();
+    _results.close();
+}
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PREPROCESS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PREPROCESS_SSE2
+#endif
+
+#include "Preprocess.h"
+
+// Filter weights are Q7, so a horizontally filtered sample is at most 255 * 128 and fits an
+// int16, and the vertical blend of two of them is Q14 and fits an int32
+static const int kWeightBits = 7;
+static const int kWeightOne = 1 << kWeightBits;
+
+static void buildTaps(int srcSize, int dstSize, int stride, std::vector<int>& offsets, std::vector<int16_t>& weights) {
+    offsets.resize(dstSize * 2);
+    weights.resize(dstSize);
+    double scale = (double)srcSize / dstSize;
+    for (int i = 0; i < dstSize; i++) {
+        // Pixel centres line up, same as cv::resize with INTER_LINEAR
+        double s = (i + 0.5) * scale - 0.5;
+        int s0 = (int)std::floor(s);
+        double frac = s - s0;
+        if (s0 < 0) {
+            s0 = 0;
+            frac = 0;
+        }
+        if (s0 >= srcSize - 1) {
+            s0 = srcSize - 1;
+            frac = 0;
+        }
+        offsets[2 * i] = s0 * stride;
+        offsets[2 * i + 1] = std::min(s0 + 1, srcSize - 1) * stride;
+        weights[i] = (int16_t)std::lround(frac * kWeightOne);
+    }
+}
+
+static void blendRows(const int16_t* top, const int16_t* bottom, int16_t w1, uint8_t* out, int n) {
+    int16_t w0 = kWeightOne - w1;
+    int i = 0;
+#if defined(PREPROCESS_NEON)
+    int16x4_t vw0 = vdup_n_s16(w0);
+    int16x4_t vw1 = vdup_n_s16(w1);
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t a = vld1q_s16(top + i);
+        int16x8_t b = vld1q_s16(bottom + i);
+        int32x4_t lo = vmlal_s16(vmull_s16(vget_low_s16(a), vw0), vget_low_s16(b), vw1);
+        int32x4_t hi = vmlal_s16(vmull_s16(vget_high_s16(a), vw0), vget_high_s16(b), vw1);
+        int16x8_t r = vcombine_s16(vrshrn_n_s32(lo, 2 * kWeightBits), vrshrn_n_s32(hi, 2 * kWeightBits));
+        vst1_u8(out + i, vqmovun_s16(r));
+    }
+#elif defined(PREPROCESS_SSE2)
+    // Interleaving top and bottom lets one madd do both taps
+    __m128i w = _mm_set1_epi32(((int)w1 << 16) | (uint16_t)w0);
+    __m128i round = _mm_set1_epi32(1 << (2 * kWeightBits - 1));
+    for (; i + 16 <= n; i += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(top + i));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(bottom + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(top + i + 8));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(bottom + i + 8));
+        __m128i r0 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a0, b0), w), round), 2 * kWeightBits);
+        __m128i r1 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a0, b0), w), round), 2 * kWeightBits);
+        __m128i r2 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a1, b1), w), round), 2 * kWeightBits);
+        __m128i r3 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a1, b1), w), round), 2 * kWeightBits);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(r0, r1), _mm_packs_epi32(r2, r3)));
+    }
+#endif
+    for (; i < n; i++) {
+        int v = (top[i] * w0 + bottom[i] * w1 + (1 << (2 * kWeightBits - 1))) >> (2 * kWeightBits);
+        out[i] = (uint8_t)std::min(std::max(v, 0), 255);
+    }
+}
+
+// Where a srcWidth x srcHeight image lands in the destination, stretched or letterboxed
+static Letterbox fit(int srcWidth, int srcHeight, int dstWidth, int dstHeight, bool letterbox, int& innerWidth, int& innerHeight) {
+    innerWidth = dstWidth;
+    innerHeight = dstHeight;
+    if (letterbox) {
+        double scale = std::min((double)dstWidth / srcWidth, (double)dstHeight / srcHeight);
+        innerWidth = std::min(dstWidth, std::max(1, (int)std::lround(srcWidth * scale)));
+        innerHeight = std::min(dstHeight, std::max(1, (int)std::lround(srcHeight * scale)));
+    }
+    Letterbox box;
+    box.scaleX = (float)innerWidth / srcWidth;
+    box.scaleY = (float)innerHeight / srcHeight;
+    box.padX = (dstWidth - innerWidth) / 2;
+    box.padY = (dstHeight - innerHeight) / 2;
+    return box;
+}
+
+// Zeroes the bands above and below the image
+static void clearBands(uint8_t* dst, const Letterbox& box, int dstWidth, int dstHeight, int innerHeight) {
+    size_t dstStride = (size_t)dstWidth * 3;
+    memset(dst, 0, box.padY * dstStride);
+    memset(dst + (box.padY + innerHeight) * dstStride, 0, (dstHeight - box.padY - innerHeight) * dstStride);
+}
+
+// And the bars either side of one row
+static void clearBars(uint8_t* row, const Letterbox& box, int dstWidth, int innerWidth) {
+    memset(row, 0, box.padX * 3);
+    memset(row + (box.padX + innerWidth) * 3, 0, (dstWidth - box.padX - innerWidth) * 3);
+}
+
+void TensorResizer::prepare(int srcWidth, int srcHeight, int dstWidth, int dstHeight, bool letterbox) {
+    _srcWidth = srcWidth;
+    _srcHeight = srcHeight;
+    _dstWidth = dstWidth;
+    _dstHeight = dstHeight;
+    _letterbox = letterbox;
+    _box = fit(srcWidth, srcHeight, dstWidth, dstHeight, letterbox, _innerWidth, _innerHeight);
+
+    buildTaps(srcWidth, _innerWidth, 3, _xOffsets, _xWeights);
+    buildTaps(srcHeight, _innerHeight, 1, _yRows, _yWeights);
+    _rows[0].resize(_innerWidth * 3);
+    _rows[1].resize(_innerWidth * 3);
+}
+
+void TensorResizer::horizontal(const uint8_t* srcRow, int16_t* out, bool swapRB) const {
+    // Swapping here costs nothing, it only changes which slot each channel lands in
+    int c0 = swapRB ? 2 : 0;
+    int c2 = swapRB ? 0 : 2;
+    for (int x = 0; x < _innerWidth; x++) {
+        const uint8_t* p0 = srcRow + _xOffsets[2 * x];
+        const uint8_t* p1 = srcRow + _xOffsets[2 * x + 1];
+        int w1 = _xWeights[x];
+        int w0 = kWeightOne - w1;
+        out[3 * x + c0] = (int16_t)(p0[0] * w0 + p1[0] * w1);
+        out[3 * x + 1] = (int16_t)(p0[1] * w0 + p1[1] * w1);
+        out[3 * x + c2] = (int16_t)(p0[2] * w0 + p1[2] * w1);
+    }
+}
+
+Letterbox TensorResizer::run(const cv::Mat& src, uint8_t* dst, int dstWidth, int dstHeight, bool swapRB, bool letterbox) {
+    if (src.type() != CV_8UC3) {
+        throw std::runtime_error("TensorResizer::run - Expected an 8-bit 3-channel image");
+    }
+    if (src.cols != _srcWidth || src.rows != _srcHeight || dstWidth != _dstWidth || dstHeight != _dstHeight || letterbox != _letterbox) {
+        prepare(src.cols, src.rows, dstWidth, dstHeight, letterbox);
+    }
+    // Cached rows belong to the previous frame
+    _rowIndex[0] = _rowIndex[1] = -1;
+
+    size_t dstStride = (size_t)dstWidth * 3;
+    if (_letterbox) clearBands(dst, _box, dstWidth, dstHeight, _innerHeight);
+
+    auto fetch = [&](int row, int keep) -> const int16_t* {
+        for (int i = 0; i < 2; i++) {
+            if (_rowIndex[i] == row) return _rows[i].data();
+        }
+        int slot = _rowIndex[0] == keep ? 1 : 0;
+        horizontal(src.ptr<uint8_t>(row), _rows[slot].data(), swapRB);
+        _rowIndex[slot] = row;
+        return _rows[slot].data();
+    };
+
+    for (int y = 0; y < _innerHeight; y++) {
+        int y0 = _yRows[2 * y];
+        int y1 = _yRows[2 * y + 1];
+        const int16_t* top = fetch(y0, y1);
+        const int16_t* bottom = fetch(y1, y0);
+
+        uint8_t* out = dst + (_box.padY + y) * dstStride;
+        if (_letterbox) clearBars(out, _box, dstWidth, _innerWidth);
+        blendRows(top, bottom, _yWeights[y], out + _box.padX * 3, _innerWidth * 3);
+    }
+    return _box;
+}
+
+// BT.601 video range to RGB in Q6: 1.164 (Y - 16) + 1.596 V, - 0.813 V - 0.391 U, + 2.018 U,
+// with U and V centred on 128. The luma term is 74.5 (Y - 16), so every product and the sums
+// fit an int16; sums that don't saturate and then clamp to 255 anyway
+static const int kCy = 74, kCvr = 102, kCvg = 52, kCug = 25, kCub = 129;
+
+static void yuvToRgbRow(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* out, int n, bool rgb) {
+    int i = 0;
+#if defined(PREPROCESS_NEON)
+    uint8x8_t y16 = vdup_n_u8(16), c128 = vdup_n_u8(128);
+    for (; i + 8 <= n; i += 8) {
+        // Widening subtracts wrap to the right signed values
+        int16x8_t ys = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(y + i), y16));
+        int16x8_t us = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(u + i), c128));
+        int16x8_t vs = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(v + i), c128));
+        int16x8_t luma = vaddq_s16(vmulq_n_s16(ys, kCy), vshrq_n_s16(ys, 1));
+        uint8x8x3_t px;
+        uint8x8_t r = vqrshrun_n_s16(vqaddq_s16(luma, vmulq_n_s16(vs, kCvr)), 6);
+        uint8x8_t g = vqrshrun_n_s16(vqsubq_s16(vqsubq_s16(luma, vmulq_n_s16(vs, kCvg)), vmulq_n_s16(us, kCug)), 6);
+        uint8x8_t b = vqrshrun_n_s16(vqaddq_s16(luma, vmulq_n_s16(us, kCub)), 6);
+        px.val[0] = rgb ? r : b;
+        px.val[1] = g;
+        px.val[2] = rgb ? b : r;
+        vst3_u8(out + 3 * i, px);
+    }
+#elif defined(PREPROCESS_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i y16 = _mm_set1_epi16(16), c128 = _mm_set1_epi16(128), round = _mm_set1_epi16(32);
+    __m128i cy = _mm_set1_epi16(kCy), cvr = _mm_set1_epi16(kCvr), cvg = _mm_set1_epi16(kCvg);
+    __m128i cug = _mm_set1_epi16(kCug), cub = _mm_set1_epi16(kCub);
+    alignas(16) uint8_t planes[3][16];
+    for (; i + 8 <= n; i += 8) {
+        __m128i ys = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + i)), zero), y16);
+        __m128i us = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + i)), zero), c128);
+        __m128i vs = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(v + i)), zero), c128);
+        __m128i luma = _mm_adds_epi16(_mm_add_epi16(_mm_mullo_epi16(ys, cy), _mm_srai_epi16(ys, 1)), round);
+        __m128i r = _mm_srai_epi16(_mm_adds_epi16(luma, _mm_mullo_epi16(vs, cvr)), 6);
+        __m128i g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(luma, _mm_mullo_epi16(vs, cvg)), _mm_mullo_epi16(us, cug)), 6);
+        __m128i b = _mm_srai_epi16(_mm_adds_epi16(luma, _mm_mullo_epi16(us, cub)), 6);
+        _mm_store_si128((__m128i*)planes[0], _mm_packus_epi16(rgb ? r : b, zero));
+        _mm_store_si128((__m128i*)planes[1], _mm_packus_epi16(g, zero));
+        _mm_store_si128((__m128i*)planes[2], _mm_packus_epi16(rgb ? b : r, zero));
+        // SSE2 has no three-way byte interleave, so the packed channels go out a pixel at a time
+        uint8_t* px = out + 3 * i;
+        for (int k = 0; k < 8; k++) {
+            px[3 * k] = planes[0][k];
+            px[3 * k + 1] = planes[1][k];
+            px[3 * k + 2] = planes[2][k];
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        int ys = y[i] - 16;
+        int us = u[i] - 128;
+        int vs = v[i] - 128;
+        int luma = ys * kCy + (ys >> 1) + 32;
+        int r = std::min(std::max((luma + vs * kCvr) >> 6, 0), 255);
+        int g = std::min(std::max((luma - vs * kCvg - us * kCug) >> 6, 0), 255);
+        int b = std::min(std::max((luma + us * kCub) >> 6, 0), 255);
+        out[3 * i] = rgb ? r : b;
+        out[3 * i + 1] = g;
+        out[3 * i + 2] = rgb ? b : r;
+    }
+}
+
+void YuvPlanes::toBgr(cv::Mat& dst) const {
+    if (width % 2 || height % 2) {
+        throw std::runtime_error("YuvPlanes::toBgr - Expected even dimensions");
+    }
+    // Planes laid out back to back with chroma rows half as long are exactly OpenCV's I420 layout
+    if (uvStride * 2 == yStride && u == y + (size_t)yStride * height && v == u + (size_t)uvStride * (height / 2)) {
+        cv::cvtColor(cv::Mat(height * 3 / 2, width, CV_8UC1, (void*)y, yStride), dst, cv::COLOR_YUV2BGR_I420);
+        return;
+    }
+    // Anything else is gathered into that layout first
+    cv::Mat packed(height * 3 / 2, width, CV_8UC1);
+    int chromaWidth = width / 2;
+    int chromaHeight = height / 2;
+    for (int r = 0; r < height; r++) memcpy(packed.ptr(r), y + (size_t)r * yStride, width);
+    uint8_t* chroma = packed.ptr(height);
+    for (int r = 0; r < chromaHeight; r++) memcpy(chroma + (size_t)r * chromaWidth, u + (size_t)r * uvStride, chromaWidth);
+    chroma += (size_t)chromaWidth * chromaHeight;
+    for (int r = 0; r < chromaHeight; r++) memcpy(chroma + (size_t)r * chromaWidth, v + (size_t)r * uvStride, chromaWidth);
+    cv::cvtColor(packed, dst, cv::COLOR_YUV2BGR_I420);
+}
+
+void YuvTensorResizer::prepare(int srcWidth, int srcHeight, int dstWidth, int dstHeight, bool letterbox) {
+    _srcWidth = srcWidth;
+    _srcHeight = srcHeight;
+    _dstWidth = dstWidth;
+    _dstHeight = dstHeight;
+    _letterbox = letterbox;
+    _box = fit(srcWidth, srcHeight, dstWidth, dstHeight, letterbox, _innerWidth, _innerHeight);
+
+    // Chroma takes the luma taps at half the position, the same samples cvtColor's 2x2
+    // replicated chroma would give a resize of the converted frame
+    buildTaps(srcWidth, _innerWidth, 1, _xOffsets, _xWeights);
+    buildTaps(srcHeight, _innerHeight, 1, _yRows, _yWeights);
+    _chromaXOffsets.resize(_xOffsets.size());
+    _chromaYRows.resize(_yRows.size());
+    for (size_t i = 0; i < _xOffsets.size(); i++) _chromaXOffsets[i] = _xOffsets[i] / 2;
+    for (size_t i = 0; i < _yRows.size(); i++) _chromaYRows[i] = _yRows[i] / 2;
+    for (PlaneRows* cache : {&_luma, &_u, &_v}) {
+        cache->rows[0].resize(_innerWidth);
+        cache->rows[1].resize(_innerWidth);
+    }
+    _lumaLine.resize(_innerWidth);
+    _uLine.resize(_innerWidth);
+    _vLine.resize(_innerWidth);
+}
+
+const int16_t* YuvTensorResizer::fetch(PlaneRows& cache, const uint8_t* plane, int stride, int row, int keep, bool chroma) {
+    for (int i = 0; i < 2; i++) {
+        if (cache.index[i] == row) return cache.rows[i].data();
+    }
+    int slot = cache.index[0] == keep ? 1 : 0;
+    const uint8_t* src = plane + (size_t)row * stride;
+    const int* offsets = chroma ? _chromaXOffsets.data() : _xOffsets.data();
+    const int16_t* weights = _xWeights.data();
+    int16_t* out = cache.rows[slot].data();
+    for (int x = 0; x < _innerWidth; x++) {
+        int w1 = weights[x];
+        out[x] = (int16_t)(src[offsets[2 * x]] * (kWeightOne - w1) + src[offsets[2 * x + 1]] * w1);
+    }
+    cache.index[slot] = row;
+    return out;
+}
+
+Letterbox YuvTensorResizer::run(const YuvPlanes& src, uint8_t* dst, int dstWidth, int dstHeight, bool swapRB, bool letterbox) {
+    if (src.empty() || src.width < 2 || src.height < 2) {
+        throw std::runtime_error("YuvTensorResizer::run - Expected YUV 4:2:0 planes of at least 2x2");
+    }
+    if (src.width != _srcWidth || src.height != _srcHeight || dstWidth != _dstWidth || dstHeight != _dstHeight || letterbox != _letterbox) {
+        prepare(src.width, src.height, dstWidth, dstHeight, letterbox);
+    }
+    for (PlaneRows* cache : {&_luma, &_u, &_v}) cache->index[0] = cache->index[1] = -1;
+
+    size_t dstStride = (size_t)dstWidth * 3;
+    if (_letterbox) clearBands(dst, _box, dstWidth, dstHeight, _innerHeight);
+
+    for (int y = 0; y < _innerHeight; y++) {
+        int y0 = _yRows[2 * y];
+        int y1 = _yRows[2 * y + 1];
+        blendRows(fetch(_luma, src.y, src.yStride, y0, y1, false), fetch(_luma, src.y, src.yStride, y1, y0, false), _yWeights[y],
+                  _lumaLine.data(), _innerWidth);
+        int c0 = _chromaYRows[2 * y];
+        int c1 = _chromaYRows[2 * y + 1];
+        blendRows(fetch(_u, src.u, src.uvStride, c0, c1, true), fetch(_u, src.u, src.uvStride, c1, c0, true), _yWeights[y],
+                  _uLine.data(), _innerWidth);
+        blendRows(fetch(_v, src.v, src.uvStride, c0, c1, true), fetch(_v, src.v, src.uvStride, c1, c0, true), _yWeights[y],
+                  _vLine.data(), _innerWidth);
+
+        uint8_t* out = dst + (_box.padY + y) * dstStride;
+        if (_letterbox) clearBars(out, _box, dstWidth, _innerWidth);
+        yuvToRgbRow(_lumaLine.data(), _uLine.data(), _vLine.data(), out + _box.padX * 3, _innerWidth, swapRB);
+    }
+    return _box;
+}
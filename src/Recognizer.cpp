@@ -0,0 +1,309 @@
+#include <cmath>
+#include <stdexcept>
+#include <stdio.h>
+
+#include "Metrics.h"
+#include "Recognizer.h"
+
+static Histogram recognizeSeconds("namevault_recognize_seconds", "Aligning, embedding and matching every face in a frame");
+static Counter facesEmbedded("namevault_faces_embedded_total", "Faces run through the recognition model");
+static Counter facesMatched("namevault_faces_matched_total", "Faces matched to a gallery identity");
+static Counter cacheHits("namevault_recognition_cache_hits_total", "Tracked faces named from the cache");
+static Counter cacheMisses("namevault_recognition_cache_misses_total", "Tracked faces the cache couldn't name confidently");
+static Gauge cacheHitRatio("namevault_recognition_cache_hit_ratio", "Share of tracked faces named from the cache over the last second");
+static Gauge recognitionsPerSecond("namevault_recognitions_per_second", "Faces run through the recognition model over the last second");
+
+// Where SFace expects the five landmarks in its 112x112 input
+static const float kReferenceLandmarks[5][2] = {
+    {38.2946f, 51.6963f}, {73.5318f, 51.5014f}, {56.0252f, 71.7366f}, {41.5493f, 92.3655f}, {70.7299f, 92.2041f}
+};
+
+Recognizer::Recognizer(std::string modelPath, float matchThresh, int maxBatch) {
+
+    _matchThresh = matchThresh;
+    _maxBatch = std::max(1, maxBatch);
+
+    try {
+        _net = cv::dnn::readNet(modelPath);
+    } catch (cv::Exception& e) {
+        throw std::runtime_error("Recognizer::Recognizer - Failed to load " + modelPath + ": " + e.what());
+    }
+    if (_net.empty()) {
+        throw std::runtime_error("Recognizer::Recognizer - Failed to load " + modelPath);
+    }
+    _net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    _net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    _faces.resize(kMaxDetections);
+    _pending.reserve(kMaxDetections);
+    _batch.reserve(_maxBatch);
+}
+
+bool Recognizer::isFace(const Detection& detection) const {
+    if (detection.hasLandmarks || _labels.empty()) return true;
+    if (!detection.label) return false;
+    for (const std::string& label : _labels) {
+        if (label == detection.label) return true;
+    }
+    return false;
+}
+
+void Recognizer::setCache(RecognitionCacheConfig config) {
+    _cacheConfig = config;
+    if (!_cacheConfig.enabled || !_cache.empty()) return;
+    // New tracks take over slots rather than adding map nodes, so the frame loop doesn't allocate
+    _cache.resize(kCacheSlots);
+    for (CacheEntry& entry : _cache) entry.bestCrop.create(kInputSize, kInputSize, CV_8UC3);
+}
+
+// Fibonacci hashing, taking the top bits: trackers on different sources differ in the high bits of their ids
+static size_t slotOf(int trackId) {
+    static_assert((Recognizer::kCacheSlots & (Recognizer::kCacheSlots - 1)) == 0, "kCacheSlots has to be a power of two");
+    return ((uint32_t)trackId * 2654435769u) >> (32 - __builtin_ctz(Recognizer::kCacheSlots));
+}
+
+Recognizer::CacheEntry& Recognizer::cacheSlot(int trackId) {
+    CacheEntry& entry = _cache[slotOf(trackId)];
+    if (entry.trackId != trackId) {
+        entry.trackId = trackId;
+        entry.recognizedAt = 0;
+        entry.hasResult = false;
+        entry.name = nullptr;
+        entry.matchScore = 0;
+        entry.shots = 0;
+        entry.bestQuality = -1;
+    }
+    return entry;
+}
+
+void Recognizer::warmUp() {
+    cv::Mat face(kInputSize, kInputSize, CV_8UC3, cv::Scalar(128, 128, 128));
+    cv::dnn::blobFromImage(face, _blob, 1.0, cv::Size(), cv::Scalar(), true, false);
+    _net.setInput(_blob);
+    _output = _net.forward();
+}
+
+void Recognizer::setVault(const NameVault* vault, MatcherConfig config) {
+    _vault = vault;
+    _matcher.reset();
+    if (_vault) _matcher = std::make_unique<Matcher>(*_vault, config);
+}
+
+bool Recognizer::fresh(const CacheEntry& entry) const {
+    return entry.hasResult && entry.matchScore >= _cacheConfig.confidentScore
+        && _frame - entry.recognizedAt <= (uint64_t)_cacheConfig.maxAge;
+}
+
+void Recognizer::applyCached(const CacheEntry& entry, Detection& detection) const {
+    if (!entry.hasResult) return;
+    detection.name = entry.name;
+    detection.matchScore = entry.matchScore;
+    memcpy(detection.embedding, entry.embedding, sizeof(detection.embedding));
+    detection.hasEmbedding = true;
+}
+
+cv::Mat& Recognizer::nextFace(size_t detection) {
+    if (_faces.size() <= _pending.size()) _faces.resize(_pending.size() + 1);
+    _pending.push_back(detection);
+    return _faces[_pending.size() - 1];
+}
+
+float Recognizer::faceQuality(const cv::Mat& face, const Detection& detection) {
+    // Blur and motion smear flatten the Laplacian
+    cv::cvtColor(face, _gray, cv::COLOR_BGR2GRAY);
+    cv::Laplacian(_gray, _laplacian, CV_16S);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(_laplacian, mean, stddev);
+    double variance = stddev[0] * stddev[0];
+    float sharpness = variance / (variance + 200);
+
+    // Faces smaller than the model input have been upscaled and lost detail
+    float size = std::min(1.f, (detection.y2 - detection.y1) / kInputSize);
+
+    // The nose sits between the eyes when the face looks at the camera
+    float frontal = 1;
+    if (detection.hasLandmarks) {
+        float eyeMid = (detection.landmarks[0][0] + detection.landmarks[1][0]) / 2;
+        float eyeDist = std::fabs(detection.landmarks[1][0] - detection.landmarks[0][0]);
+        frontal = eyeDist > 0 ? std::max(0.f, 1 - std::fabs(detection.landmarks[2][0] - eyeMid) / (eyeDist / 2)) : 0;
+    }
+    return sharpness * size * frontal;
+}
+
+void Recognizer::annotate(Detections& detections) {
+    if (_cacheConfig.enabled) {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        for (Detection& d : detections) {
+            if (d.trackId < 0 || !isFace(d)) continue;
+            const CacheEntry& entry = _cache[slotOf(d.trackId)];
+            if (entry.trackId == d.trackId && entry.hasResult) {
+                applyCached(entry, d);
+                hits++;
+            } else {
+                misses++;
+            }
+        }
+        cacheHits.add(hits);
+        cacheMisses.add(misses);
+        _cacheHits += hits;
+        _cacheLookups += hits + misses;
+    }
+    report();
+}
+
+void Recognizer::report() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - _windowStart < std::chrono::seconds(1)) return;
+    recognitionsPerSecond.set(_embedded / std::chrono::duration<double>(now - _windowStart).count());
+    // 0 for a second without tracked faces
+    if (_cacheConfig.enabled) cacheHitRatio.set(_cacheLookups ? (double)_cacheHits / _cacheLookups : 0);
+    _embedded = 0;
+    _cacheHits = 0;
+    _cacheLookups = 0;
+    _windowStart = now;
+}
+
+void Recognizer::recognize(const cv::Mat& frame, Detections& detections) {
+    if (detections.empty()) {
+        report();
+        return;
+    }
+    ScopedTimer timer(recognizeSeconds);
+    _frame++;
+    _pending.clear();
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    for (size_t i = 0; i < detections.size(); i++) {
+        Detection& d = detections[i];
+        if (!isFace(d)) continue;
+        if (!_cacheConfig.enabled || d.trackId < 0) {
+            alignCrop(frame, d, nextFace(i));
+            continue;
+        }
+
+        CacheEntry& entry = cacheSlot(d.trackId);
+        if (fresh(entry)) {
+            applyCached(entry, d);
+            hits++;
+            continue;
+        }
+        misses++;
+
+        // Keep the best crop of the window and embed that one when the window closes
+        alignCrop(frame, d, _crop);
+        float quality = faceQuality(_crop, d);
+        if (quality > entry.bestQuality) {
+            _crop.copyTo(entry.bestCrop);
+            entry.bestQuality = quality;
+        }
+        if (++entry.shots >= _cacheConfig.shotWindow) {
+            entry.bestCrop.copyTo(nextFace(i));
+        } else {
+            // The old, unsure name is still better than nothing until then
+            applyCached(entry, d);
+        }
+    }
+
+    size_t first = 0;
+    while (first < _pending.size()) {
+        size_t count = std::min(_pending.size() - first, (size_t)_maxBatch);
+        try {
+            embedBatch(first, count, detections);
+        } catch (cv::Exception& e) {
+            if (count == 1) {
+                throw std::runtime_error(std::string("Recognizer::recognize - ") + e.what());
+            }
+            // Some exports pin the batch dimension to 1; fall back to one face per forward pass
+            printf("Recognizer model rejected a batch of %zu, running faces one at a time\n", count);
+            _maxBatch = 1;
+            continue;
+        }
+        first += count;
+    }
+
+    for (size_t i : _pending) {
+        Detection& d = detections[i];
+        match(d);
+        if (!_cacheConfig.enabled || d.trackId < 0) continue;
+        CacheEntry& entry = cacheSlot(d.trackId);
+        entry.hasResult = true;
+        entry.name = d.name;
+        entry.matchScore = d.matchScore;
+        memcpy(entry.embedding, d.embedding, sizeof(entry.embedding));
+        entry.recognizedAt = _frame;
+        entry.shots = 0;
+        entry.bestQuality = -1;
+    }
+    facesEmbedded.add(_pending.size());
+
+    if (_cacheConfig.enabled) {
+        cacheHits.add(hits);
+        cacheMisses.add(misses);
+        _cacheHits += hits;
+        _cacheLookups += hits + misses;
+    }
+
+    _embedded += _pending.size();
+    report();
+}
+
+void Recognizer::alignCrop(const cv::Mat& frame, const Detection& detection, cv::Mat& face) {
+    cv::Mat& transform = _transform;
+    transform.release();
+    if (detection.hasLandmarks) {
+        // Headers over the arrays themselves, no copies
+        cv::Mat src(5, 1, CV_32FC2, (void*)detection.landmarks);
+        cv::Mat dst(5, 1, CV_32FC2, (void*)kReferenceLandmarks);
+        transform = cv::estimateAffinePartial2D(src, dst, cv::noArray(), cv::LMEDS);
+    }
+    if (transform.empty()) {
+        // Square on the box's longer side, so the face isn't squashed
+        float side = std::max(detection.x2 - detection.x1, detection.y2 - detection.y1);
+        float cx = (detection.x1 + detection.x2) / 2;
+        float cy = (detection.y1 + detection.y2) / 2;
+        float scale = side > 0 ? kInputSize / side : 1;
+        transform.create(2, 3, CV_64F);
+        double* t = transform.ptr<double>();
+        t[0] = scale; t[1] = 0; t[2] = kInputSize / 2.0 - cx * scale;
+        t[3] = 0; t[4] = scale; t[5] = kInputSize / 2.0 - cy * scale;
+    }
+    // One warp does the crop and the resize, and pads faces at the edge of the frame
+    cv::warpAffine(frame, face, transform, cv::Size(kInputSize, kInputSize), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
+
+void Recognizer::embedBatch(size_t first, size_t count, Detections& detections) {
+    _batch.assign(_faces.begin() + first, _faces.begin() + first + count);
+    // SFace takes RGB at 0-255, like cv::FaceRecognizerSF feeds it
+    cv::dnn::blobFromImages(_batch, _blob, 1.0, cv::Size(), cv::Scalar(), true, false);
+    _net.setInput(_blob);
+    _output = _net.forward();
+
+    if (_output.total() != count * kEmbeddingSize) {
+        throw std::runtime_error("Recognizer::embedBatch - Unexpected output size " + std::to_string(_output.total()));
+    }
+    const float* out = _output.ptr<float>();
+    for (size_t i = 0; i < count; i++) {
+        Detection& d = detections[_pending[first + i]];
+        const float* e = out + i * kEmbeddingSize;
+        float norm = 0;
+        for (int k = 0; k < kEmbeddingSize; k++) norm += e[k] * e[k];
+        norm = norm > 0 ? 1 / std::sqrt(norm) : 0;
+        for (int k = 0; k < kEmbeddingSize; k++) d.embedding[k] = e[k] * norm;
+        d.hasEmbedding = true;
+    }
+}
+
+void Recognizer::match(Detection& detection) {
+    detection.name = nullptr;
+    detection.matchScore = 0;
+    if (!detection.hasEmbedding || !_matcher) return;
+
+    _matcher->search(detection.embedding, 1, _matches);
+    if (!_matches.empty() && _matches[0].score >= _matchThresh && _vault->name(_matches[0].row)) {
+        detection.name = _vault->name(_matches[0].row);
+        detection.matchScore = _matches[0].score;
+        facesMatched.add();
+    }
+}
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+
+#include <opencv2/highgui.hpp>
+
+#include "CompletionQueue.h"
+#include "Sink.h"
+
+static Counter displayDropped("namevault_frames_dropped_total{stage=\"sink_display\"}", "Frames dropped because the next stage was full");
+static Counter videoDropped("namevault_frames_dropped_total{stage=\"sink_video\"}", "Frames dropped because the next stage was full");
+static Counter consoleDropped("namevault_frames_dropped_total{stage=\"sink_console\"}", "Frames dropped because the next stage was full");
+
+Sink::Sink(std::string name, size_t depth, const Counter& droppedTotal)
+    : _name(std::move(name)), _depth(std::max<size_t>(1, depth)), _droppedTotal(droppedTotal), _queue(_depth) {}
+
+Sink::~Sink() {
+    stop();
+}
+
+void Sink::start() {
+    _thread = std::thread(&Sink::run, this);
+}
+
+void Sink::stop() {
+    _queue.close();
+    if (_thread.joinable()) _thread.join();
+}
+
+void Sink::push(FrameResult&& result, double fps) {
+    Entry entry;
+    entry.result = std::move(result);
+    entry.fps = fps;
+    // The evicted result, and the frame it holds, go away here rather than under the queue lock
+    Entry stale;
+    bool displaced;
+    if (!_queue.put(std::move(entry), stale, displaced)) return;
+    if (displaced) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        _droppedTotal.add();
+    }
+}
+
+void Sink::run() {
+    Entry entry;
+    while (_queue.take(entry)) {
+        // A broken sink keeps draining, so the frames it's handed still get let go of
+        if (!_failed) {
+            try {
+                consume(entry.result, entry.fps);
+            } catch (std::exception& e) {
+                _failed = true;
+                std::cout << "Error - " << _name << " sink stopped: " << e.what() << std::endl;
+            }
+        }
+        _consumed.fetch_add(1, std::memory_order_relaxed);
+        entry = Entry();
+    }
+    try {
+        finish();
+    } catch (std::exception& e) {
+        std::cout << "Error - " << _name << " sink: " << e.what() << std::endl;
+    }
+}
+
+DisplaySink::DisplaySink(std::vector<std::string> windows, size_t depth)
+    : Sink("display", depth, displayDropped), _windows(std::move(windows)), _display(false) {
+    if (_windows.empty()) _windows.push_back("Stream");
+}
+
+DisplaySink::~DisplaySink() {
+    stop();
+}
+
+void DisplaySink::consume(FrameResult& result, double fps) {
+    // Frames come in read-only, so this copies into the canvas reused across frames
+    cv::Mat frame = result.frame.writable(_canvas);
+    if (frame.empty()) return;
+    _display.visualize(frame, result.detections, fps);
+    cv::imshow(_windows[std::min<size_t>(result.source, _windows.size() - 1)], frame);
+    // HighGUI handles its window events in waitKey, on the thread that owns the windows
+    if (cv::waitKey(1) > 0) _quit = true;
+}
+
+void DisplaySink::finish() {
+    cv::destroyAllWindows();
+}
+
+VideoFileSink::VideoFileSink(std::string path, double frameRate, std::string fourcc, size_t depth)
+    : Sink("video", depth, videoDropped), _path(std::move(path)), _frameRate(frameRate > 0 ? frameRate : 30), _display(false) {
+    if (fourcc.size() != 4) {
+        throw std::runtime_error("VideoFileSink::VideoFileSink - A fourcc is 4 characters, got " + fourcc);
+    }
+    _fourcc = cv::VideoWriter::fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+}
+
+VideoFileSink::~VideoFileSink() {
+    stop();
+}
+
+std::string VideoFileSink::pathFor(int source) const {
+    if (source == 0) return _path;
+    size_t dot = _path.find_last_of('.');
+    size_t slash = _path.find_last_of('/');
+    std::string suffix = "-" + std::to_string(source);
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return _path + suffix;
+    return _path.substr(0, dot) + suffix + _path.substr(dot);
+}
+
+void VideoFileSink::consume(FrameResult& result, double fps) {
+    cv::Mat frame = result.frame.writable(_canvas);
+    if (frame.empty()) return;
+    if (result.source >= (int)_writers.size()) _writers.resize(result.source + 1);
+    std::unique_ptr<cv::VideoWriter>& writer = _writers[result.source];
+    if (!writer) {
+        std::string path = pathFor(result.source);
+        writer = std::make_unique<cv::VideoWriter>(path, _fourcc, _frameRate, frame.size());
+        if (!writer->isOpened()) {
+            throw std::runtime_error("VideoFileSink::consume - Could not open " + path + " for writing");
+        }
+        std::cout << "Recording stream " << result.source << " to " << path << std::endl;
+    }
+    _display.visualize(frame, result.detections, fps);
+    writer->write(frame);
+}
+
+void VideoFileSink::finish() {
+    // Writes the container's index; a file that's never released may not play
+    for (auto& writer : _writers) {
+        if (writer) writer->release();
+    }
+}
+
+ConsoleSink::ConsoleSink(size_t depth) : Sink("console", depth, consoleDropped) {}
+
+ConsoleSink::~ConsoleSink() {
+    stop();
+}
+
+void ConsoleSink::consume(FrameResult& result, double /*fps*/) {
+    for (const Detection& d : result.detections) {
+        printf("Detection of %s, score: %f, name: %s\n", d.label, d.score, d.name ? d.name : "-");
+    }
+}
+
+// Buffers the sinks' copies of borrowed frames are made in. Claims go back on the free list
+// when the last sink lets go of a copy
+struct SinkSet::CopyPool {
+    struct Copy : FrameClaim {
+        CopyPool* owner;
+        cv::Mat image;
+        std::shared_ptr<CopyPool> keepAlive;  // set while leased
+
+        void release() override {
+            std::shared_ptr<CopyPool> keep = std::move(keepAlive);
+            owner->free.push(this);
+        }
+    };
+
+    explicit CopyPool(size_t count) : free(count) {
+        for (size_t i = 0; i < count; i++) {
+            copies.push_back(std::make_unique<Copy>());
+            copies.back()->owner = this;
+            free.push(copies.back().get());
+        }
+    }
+
+    std::vector<std::unique_ptr<Copy>> copies;
+    CompletionQueue<Copy*> free;
+};
+
+SinkSet::SinkSet() {}
+
+SinkSet::~SinkSet() {
+    stop();
+}
+
+void SinkSet::add(std::unique_ptr<Sink> sink) {
+    _sinks.push_back(std::move(sink));
+}
+
+void SinkSet::start() {
+    // Each drawing sink holds at most its queue plus the frame it's on, and one more is on its way in
+    size_t copies = 1;
+    for (auto& sink : _sinks) {
+        if (sink->needsPixels()) copies += sink->depth() + 1;
+    }
+    _anyPixels = copies > 1;
+    if (_anyPixels) _copies = std::make_shared<CopyPool>(copies);
+    for (auto& sink : _sinks) sink->start();
+}
+
+void SinkSet::stop() {
+    for (auto& sink : _sinks) sink->stop();
+}
+
+bool SinkSet::quitRequested() const {
+    for (const auto& sink : _sinks) {
+        if (sink->quitRequested()) return true;
+    }
+    return false;
+}
+
+FrameLease SinkSet::pixelsFor(const FrameLease& frame) {
+    if (frame.empty()) return FrameLease();
+    // An owned frame can be shared as is; read-only makes every sink draw on its own copy
+    if (!frame.borrowed() && !frame.isYuv()) return FrameLease(frame.image(), nullptr, true);
+
+    CopyPool::Copy* copy;
+    if (!_copies->free.tryPop(copy)) {
+        // Only if sinks hold more than their queues allow for; a one-off copy still keeps capture's buffers free
+        cv::Mat owned;
+        if (frame.isYuv()) frame.yuv().toBgr(owned);
+        else owned = frame.image().clone();
+        return FrameLease(owned, nullptr, true);
+    }
+    if (frame.isYuv()) frame.yuv().toBgr(copy->image);
+    else frame.image().copyTo(copy->image);
+    copy->keepAlive = _copies;
+    return FrameLease(copy->image, copy, true);
+}
+
+void SinkSet::publish(const FrameResult& result, double fps) {
+    FrameLease pixels;
+    if (_anyPixels) pixels = pixelsFor(result.frame);
+    for (auto& sink : _sinks) {
+        FrameResult item = result;
+        if (sink->needsPixels()) item.frame = pixels;
+        else item.frame.reset();
+        sink->push(std::move(item), fps);
+    }
+}
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <stdio.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TILED_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TILED_SSE2
+#endif
+
+#include "Metrics.h"
+#include "TiledDetector.h"
+
+static Histogram tilesSeconds("namevault_tiled_detect_seconds", "Running the detectors over every tile of a frame");
+static Histogram mergeSeconds("namevault_tiled_merge_seconds", "Merging boxes across tiles");
+
+// Each wrapped detector has its own copy of the labels, so the same label isn't always the same pointer
+static bool sameLabel(const char* a, const char* b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// hits[j] for each of n boxes against box (x1, y1, x2, y2) of the given area: bit 0 when their
+// IoU is over iouThresh, bit 1 when more than containThresh of box j lies inside it.
+// Overlap tests are multiplied out so there's no division
+static void overlapHits(const float* x1, const float* y1, const float* x2, const float* y2, const float* area, int n,
+                        float bx1, float by1, float bx2, float by2, float barea, float iouThresh, float containThresh, uint8_t* hits) {
+    int j = 0;
+#if defined(TILED_NEON)
+    float32x4_t vx1 = vdupq_n_f32(bx1), vy1 = vdupq_n_f32(by1), vx2 = vdupq_n_f32(bx2), vy2 = vdupq_n_f32(by2);
+    float32x4_t va = vdupq_n_f32(barea), zero = vdupq_n_f32(0);
+    for (; j + 4 <= n; j += 4) {
+        float32x4_t w = vmaxq_f32(zero, vsubq_f32(vminq_f32(vx2, vld1q_f32(x2 + j)), vmaxq_f32(vx1, vld1q_f32(x1 + j))));
+        float32x4_t h = vmaxq_f32(zero, vsubq_f32(vminq_f32(vy2, vld1q_f32(y2 + j)), vmaxq_f32(vy1, vld1q_f32(y1 + j))));
+        float32x4_t inter = vmulq_f32(w, h);
+        float32x4_t a = vld1q_f32(area + j);
+        uint32x4_t iou = vcgtq_f32(inter, vmulq_n_f32(vsubq_f32(vaddq_f32(va, a), inter), iouThresh));
+        uint32x4_t inside = vcgtq_f32(inter, vmulq_n_f32(a, containThresh));
+        uint32x4_t bits = vorrq_u32(vandq_u32(iou, vdupq_n_u32(1)), vandq_u32(inside, vdupq_n_u32(2)));
+        hits[j] = vgetq_lane_u32(bits, 0);
+        hits[j + 1] = vgetq_lane_u32(bits, 1);
+        hits[j + 2] = vgetq_lane_u32(bits, 2);
+        hits[j + 3] = vgetq_lane_u32(bits, 3);
+    }
+#elif defined(TILED_SSE2)
+    __m128 vx1 = _mm_set1_ps(bx1), vy1 = _mm_set1_ps(by1), vx2 = _mm_set1_ps(bx2), vy2 = _mm_set1_ps(by2);
+    __m128 va = _mm_set1_ps(barea), zero = _mm_setzero_ps();
+    __m128 vIou = _mm_set1_ps(iouThresh), vContain = _mm_set1_ps(containThresh);
+    for (; j + 4 <= n; j += 4) {
+        __m128 w = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(vx2, _mm_loadu_ps(x2 + j)), _mm_max_ps(vx1, _mm_loadu_ps(x1 + j))));
+        __m128 h = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(vy2, _mm_loadu_ps(y2 + j)), _mm_max_ps(vy1, _mm_loadu_ps(y1 + j))));
+        __m128 inter = _mm_mul_ps(w, h);
+        __m128 a = _mm_loadu_ps(area + j);
+        int iou = _mm_movemask_ps(_mm_cmpgt_ps(inter, _mm_mul_ps(_mm_sub_ps(_mm_add_ps(va, a), inter), vIou)));
+        int inside = _mm_movemask_ps(_mm_cmpgt_ps(inter, _mm_mul_ps(a, vContain)));
+        for (int k = 0; k < 4; k++) hits[j + k] = ((iou >> k) & 1) | (((inside >> k) & 1) << 1);
+    }
+#endif
+    for (; j < n; j++) {
+        float w = std::max(0.f, std::min(bx2, x2[j]) - std::max(bx1, x1[j]));
+        float h = std::max(0.f, std::min(by2, y2[j]) - std::max(by1, y1[j]));
+        float inter = w * h;
+        hits[j] = (inter > (barea + area[j] - inter) * iouThresh) | ((inter > area[j] * containThresh) << 1);
+    }
+}
+
+TiledDetector::TiledDetector(std::vector<std::unique_ptr<Detector>> detectors, TilingConfig config)
+    : _detectors(std::move(detectors)), _config(config) {
+    if (_detectors.empty()) {
+        throw std::runtime_error("TiledDetector::TiledDetector - Needs at least one detector");
+    }
+    _config.cols = std::max(1, _config.cols);
+    _config.rows = std::max(1, _config.rows);
+    _config.overlap = std::min(0.9f, std::max(0.f, _config.overlap));
+    _name = std::string("tiled-") + _detectors[0]->name();
+
+    size_t tiles = _config.cols * _config.rows + (_config.fullFrame ? 1 : 0);
+    _views.resize(tiles);
+    _found.resize(tiles);
+    size_t candidates = tiles * kMaxDetections;
+    _candidates.reserve(candidates);
+    _order.reserve(candidates);
+    for (std::vector<float>* v : {&_x1, &_y1, &_x2, &_y2, &_area}) v->resize(candidates);
+    _hits.resize(candidates);
+    _suppressed.resize(candidates);
+
+    for (size_t i = 1; i < _detectors.size(); i++) {
+        _workers.emplace_back(&TiledDetector::workerLoop, this, i);
+    }
+}
+
+TiledDetector::~TiledDetector() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& worker : _workers) worker.join();
+}
+
+void TiledDetector::layout(int width, int height) {
+    _width = width;
+    _height = height;
+    _tiles.clear();
+    // Equal tiles, stepping by (1 - overlap) of a tile, that together just cover the frame
+    int cols = _config.cols;
+    int rows = _config.rows;
+    int tileWidth = std::min(width, (int)std::ceil(width / (cols - (cols - 1) * _config.overlap)));
+    int tileHeight = std::min(height, (int)std::ceil(height / (rows - (rows - 1) * _config.overlap)));
+    for (int r = 0; r < rows; r++) {
+        int y = rows > 1 ? (int)std::lround((double)(height - tileHeight) * r / (rows - 1)) : 0;
+        for (int c = 0; c < cols; c++) {
+            int x = cols > 1 ? (int)std::lround((double)(width - tileWidth) * c / (cols - 1)) : 0;
+            _tiles.push_back(cv::Rect(x, y, tileWidth, tileHeight));
+        }
+    }
+    if (_config.fullFrame) _tiles.push_back(cv::Rect(0, 0, width, height));
+}
+
+void TiledDetector::runShare(size_t worker) {
+    size_t n = _tiles.size();
+    size_t first = n * worker / _detectors.size();
+    size_t last = n * (worker + 1) / _detectors.size();
+    if (first == last) return;
+    try {
+        _detectors[worker]->detectBatch(&_views[first], last - first, &_found[first]);
+    } catch (std::exception& e) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_error.empty()) _error = e.what();
+    }
+}
+
+void TiledDetector::workerLoop(size_t worker) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [&] { return _stop || _generation != seen; });
+        if (_stop) return;
+        seen = _generation;
+        lock.unlock();
+        runShare(worker);
+        lock.lock();
+        if (--_pending == 0) _done.notify_one();
+    }
+}
+
+void TiledDetector::detect(const cv::Mat& src, Detections& detections) {
+    if (src.cols != _width || src.rows != _height) layout(src.cols, src.rows);
+    for (size_t i = 0; i < _tiles.size(); i++) _views[i] = src(_tiles[i]);
+
+    {
+        ScopedTimer timer(tilesSeconds);
+        if (!_workers.empty()) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending = _workers.size();
+            _generation++;
+        }
+        _wake.notify_all();
+        runShare(0);
+        if (!_workers.empty()) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [this] { return _pending == 0; });
+        }
+    }
+    // The views hold a reference to the frame, which may be a leased camera buffer
+    for (cv::Mat& view : _views) view.release();
+    if (!_error.empty()) {
+        std::string error = _error;
+        _error.clear();
+        throw std::runtime_error("TiledDetector::detect - " + error);
+    }
+
+    ScopedTimer timer(mergeSeconds);
+    merge(detections);
+}
+
+void TiledDetector::merge(Detections& detections) {
+    // Back into frame pixels
+    _candidates.clear();
+    for (size_t t = 0; t < _tiles.size(); t++) {
+        float dx = _tiles[t].x;
+        float dy = _tiles[t].y;
+        for (Detection d : _found[t]) {
+            d.x1 += dx;
+            d.x2 += dx;
+            d.y1 += dy;
+            d.y2 += dy;
+            for (int k = 0; d.hasLandmarks && k < 5; k++) {
+                d.landmarks[k][0] += dx;
+                d.landmarks[k][1] += dy;
+            }
+            _candidates.push_back(d);
+        }
+    }
+
+    int n = _candidates.size();
+    _order.resize(n);
+    for (int i = 0; i < n; i++) _order[i] = i;
+    std::sort(_order.begin(), _order.end(), [this](int a, int b) { return _candidates[a].score > _candidates[b].score; });
+    for (int i = 0; i < n; i++) {
+        const Detection& d = _candidates[_order[i]];
+        _x1[i] = d.x1;
+        _y1[i] = d.y1;
+        _x2[i] = d.x2;
+        _y2[i] = d.y2;
+        _area[i] = (d.x2 - d.x1) * (d.y2 - d.y1);
+    }
+    std::fill(_suppressed.begin(), _suppressed.begin() + n, 0);
+
+    // Greedy, best first: whatever a kept box overlaps with the same label is the same object
+    detections.clear();
+    for (int i = 0; i < n && !detections.full(); i++) {
+        if (_suppressed[i]) continue;
+        int rest = n - i - 1;
+        overlapHits(&_x1[i + 1], &_y1[i + 1], &_x2[i + 1], &_y2[i + 1], &_area[i + 1], rest,
+                    _x1[i], _y1[i], _x2[i], _y2[i], _area[i], _config.nmsThresh, _config.containThresh, _hits.data());
+        const char* label = _candidates[_order[i]].label;
+        for (int j = 0; j < rest; j++) {
+            if (!_hits[j] || _suppressed[i + 1 + j]) continue;
+            // A face inside a person box is a face, not a cut-off part of the person
+            if (!sameLabel(label, _candidates[_order[i + 1 + j]].label)) continue;
+            _suppressed[i + 1 + j] = 1;
+            if (_hits[j] & 2) {
+                // Part of the same face from a tile that cut it off; the kept box covers both
+                int k = i + 1 + j;
+                _x1[i] = std::min(_x1[i], _x1[k]);
+                _y1[i] = std::min(_y1[i], _y1[k]);
+                _x2[i] = std::max(_x2[i], _x2[k]);
+                _y2[i] = std::max(_y2[i], _y2[k]);
+            }
+        }
+        Detection d = _candidates[_order[i]];
+        d.x1 = _x1[i];
+        d.y1 = _y1[i];
+        d.x2 = _x2[i];
+        d.y2 = _y2[i];
+        detections.push_back(d);
+    }
+}
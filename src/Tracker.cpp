@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cstring>
+
+#include "Tracker.h"
+
+void Tracker::Axis::init(float z, float r) {
+    p = z;
+    v = 0;
+    p00 = r;
+    p01 = 0;
+    p11 = r;
+}
+
+void Tracker::Axis::predict(float q) {
+    // x = F x, P = F P F' + Q with F = [1 1; 0 1] and Q = q [1/4 1/2; 1/2 1]
+    p += v;
+    p00 += 2 * p01 + p11 + q / 4;
+    p01 += p11 + q / 2;
+    p11 += q;
+}
+
+void Tracker::Axis::correct(float z, float r) {
+    float s = p00 + r;
+    float k0 = p00 / s;
+    float k1 = p01 / s;
+    float y = z - p;
+    p += k0 * y;
+    v += k1 * y;
+    p11 -= k1 * p01;
+    p01 -= k0 * p01;
+    p00 -= k0 * p00;
+}
+
+Tracker::Tracker(TrackerConfig config) : _config(config), _nextId(config.firstId) {
+    // Each update starts at most kMaxDetections tracks and a track outlives maxMisses + 1 updates unmatched
+    size_t maxTracks = kMaxDetections * (std::max(0, _config.maxMisses) + 2);
+    _tracks.reserve(maxTracks);
+    _predicted.reserve(maxTracks);
+    _pairs.reserve(maxTracks * kMaxDetections);
+    _trackUsed.reserve(maxTracks);
+    _detectionUsed.reserve(kMaxDetections);
+}
+
+float Tracker::iou(const Detection& a, const Detection& b) {
+    float w = std::min(a.x2, b.x2) - std::max(a.x1, b.x1);
+    float h = std::min(a.y2, b.y2) - std::max(a.y1, b.y1);
+    if (w <= 0 || h <= 0) return 0;
+    float overlap = w * h;
+    float areaA = (a.x2 - a.x1) * (a.y2 - a.y1);
+    float areaB = (b.x2 - b.x1) * (b.y2 - b.y1);
+    return overlap / (areaA + areaB - overlap);
+}
+
+void Tracker::boxOf(const Track& track, Detection& d) const {
+    float w = std::max(1.f, track.w.p);
+    float h = std::max(1.f, track.h.p);
+    d.x1 = track.cx.p - w / 2;
+    d.x2 = track.cx.p + w / 2;
+    d.y1 = track.cy.p - h / 2;
+    d.y2 = track.cy.p + h / 2;
+}
+
+void Tracker::step() {
+    for (Track& track : _tracks) {
+        // Noise scales with the face, so near and far faces track alike
+        float scale = std::max(1.f, track.h.p);
+        float q = _config.processNoise * scale;
+        q *= q;
+        track.cx.predict(q);
+        track.cy.predict(q);
+        track.w.predict(q);
+        track.h.predict(q);
+    }
+}
+
+void Tracker::predict(Detections& detections) {
+    step();
+    detections.clear();
+    for (const Track& track : _tracks) {
+        // Only tracks the detector still sees; a missed one waits for the next detector run
+        if (track.misses) continue;
+        Detection d = track.last;
+        boxOf(track, d);
+        if (!detections.push_back(d)) break;
+    }
+}
+
+void Tracker::annotate(const Detections& detections) {
+    for (const Detection& d : detections) {
+        if (d.trackId < 0) continue;
+        for (Track& track : _tracks) {
+            if (track.id != d.trackId) continue;
+            track.last.name = d.name;
+            track.last.matchScore = d.matchScore;
+            track.last.hasEmbedding = d.hasEmbedding;
+            if (d.hasEmbedding) memcpy(track.last.embedding, d.embedding, sizeof(d.embedding));
+            break;
+        }
+    }
+}
+
+void Tracker::update(Detections& detections) {
+    step();
+
+    // Greedy association, best overlap first; a handful of faces doesn't need Hungarian
+    _predicted.resize(_tracks.size());
+    for (size_t t = 0; t < _tracks.size(); t++) boxOf(_tracks[t], _predicted[t]);
+    _pairs.clear();
+    for (size_t t = 0; t < _tracks.size(); t++) {
+        for (size_t d = 0; d < detections.size(); d++) {
+            float overlap = iou(_predicted[t], detections[d]);
+            if (overlap >= _config.iouThresh) _pairs.push_back({overlap, {(int)t, (int)d}});
+        }
+    }
+    std::sort(_pairs.begin(), _pairs.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    _trackUsed.assign(_tracks.size(), 0);
+    _detectionUsed.assign(detections.size(), 0);
+    _stable = !_tracks.empty();
+    for (const auto& pair : _pairs) {
+        int t = pair.second.first;
+        int d = pair.second.second;
+        if (_trackUsed[t] || _detectionUsed[d]) continue;
+        _trackUsed[t] = 1;
+        _detectionUsed[d] = 1;
+        if (pair.first < 0.5) _stable = false;
+
+        Track& track = _tracks[t];
+        Detection& det = detections[d];
+        float r = _config.measurementNoise * std::max(1.f, track.h.p);
+        r *= r;
+        track.cx.correct((det.x1 + det.x2) / 2, r);
+        track.cy.correct((det.y1 + det.y2) / 2, r);
+        track.w.correct(det.x2 - det.x1, r);
+        track.h.correct(det.y2 - det.y1, r);
+        track.misses = 0;
+        track.hits++;
+        det.trackId = track.id;
+        track.last = det;
+    }
+
+    for (size_t t = 0; t < _tracks.size(); t++) {
+        if (!_trackUsed[t]) {
+            _tracks[t].misses++;
+            _stable = false;
+        }
+    }
+    _tracks.erase(std::remove_if(_tracks.begin(), _tracks.end(), [this](const Track& track) { return track.misses > _config.maxMisses; }),
+                  _tracks.end());
+
+    for (size_t d = 0; d < detections.size(); d++) {
+        if (_detectionUsed[d]) continue;
+        Detection& det = detections[d];
+        Track track;
+        track.id = _nextId++;
+        track.misses = 0;
+        track.hits = 1;
+        float r = _config.measurementNoise * std::max(1.f, det.y2 - det.y1);
+        r *= r;
+        track.cx.init((det.x1 + det.x2) / 2, r);
+        track.cy.init((det.y1 + det.y2) / 2, r);
+        track.w.init(det.x2 - det.x1, r);
+        track.h.init(det.y2 - det.y1, r);
+        det.trackId = track.id;
+        track.last = det;
+        _tracks.push_back(track);
+        _stable = false;
+    }
+}
@@ -1,59 +1,183 @@
 
+#include <algorithm>
 #include <iostream>
 #include <chrono>
+#include <mutex>
 #include <thread>
 #include <stdexcept>
+#include <vector>
 
+#include "CompletionQueue.h"
+#include "Metrics.h"
 #include "VideoSource.h"
 
 cv::Size VideoSource::getSize() {
     return cv::Size(_frameWidth, _frameHeight);
 }
 
+FrameLease VideoSource::acquireFrame() {
+    cv::Mat frame;
+    getFrame(frame);
+    return FrameLease(frame);
+}
+
 #ifdef CROSSCOMPILING
 
-LibCameraVideoSource::LibCameraVideoSource(int width, int height, int fps) {
-    if (_cam.initCamera()) {
-        throw std::runtime_error("LibCameraVideoSource:Could not initialize libcamera");
+static Counter backlogDropped("namevault_frames_dropped_total{stage=\"camera_backlog\"}", "Frames dropped because the next stage was full");
+
+// A camera buffer checked out to the pipeline. Claims go back on the free list when the last
+// lease lets go, so steady-state capture reuses them instead of allocating
+struct LibCameraVideoSource::CameraLeases {
+    struct BufferClaim : FrameClaim {
+        CameraLeases* owner;
+        LibcameraOutData frameData;
+        std::shared_ptr<CameraLeases> keepAlive;  // set while leased
+
+        void release() override {
+            // The last claim out may be holding the last reference
+            std::shared_ptr<CameraLeases> keep = std::move(keepAlive);
+            std::lock_guard<std::mutex> lock(owner->mutex);
+            if (owner->cam) owner->cam->returnFrameBuffer(frameData);
+            owner->free.push(this);
+        }
+    };
+
+    explicit CameraLeases(size_t count) : free(count) {
+        for (size_t i = 0; i < count; i++) {
+            claims.push_back(std::make_unique<BufferClaim>());
+            claims.back()->owner = this;
+            free.push(claims.back().get());
+        }
     }
-    _cam.configureStream(width, height, libcamera::formats::RGB888, 1, 0);
-    libcamera::ControlList controls;
-    int64_t frame_time = 1000000 / fps;
-	controls.set(libcamera::controls::FrameDurationLimits, libcamera::Span<const int64_t, 2>({ frame_time, frame_time }));
+
+    std::mutex mutex;
+    LibCamera* cam = nullptr;  // cleared when the source closes the camera
+    std::vector<std::unique_ptr<BufferClaim>> claims;
+    CompletionQueue<BufferClaim*> free;
+};
+
+LibCameraVideoSource::LibCameraVideoSource(int width, int height, int fps, int bufferCount, int cameraIndex, bool yuv) : _yuv(yuv) {
+    if (_cam.initCamera(cameraIndex)) {
+        throw std::runtime_error("LibCameraVideoSource:Could not initialize camera " + std::to_string(cameraIndex));
+    }
+    _cam.configureStream(width, height, yuv ? libcamera::formats::YUV420 : libcamera::formats::RGB888, bufferCount, 0);
     // controls.set(controls::Brightness, 0.5);
     // controls.set(controls::Contrast, 1.5);
     // controls.set(controls::ExposureTime, 20000);
-    _cam.set(controls);
+    setFrameRate(fps);
 
     std::cout << "Starting camera\n";
     _cam.startCamera();
+    if (_cam.bufferCount() == 0) {
+        _cam.stopCamera();
+        _cam.closeCamera();
+        throw std::runtime_error("LibCameraVideoSource:Could not start camera " + std::to_string(cameraIndex));
+    }
+    // One lease per buffer the allocator actually gave us, since each one holds a request.
+    // The configuration can round the requested count up, and every buffer completes frames
+    _leases = std::make_shared<CameraLeases>(_cam.bufferCount());
+    _leases->cam = &_cam;
 
     _cam.VideoStream(&_frameWidth, &_frameHeight, &_stride);
-    std::cout << "Starting video stream of " << _frameWidth << "X" << _frameHeight << " and stride " << _stride << "\n";
+    std::cout << "Starting " << (_yuv ? "YUV420" : "RGB888") << " video stream of " << _frameWidth << "X" << _frameHeight << " and stride " << _stride << "\n";
 }
 
 LibCameraVideoSource::~LibCameraVideoSource() {
+    {
+        std::lock_guard<std::mutex> lock(_leases->mutex);
+        _leases->cam = nullptr;
+    }
     _cam.stopCamera();
     _cam.closeCamera();
 }
 
 void LibCameraVideoSource::getFrame(cv::Mat& frame) {
-    while (!_cam.readFrame(&_frameData)) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // Callers of the plain API own their frame, so this path still copies
+    FrameLease lease = acquireFrame();
+    if (lease.isYuv()) lease.yuv().toBgr(frame);
+    else frame = lease.image().clone();
+}
+
+FrameLease LibCameraVideoSource::acquireFrame() {
+    LibcameraOutData frameData;
+    // Sleeps until libcamera completes a request
+    _cam.readFrame(&frameData, -1);
+    if (_latestOnly.load(std::memory_order_relaxed)) {
+        // Requests that completed while the caller was busy are already stale; requeue them
+        LibcameraOutData newer;
+        while (_cam.readFrame(&newer, 0)) {
+            _cam.returnFrameBuffer(frameData);
+            frameData = newer;
+            _staleDropped.fetch_add(1, std::memory_order_relaxed);
+            backlogDropped.add();
+        }
+    }
+    // The request stays checked out of libcamera until the last holder lets go of the lease.
+    // The buffer is mapped PROT_READ, hence read-only
+    CameraLeases::BufferClaim* claim;
+    if (!_leases->free.tryPop(claim)) {
+        _cam.returnFrameBuffer(frameData);
+        throw std::runtime_error("LibCameraVideoSource::acquireFrame - More frames leased than camera buffers");
+    }
+    claim->frameData = frameData;
+    claim->keepAlive = _leases;
+    if (_yuv) {
+        // Chroma rows are half the luma stride; the planes come from the buffer's own offsets
+        YuvPlanes planes;
+        planes.y = frameData.planes[0];
+        planes.u = frameData.planeCount == 3 ? frameData.planes[1] : planes.y + (size_t)_stride * _frameHeight;
+        planes.v = frameData.planeCount == 3 ? frameData.planes[2] : planes.u + (size_t)(_stride / 2) * (_frameHeight / 2);
+        planes.width = _frameWidth;
+        planes.height = _frameHeight;
+        planes.yStride = _stride;
+        planes.uvStride = _stride / 2;
+        return FrameLease(planes, claim);
     }
-    // _frameData.imageData is non-modifiable, remove clone if no display
-    frame = cv::Mat(_frameHeight, _frameWidth, CV_8UC3, _frameData.imageData, _stride).clone();
-    _cam.returnFrameBuffer(_frameData);
+    cv::Mat view(_frameHeight, _frameWidth, CV_8UC3, frameData.imageData, _stride);
+    return FrameLease(view, claim);
 }
 
-void LibCameraVideoSource::returnFrame() {
-    _cam.returnFrameBuffer(_frameData);
+bool LibCameraVideoSource::setFrameRate(double fps) {
+    if (fps <= 0) return false;
+    libcamera::ControlList controls;
+    int64_t frame_time = 1000000 / fps;
+	controls.set(libcamera::controls::FrameDurationLimits, libcamera::Span<const int64_t, 2>({ frame_time, frame_time }));
+    _cam.set(controls);
+    _frameRate = fps;
+    return true;
 }
 
 #endif
 
-FileVideoSource::FileVideoSource(std::string path, int frameRate) {
-    _frameRate = frameRate;
+// Decode buffers handed back and forth with the leases. Only one thread takes frames (the
+// prefetch thread when there is one, otherwise the caller), any thread gives them back
+struct FileVideoSource::FramePool {
+    struct FileFrame : FrameClaim {
+        FramePool* owner;
+        cv::Mat image;
+        std::shared_ptr<FramePool> keepAlive;  // set while leased
+
+        void release() override {
+            std::shared_ptr<FramePool> keep = std::move(keepAlive);
+            owner->free.push(this);
+        }
+    };
+
+    explicit FramePool(size_t count) : free(count) {
+        for (size_t i = 0; i < count; i++) {
+            frames.push_back(std::make_unique<FileFrame>());
+            frames.back()->owner = this;
+            free.push(frames.back().get());
+        }
+    }
+
+    std::vector<std::unique_ptr<FileFrame>> frames;
+    CompletionQueue<FileFrame*> free;
+};
+
+FileVideoSource::FileVideoSource(std::string path, int frameRate, Pacing pacing, bool loop, size_t prefetchDepth, size_t bufferCount) {
+    _pacing = pacing;
+    _loop = loop;
     _cap.open(path);
     if (_cap.isOpened()) {
         _frameWidth = _cap.get(cv::CAP_PROP_FRAME_WIDTH);
@@ -62,11 +186,120 @@ FileVideoSource::FileVideoSource(std::string path, int frameRate) {
     } else {
         throw std::runtime_error("FileVideoSource:Could not open " + path);
     }
+    _frameRate = frameRate > 0 ? frameRate : _cap.get(cv::CAP_PROP_FPS);
+    if (_frameRate <= 0) _frameRate = 30;
+
+    // Enough for the prefetched frames plus one being decoded and one with the caller
+    _pool = std::make_shared<FramePool>(std::max(bufferCount, prefetchDepth + 2));
+
+    if (_pacing == Pacing::Unthrottled) {
+        _prefetched = std::make_unique<SpscQueue<FrameLease>>(prefetchDepth);
+        _prefetching = true;
+        _prefetchThread = std::thread(&FileVideoSource::prefetchLoop, this);
+    }
+}
+
+FileVideoSource::~FileVideoSource() {
+    if (_prefetchThread.joinable()) {
+        _prefetching = false;
+        _prefetched->close();
+        _prefetchThread.join();
+    }
+}
+
+void FileVideoSource::decode(cv::Mat& frame) {
+    if (_cap.read(frame)) return;
+    if (_loop) {
+        // Keep timestamps increasing across the rewind
+        _loopOffset = _lastPts + 1000.0 / _frameRate;
+        _cap.set(cv::CAP_PROP_POS_FRAMES, 0);
+        if (_cap.read(frame)) return;
+    }
+    throw std::runtime_error("FileVideoSource: Can't grab frame");
+}
+
+FrameLease FileVideoSource::decodeLease() {
+    FramePool::FileFrame* frame;
+    if (!_pool->free.tryPop(frame)) {
+        // Every buffer is still held downstream; a one-off frame beats stalling the pipeline
+        cv::Mat image;
+        decode(image);
+        return FrameLease(image);
+    }
+    try {
+        decode(frame->image);
+    } catch (...) {
+        _pool->free.push(frame);
+        throw;
+    }
+    frame->keepAlive = _pool;
+    // Nothing else reads a pooled buffer until it's released, so stages may draw on it
+    return FrameLease(frame->image, frame, false);
+}
+
+void FileVideoSource::prefetchLoop() {
+    while (_prefetching) {
+        FrameLease frame;
+        try {
+            frame = decodeLease();
+        } catch (std::runtime_error& e) {
+            _prefetchError = e.what();
+            break;
+        }
+        if (!_prefetched->push(std::move(frame))) break;
+    }
+    _prefetched->close();
+}
+
+FrameLease FileVideoSource::acquireFrame() {
+    FrameLease frame;
+    if (_pacing == Pacing::Unthrottled) {
+        if (!_prefetched->pop(frame)) {
+            throw std::runtime_error(_prefetchError.empty() ? "FileVideoSource: Can't grab frame" : _prefetchError);
+        }
+        return frame;
+    }
+
+    // Decode first and then wait out the rest of the frame period, so decode time isn't added on top
+    frame = decodeLease();
+    pace();
+    return frame;
 }
 
 void FileVideoSource::getFrame(cv::Mat& frame) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000 / _frameRate));
-    if (!_cap.read(frame)) {
-        throw std::runtime_error("FileVideoSource: Can't grab frame");
+    if (_pacing == Pacing::Unthrottled) {
+        // The caller owns its frame, so this path copies out of the pool
+        acquireFrame().image().copyTo(frame);
+        return;
+    }
+    decode(frame);
+    pace();
+}
+
+void FileVideoSource::pace() {
+    if (_pacing == Pacing::None) return;
+    auto now = std::chrono::steady_clock::now();
+    auto period = std::chrono::microseconds((int64_t)(1000000 / _frameRate));
+
+    if (_pacing == Pacing::Timestamp) {
+        double pts = _loopOffset + _cap.get(cv::CAP_PROP_POS_MSEC);
+        if (_firstPts < 0) {
+            _firstPts = pts;
+            _start = now;
+        }
+        _lastPts = pts;
+        _deadline = _start + std::chrono::microseconds((int64_t)((pts - _firstPts) * 1000));
+    } else if (!_started) {
+        _deadline = now;
+    } else {
+        _deadline += period;
+    }
+    _started = true;
+
+    // After a stall, restart the schedule rather than bursting to catch up
+    if (now - _deadline > period) {
+        _start += now - _deadline;
+        _deadline = now;
     }
+    std::this_thread::sleep_until(_deadline);
 }
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <stdio.h>
+
+#include "Metrics.h"
+#include "YunetDetector.h"
+
+static Histogram preprocessSeconds("namevault_yunet_preprocess_seconds", "Resizing a frame into the YuNet input blob");
+static Histogram forwardSeconds("namevault_yunet_forward_seconds", "YuNet forward pass");
+static Histogram postprocessSeconds("namevault_yunet_postprocess_seconds", "Decoding and suppressing YuNet faces");
+static Counter detectionsTotal("namevault_detections_total{backend=\"yunet\"}", "Detections above the confidence threshold");
+
+const int YunetDetector::kStrides[3] = {8, 16, 32};
+
+// Every feature map divides the input evenly
+static const int kAlign = 32;
+
+YunetDetector::YunetDetector(std::string modelPath, YunetConfig config) : _config(config) {
+
+    printf("Creating YuNet detector with %s\n", modelPath.c_str());
+    try {
+        _net = cv::dnn::readNet(modelPath);
+    } catch (cv::Exception& e) {
+        throw std::runtime_error("YunetDetector::YunetDetector - Failed to load " + modelPath + ": " + e.what());
+    }
+    if (_net.empty()) {
+        throw std::runtime_error("YunetDetector::YunetDetector - Failed to load " + modelPath);
+    }
+    _net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    _net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    // Outputs are looked up by name rather than trusting their order
+    _outputNames = _net.getUnconnectedOutLayersNames();
+    const char* kinds[4] = {"cls", "obj", "bbox", "kps"};
+    for (int s = 0; s < 3; s++) {
+        for (int k = 0; k < 4; k++) {
+            std::string wanted = std::string(kinds[k]) + "_" + std::to_string(kStrides[s]);
+            auto it = std::find(_outputNames.begin(), _outputNames.end(), wanted);
+            if (it == _outputNames.end()) {
+                throw std::runtime_error("YunetDetector::YunetDetector - Model has no output " + wanted);
+            }
+            _outputIndex[s][k] = it - _outputNames.begin();
+        }
+    }
+
+    _config.inputWidth = std::max(kAlign, _config.inputWidth / kAlign * kAlign);
+    _config.topK = std::max(1, _config.topK);
+    _candidates.reserve(_config.topK);
+    _order.reserve(_config.topK);
+    _suppressed.reserve(_config.topK);
+}
+
+void YunetDetector::prepare(int srcWidth, int srcHeight) {
+    _srcWidth = srcWidth;
+    _srcHeight = srcHeight;
+    // Keep the frame's aspect ratio and pad up to the next multiple of the coarsest stride
+    _inputWidth = _config.inputWidth;
+    int height = (int)std::lround((double)srcHeight * _inputWidth / srcWidth);
+    _inputHeight = std::max(kAlign, (height + kAlign - 1) / kAlign * kAlign);
+    _input.create(_inputHeight, _inputWidth, CV_8UC3);
+}
+
+void YunetDetector::detect(const cv::Mat& src, Detections& detections) {
+    detections.clear();
+    if (src.cols != _srcWidth || src.rows != _srcHeight) prepare(src.cols, src.rows);
+
+    Letterbox box;
+    {
+        ScopedTimer timer(preprocessSeconds);
+        // YuNet takes BGR at 0-255, so no swap and no scaling
+        box = _resizer.run(src, _input.ptr<uint8_t>(), _inputWidth, _inputHeight, false, true);
+        cv::dnn::blobFromImage(_input, _blob);
+    }
+    {
+        ScopedTimer timer(forwardSeconds);
+        _net.setInput(_blob);
+        _net.forward(_outputs, _outputNames);
+    }
+
+    ScopedTimer timer(postprocessSeconds);
+    decode();
+
+    // Greedy NMS, best first
+    std::sort_heap(_order.begin(), _order.end(), [this](int a, int b) { return _candidates[a].score > _candidates[b].score; });
+    _suppressed.assign(_candidates.size(), 0);
+    for (size_t i = 0; i < _order.size() && !detections.full(); i++) {
+        const Candidate& c = _candidates[_order[i]];
+        if (_suppressed[_order[i]]) continue;
+        float area = (c.x2 - c.x1) * (c.y2 - c.y1);
+        for (size_t j = i + 1; j < _order.size(); j++) {
+            const Candidate& o = _candidates[_order[j]];
+            float w = std::min(c.x2, o.x2) - std::max(c.x1, o.x1);
+            float h = std::min(c.y2, o.y2) - std::max(c.y1, o.y1);
+            if (w <= 0 || h <= 0) continue;
+            float overlap = w * h / (area + (o.x2 - o.x1) * (o.y2 - o.y1) - w * h);
+            if (overlap > _config.nmsThresh) _suppressed[_order[j]] = 1;
+        }
+
+        // Back through the letterbox into frame pixels
+        Detection d;
+        d.x1 = (c.x1 - box.padX) / box.scaleX;
+        d.y1 = (c.y1 - box.padY) / box.scaleY;
+        d.x2 = (c.x2 - box.padX) / box.scaleX;
+        d.y2 = (c.y2 - box.padY) / box.scaleY;
+        d.score = c.score;
+        d.label = kFaceLabel;
+        d.hasLandmarks = true;
+        for (int k = 0; k < 5; k++) {
+            d.landmarks[k][0] = (c.landmarks[k][0] - box.padX) / box.scaleX;
+            d.landmarks[k][1] = (c.landmarks[k][1] - box.padY) / box.scaleY;
+        }
+        detections.push_back(d);
+    }
+    detectionsTotal.add(detections.size());
+}
+
+void YunetDetector::decode() {
+    _candidates.clear();
+    _order.clear();
+    // _order is a heap with the weakest kept candidate on top. Once topK are kept a better one
+    // takes the weakest one's slot, so neither buffer grows past what the constructor reserved
+    auto weaker = [this](int a, int b) { return _candidates[a].score > _candidates[b].score; };
+    for (int s = 0; s < 3; s++) {
+        int stride = kStrides[s];
+        int cols = _inputWidth / stride;
+        int rows = _inputHeight / stride;
+        const float* cls = _outputs[_outputIndex[s][0]].ptr<float>();
+        const float* obj = _outputs[_outputIndex[s][1]].ptr<float>();
+        const float* bbox = _outputs[_outputIndex[s][2]].ptr<float>();
+        const float* kps = _outputs[_outputIndex[s][3]].ptr<float>();
+        if ((int)_outputs[_outputIndex[s][0]].total() != rows * cols) {
+            throw std::runtime_error("YunetDetector::decode - Unexpected output size for stride " + std::to_string(stride));
+        }
+
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                int i = r * cols + c;
+                float score = std::sqrt(std::min(1.f, std::max(0.f, cls[i])) * std::min(1.f, std::max(0.f, obj[i])));
+                if (score < _config.scoreThresh) continue;
+                bool full = (int)_candidates.size() == _config.topK;
+                if (full && score <= _candidates[_order.front()].score) continue;
+
+                // Centre as an offset from the cell, size in log space, both in units of the stride
+                Candidate candidate;
+                candidate.score = score;
+                float cx = (c + bbox[4 * i]) * stride;
+                float cy = (r + bbox[4 * i + 1]) * stride;
+                float w = std::exp(bbox[4 * i + 2]) * stride;
+                float h = std::exp(bbox[4 * i + 3]) * stride;
+                candidate.x1 = cx - w / 2;
+                candidate.y1 = cy - h / 2;
+                candidate.x2 = cx + w / 2;
+                candidate.y2 = cy + h / 2;
+                for (int k = 0; k < 5; k++) {
+                    candidate.landmarks[k][0] = (c + kps[10 * i + 2 * k]) * stride;
+                    candidate.landmarks[k][1] = (r + kps[10 * i + 2 * k + 1]) * stride;
+                }
+                if (full) {
+                    std::pop_heap(_order.begin(), _order.end(), weaker);
+                    _candidates[_order.back()] = candidate;
+                } else {
+                    _order.push_back(_candidates.size());
+                    _candidates.push_back(candidate);
+                }
+                std::push_heap(_order.begin(), _order.end(), weaker);
+            }
+        }
+    }
+}
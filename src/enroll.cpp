@@ -0,0 +1,101 @@
+// Enrolls face crops into a NameVault, creating or growing the vault as needed
+
+#include <iostream>
+
+#include <opencv2/opencv.hpp>
+#include <unistd.h>
+
+#include "NameVault.h"
+#include "Recognizer.h"
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{vault                   | ../res/names.vault | Vault to enroll into, created if missing}"
+        "{format                  | int8       | Embedding format for a new vault: int8 or fp16}"
+        "{capacity                | 1024       | Rows in a new vault; a full vault doubles}"
+        "{image i                 |            | Face crop to enroll as name}"
+        "{name n                  |            | Name for image}"
+        "{dir                     |            | Directory of face crops, each enrolled under its file name}"
+        "{recognizer_model        | ../res/face_recognition_sface_2021dec.onnx | Path to the SFace model}"
+        "{list                    | 0          | Print every enrolled name [1]}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+
+    std::string path = parser.get<std::string>("vault");
+
+    // Face crops paired with the names to enroll them under
+    std::vector<std::pair<std::string, std::string>> faces;
+    if (parser.has("image")) {
+        if (!parser.has("name")) {
+            std::cout << "Error - image needs a name" << std::endl;
+            return 1;
+        }
+        faces.push_back({parser.get<std::string>("name"), parser.get<std::string>("image")});
+    }
+    if (parser.has("dir")) {
+        std::vector<std::string> paths;
+        cv::glob(parser.get<std::string>("dir") + "/*", paths);
+        for (const std::string& image : paths) {
+            std::string name = image.substr(image.find_last_of('/') + 1);
+            faces.push_back({name.substr(0, name.find_last_of('.')), image});
+        }
+    }
+
+    try {
+        if (access(path.c_str(), F_OK) != 0) {
+            VaultFormat format = parser.get<std::string>("format") == "fp16" ? VaultFormat::Fp16 : VaultFormat::Int8;
+            NameVault::create(path, format, parser.get<int>("capacity"));
+            std::cout << "Created " << path << std::endl;
+        }
+
+        if (!faces.empty()) {
+            Recognizer recognizer(parser.get<std::string>("recognizer_model"));
+            std::unique_ptr<NameVault> vault = std::make_unique<NameVault>(path, true);
+            for (const auto& face : faces) {
+                cv::Mat image = cv::imread(face.second);
+                if (image.empty()) {
+                    std::cout << "Skipping " << face.second << ", not an image" << std::endl;
+                    continue;
+                }
+                // Crops are already the face, so the whole image is the box
+                Detections detections;
+                detections.resize(1);
+                detections[0].x1 = 0;
+                detections[0].y1 = 0;
+                detections[0].x2 = image.cols;
+                detections[0].y2 = image.rows;
+                detections[0].label = kFaceLabel;
+                recognizer.recognize(image, detections);
+
+                // A full vault is rewritten at twice the size and renamed over the old file, under
+                // the vault's lock so enrollers running alongside don't lose rows
+                size_t capacity = vault->capacity();
+                size_t row = vault->append(face.first, detections[0].embedding, true);
+                if (vault->capacity() != capacity) {
+                    std::cout << "Grew " << path << " to " << vault->capacity() << " rows" << std::endl;
+                }
+                std::cout << "Enrolled " << face.first << " as row " << row << std::endl;
+            }
+        }
+
+        NameVault vault(path);
+        if (parser.get<int>("list")) {
+            for (size_t i = 0; i < vault.size(); i++) {
+                const char* name = vault.name(i);
+                std::cout << i << " " << (name ? name : "(damaged)") << std::endl;
+            }
+        }
+        std::cout << path << " holds " << vault.size() << " of " << vault.capacity() << " identities ("
+                  << (vault.format() == VaultFormat::Int8 ? "int8" : "fp16") << ")" << std::endl;
+    } catch (std::runtime_error& e) {
+        std::cout << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+// Scans the detection event log and exports it as CSV or JSON, or lists its segments
+
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <stdio.h>
+
+#include <opencv2/core.hpp>
+
+#include "EventLog.h"
+
+// Unix seconds, or a UTC date with an optional time: 2026-10-17, 2026-10-17T08:30, 2026-10-17 08:30:15
+static bool parseTime(const std::string& text, int64_t& us) {
+    char* end;
+    double seconds = strtod(text.c_str(), &end);
+    if (!text.empty() && *end == '\0') {
+        us = (int64_t)(seconds * 1e6);
+        return true;
+    }
+    for (const char* format : {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d"}) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* rest = strptime(text.c_str(), format, &tm);
+        if (rest && (*rest == '\0' || *rest == 'Z')) {
+            us = (int64_t)timegm(&tm) * 1000000;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ISO 8601 UTC with milliseconds
+static const char* formatTime(int64_t us, char* out, size_t size) {
+    time_t seconds = us / 1000000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    size_t n = strftime(out, size, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(out + n, size - n, ".%03dZ", (int)(us % 1000000 / 1000));
+    return out;
+}
+
+// Names come from whoever enrolled them, so they're quoted for both formats
+static void writeQuoted(FILE* f, const char* text, bool json) {
+    fputc('"', f);
+    for (const char* c = text; *c; c++) {
+        if (*c == '"') fputs(json ? "\\\"" : "\"\"", f);
+        else if (json && *c == '\\') fputs("\\\\", f);
+        else if (json && (unsigned char)*c < 0x20) fprintf(f, "\\u%04x", *c);
+        else fputc(*c, f);
+    }
+    fputc('"', f);
+}
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{dir                     | ../events  | Event log directory}"
+        "{from                    |            | Earliest capture time: unix seconds or a UTC date, 2026-10-17T08:30:00}"
+        "{to                      |            | Latest capture time, in the same forms}"
+        "{format f                | csv        | csv, json, or list for one line per segment}"
+        "{name n                  |            | Only detections recognized as this name}"
+        "{source                  | -1         | Only frames from this source}"
+        "{output o                | -          | Where to write the export, - for stdout}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+
+    int64_t fromUs = INT64_MIN, toUs = INT64_MAX;
+    if ((parser.has("from") && !parseTime(parser.get<std::string>("from"), fromUs))
+        || (parser.has("to") && !parseTime(parser.get<std::string>("to"), toUs))) {
+        std::cout << "Error - Times are unix seconds or YYYY-MM-DD[THH:MM[:SS]]" << std::endl;
+        return 1;
+    }
+    std::string format = parser.get<std::string>("format");
+    if (format != "csv" && format != "json" && format != "list") {
+        std::cout << "Error - Unknown format " << format << std::endl;
+        return 1;
+    }
+    bool json = format == "json";
+    std::string name = parser.get<std::string>("name");
+    int source = parser.get<int>("source");
+
+    std::vector<std::string> paths;
+    try {
+        paths = EventLog::segments(parser.get<std::string>("dir"));
+    } catch (std::runtime_error& e) {
+        std::cout << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::string output = parser.get<std::string>("output");
+    FILE* f = output == "-" ? stdout : fopen(output.c_str(), "w");
+    if (!f) {
+        std::cout << "Error - Could not write " << output << std::endl;
+        return 1;
+    }
+    // Exports run to gigabytes; large writes keep the output from costing more than the scan
+    static char buffer[1 << 20];
+    setvbuf(f, buffer, _IOFBF, sizeof(buffer));
+
+    if (format == "csv") fputs("time,time_us,source,frame,detected,track,label,name,score,match_score,x1,y1,x2,y2\n", f);
+    if (json) fputs("[", f);
+
+    uint64_t frames = 0, detections = 0;
+    size_t scanned = 0, damaged = 0;
+    bool first = true;
+    char time[40];
+    for (const std::string& path : paths) {
+        try {
+            EventSegment segment(path);
+            const EventSegmentHeader& h = segment.header();
+            if (format == "list") {
+                fprintf(f, "%s  %s", path.c_str(), h.frames ? formatTime(h.minTimeUs, time, sizeof(time)) : "-");
+                fprintf(f, " .. %s  %llu frames, %llu detections, %.1f of %.1f MB\n", h.frames ? formatTime(h.maxTimeUs, time, sizeof(time)) : "-",
+                        (unsigned long long)h.frames, (unsigned long long)h.detections, h.used / 1e6, h.capacity / 1e6);
+                continue;
+            }
+            // Only the header has been read so far; a segment outside the range costs nothing more
+            if (!h.frames || h.maxTimeUs < fromUs || h.minTimeUs > toUs) continue;
+            scanned++;
+
+            const EventRecord* frame;
+            while (segment.next(frame)) {
+                if (frame->timeUs < fromUs || frame->timeUs > toUs || (source >= 0 && frame->source != source)) continue;
+                const LoggedDetection* d = segment.detections(frame);
+                bool any = false;
+                for (uint16_t i = 0; i < frame->count; i++) {
+                    const char* who = segment.text(d[i].name);
+                    if (!name.empty() && name != who) continue;
+                    if (!any) {
+                        formatTime(frame->timeUs, time, sizeof(time));
+                        if (json) {
+                            fprintf(f, "%s\n{\"time\": \"%s\", \"time_us\": %lld, \"source\": %u, \"frame\": %llu, \"detected\": %s, \"detections\": [",
+                                    first ? "" : ",", time, (long long)frame->timeUs, frame->source, (unsigned long long)frame->frameIndex,
+                                    frame->flags & kEventDetected ? "true" : "false");
+                        }
+                        first = false;
+                        frames++;
+                    }
+                    if (json) {
+                        fprintf(f, "%s{\"track\": %d, \"label\": ", any ? ", " : "", d[i].trackId);
+                        writeQuoted(f, segment.text(d[i].label), true);
+                        fputs(", \"name\": ", f);
+                        if (*who) writeQuoted(f, who, true);
+                        else fputs("null", f);
+                        fprintf(f, ", \"score\": %.4f, \"match_score\": %.4f, \"box\": [%u, %u, %u, %u]}",
+                                d[i].score / 65535.0, d[i].matchScore / 65535.0, d[i].x1, d[i].y1, d[i].x2, d[i].y2);
+                    } else {
+                        fprintf(f, "%s,%lld,%u,%llu,%d,%d,", time, (long long)frame->timeUs, frame->source,
+                                (unsigned long long)frame->frameIndex, frame->flags & kEventDetected ? 1 : 0, d[i].trackId);
+                        writeQuoted(f, segment.text(d[i].label), false);
+                        fputc(',', f);
+                        writeQuoted(f, who, false);
+                        fprintf(f, ",%.4f,%.4f,%u,%u,%u,%u\n", d[i].score / 65535.0, d[i].matchScore / 65535.0, d[i].x1, d[i].y1, d[i].x2, d[i].y2);
+                    }
+                    any = true;
+                    detections++;
+                }
+                if (!frame->count && name.empty()) {
+                    // Logged with events_empty; kept so gaps in the detections can be told from gaps in the log
+                    formatTime(frame->timeUs, time, sizeof(time));
+                    if (json) {
+                        fprintf(f, "%s\n{\"time\": \"%s\", \"time_us\": %lld, \"source\": %u, \"frame\": %llu, \"detected\": %s, \"detections\": []}",
+                                first ? "" : ",", time, (long long)frame->timeUs, frame->source, (unsigned long long)frame->frameIndex,
+                                frame->flags & kEventDetected ? "true" : "false");
+                    } else {
+                        fprintf(f, "%s,%lld,%u,%llu,%d,,,,,,,,,\n", time, (long long)frame->timeUs, frame->source,
+                                (unsigned long long)frame->frameIndex, frame->flags & kEventDetected ? 1 : 0);
+                    }
+                    first = false;
+                    frames++;
+                }
+                if (any && json) fputs("]}", f);
+            }
+            if (segment.damaged()) damaged++;
+        } catch (std::runtime_error& e) {
+            // One bad file shouldn't cost the rest of the export
+            std::cerr << "Skipping " << e.what() << std::endl;
+        }
+    }
+    if (json) fputs(first ? "]\n" : "\n]\n", f);
+
+    fflush(f);
+    if (f != stdout) fclose(f);
+    if (format != "list") {
+        // Kept off stdout, which may be carrying the export
+        std::cerr << "Exported " << frames << " frames, " << detections << " detections from " << scanned << " of " << paths.size() << " segments";
+        if (damaged) std::cerr << " (" << damaged << " cut short by a damaged record)";
+        std::cerr << std::endl;
+    }
+
+    return 0;
+}
@@ -4,103 +4,474 @@
 #include <opencv2/dnn.hpp>
 #include <opencv2/objdetect.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <future>
+#include <sstream>
 
 #include "VideoSource.h"
-#include "Display.h"
 #include "Detector.h"
+#include "YunetDetector.h"
+#include "Metrics.h"
+#include "Pipeline.h"
+#include "EventLog.h"
+#include "Recognizer.h"
+#include "Sink.h"
+#include "TiledDetector.h"
+
+static Histogram sinkSeconds("namevault_sink_seconds", "Displaying or reporting one frame's results");
+static Histogram frameLatencySeconds("namevault_frame_latency_seconds", "Capture to sink latency");
+static Counter framesProcessed("namevault_frames_processed_total", "Frames that reached the sink");
+static Gauge cameraReadySeconds("namevault_startup_seconds{phase=\"camera\"}", "Seconds from launch until each startup phase was done");
+static Gauge modelsReadySeconds("namevault_startup_seconds{phase=\"models\"}", "Seconds from launch until each startup phase was done");
+static Gauge firstDetectionSeconds("namevault_startup_seconds{phase=\"first_detection\"}", "Seconds from launch until each startup phase was done");
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// "cam<N>" names the Nth camera; anything else is a video file
+static bool cameraIndex(const std::string& spec, int& index) {
+    if (spec.size() <= 3 || spec.compare(0, 3, "cam") != 0) return false;
+    if (spec.find_first_not_of("0123456789", 3) != std::string::npos) return false;
+    index = std::stoi(spec.substr(3));
+    return true;
+}
+
+// What one source delivered to the sink
+struct StreamStats {
+    uint64_t frames = 0;
+    double latencyMs = 0;
+    double worstMs = 0;
+
+    void add(double ms) {
+        frames++;
+        latencyMs += ms;
+        worstMs = std::max(worstMs, ms);
+    }
+};
 
 int main(int argc, char** argv) {
 
+    auto launchTime = std::chrono::steady_clock::now();
+
     cv::CommandLineParser parser(argc, argv,
         "{help  h                 |            | Print this message}"
         "{video v                 | ../res/face_test.mp4 | Path to the input video}"
+        "{sources                 |            | Comma-separated inputs sharing the detector, cameras (cam0, cam1, ...) and video paths in any mix; empty is cam0 on the Pi and video elsewhere}"
+        "{pacing                  | deadline   | Video file replay: deadline, timestamp (container PTS) or unthrottled}"
+        "{loop                    | 0          | Loop the video file [1] or stop at the end [0]}"
+        "{fps                     | 0          | Video file replay rate, 0 for the rate stored in the container}"
         "{model_path m            | ../res/detect_tpu.tflite | Path to the model}"
         "{labels_path l           | ../res/labels.txt | Path to the labels}"
         "{confidence_threshold c  | 0.5        | Filter out detections of score < confidence_threshold}"
         "{use_tpu t               | true       | Use Coral accelerator for object detection}"
+        "{backend                 | tflite     | Detector: tflite, yunet, or auto to time both and keep the fastest that's accurate enough (needs a face model for tflite)}"
+        "{yunet_model             | ../res/face_detection_yunet_2023mar.onnx | Path to the YuNet model}"
+        "{yunet_width             | 320        | Width frames are scaled to for YuNet}"
+        "{accuracy_floor          | 0.8        | Share of the tflite detector's faces the auto-selected backend has to find}"
+        "{autoselect_frames       | 8          | Frames each backend is timed on when auto-selecting}"
+        "{threads                 | 3          | Threads for the CPU interpreter, 0 to time each count at startup and keep the fastest}"
+        "{xnnpack                 | 1          | Run the CPU interpreter through the XNNPACK delegate [1]}"
+        "{batch                   | 1          | Most frames the CPU interpreter detects in one inference, across sources}"
+        "{batch_wait_ms           | 5          | How long a batch waits for more frames after its first}"
+        "{swap_rb                 | 1          | Swap red and blue before inference, for RGB models fed BGR frames}"
+        "{letterbox               | 0          | Pad frames to the model's aspect ratio [1] instead of stretching [0]}"
+        "{pool                    | 0          | Spread inference over every Edge TPU found (if use_tpu) plus cpu_interpreters [1]}"
+        "{cpu_interpreters        | 0          | CPU interpreters in the detector pool}"
+        "{pool_threads            | 1          | Threads per CPU interpreter in the detector pool}"
+        "{dispatch                | least      | Detector pool dispatch: least (least loaded) or round (round robin)}"
+        "{track                   | 0          | Track faces between frames [1], so detection can skip frames}"
+        "{detect_every            | 1          | Run the detector every N frames while tracking}"
+        "{adaptive_cadence        | 0          | Ramp the detector from every frame up to detect_every while tracks are stable [1]}"
+        "{motion_gate             | 0          | Skip the detector on frames that barely differ from the background [1]}"
+        "{motion_cell             | 8          | Frame pixels per side of one motion cell}"
+        "{motion_threshold        | 10         | Luma change, 0-255, for a motion cell to count as changed}"
+        "{motion_sensitivity      | 0.005      | Share of cells that have to change for a frame to count as motion}"
+        "{motion_refresh          | 30         | Most frames in a row the motion gate can skip}"
+        "{tiles                   | 0          | Detect on overlapping full-resolution tiles instead of the whole frame scaled down [1]}"
+        "{tile_cols               | 2          | Tiles across the frame}"
+        "{tile_rows               | 2          | Tiles down the frame}"
+        "{tile_overlap            | 0.2        | Share of a tile overlapping its neighbour}"
+        "{tile_full_frame         | 1          | Also detect on the whole frame, for faces bigger than a tile [1]}"
+        "{tile_interpreters       | 1          | Detectors running tiles at once (CPU tflite and yunet only)}"
+        "{recognize r             | 0          | Embed and name every detected face [1]}"
+        "{recognizer_model        | ../res/face_recognition_sface_2021dec.onnx | Path to the SFace model}"
+        "{vault                   | ../res/names.vault | Identity vault written by nameVaultEnroll}"
+        "{match_threshold         | 0.363      | Cosine similarity needed to match a gallery face}"
+        "{recognize_batch         | 16         | Most faces embedded in one forward pass}"
+        "{recognize_labels        | face       | Comma-separated detection labels that are faces, empty for every detection; boxes with landmarks always are}"
+        "{recognition_cache       | 1          | Remember names per track and only recognize a track again when unsure or old [1]; needs track}"
+        "{cache_confident         | 0.5        | Cached match score that's trusted until it's old}"
+        "{cache_max_age           | 150        | Detector frames before a cached name is checked again}"
+        "{best_shot_window        | 3          | Detector frames of a track to pick the sharpest, most frontal crop from}"
+        "{match_threads           | 1          | Threads the exact gallery search is split over}"
+        "{ivf_min_rows            | 20000      | Use the approximate index for vaults with at least this many identities}"
+        "{ivf_probe               | 8          | Index lists scanned per face}"
         "{display d               | 1          | Display stream [1] or not [0]}"
+        "{buffers b               | 8          | Camera buffers that can be in flight through the pipeline}"
+        "{yuv                     | 0          | Capture YUV420 [1] instead of RGB888 [0], scaling and converting straight into the model input}"
+        "{queue_depth q           | 2          | Frames buffered between pipeline stages}"
+        "{capture_drop            | 0          | Drop new frames [1] instead of waiting [0] when inference falls behind}"
+        "{result_drop             | 0          | Drop new results [1] instead of waiting [0] when the display falls behind}"
+        "{record                  |            | Video file to write the annotated stream to; other sources get -<source> before the extension}"
+        "{record_fourcc           | mp4v       | Codec of the recorded video}"
+        "{console                 | -1         | Print every detection [1] or not [0]; -1 follows display}"
+        "{sink_depth              | 2          | Results each sink buffers before dropping the oldest}"
+        "{events                  |            | Directory to log every frame's detections to, for nameVaultLog}"
+        "{events_segment_mb       | 16         | Size an event log segment grows to before the next is started}"
+        "{events_max_mb           | 0          | Delete the oldest segments past this much log, 0 keeps everything}"
+        "{events_empty            | 0          | Log frames without detections too [1]}"
+        "{latest_frame            | 0          | Always run inference on the newest frame and drop the ones it missed [1]; replaces queue_depth and capture_drop before inference}"
+        "{adaptive_fps            | 0          | With latest_frame, lower the camera frame rate while frames keep going stale [1]}"
+        "{min_fps                 | 5          | Lowest frame rate adaptive_fps goes down to}"
+        "{metrics_file            |            | Prometheus text file to rewrite every metrics_interval ms}"
+        "{metrics_socket          |            | UNIX socket that serves the metrics to whoever connects}"
+        "{metrics_interval        | 5000       | Milliseconds between metrics file writes}"
     );
     if (parser.has("help")) {
         parser.printMessage();
         return 0;
     }
 
-    std::string fd_modelPath = "../res/face_detection_yunet_2023mar.onnx";
-    std::string fr_modelPath = "../res/face_recognition_sface_2021dec.onnx";
-
     // float scoreThreshold = parser.get<float>("score_threshold");
     // float nmsThreshold = parser.get<float>("nms_threshold");
     // int topK = parser.get<int>("top_k");
     bool showDisplay = parser.get<int>("display");
 
     cv::TickMeter tm;
-    Display display;
 
-    VideoSource* source;
-    Detector detector;
+    std::vector<std::unique_ptr<VideoSource>> sources;
+    std::vector<std::string> specs;
+    std::unique_ptr<Detector> detector;
+    std::unique_ptr<DetectorPool> pool;
+    std::unique_ptr<Recognizer> recognizer;
+    std::unique_ptr<NameVault> vault;
+    // What the cameras are asked for. Models warm up on the sizes the sources actually deliver
+    const cv::Size cameraSize(640, 480);
     try {
+        std::stringstream list(parser.get<std::string>("sources"));
+        for (std::string spec; std::getline(list, spec, ',');) {
+            if (!spec.empty()) specs.push_back(spec);
+        }
+        if (specs.empty()) {
         #ifdef CROSSCOMPILING
-            source = new LibCameraVideoSource(640, 480, 30);
+            specs.push_back("cam0");
         #else
-            source = new FileVideoSource(parser.get<std::string>("video"), 30);
+            specs.push_back(parser.get<std::string>("video"));
+        #endif
+        }
+        std::string pacingName = parser.get<std::string>("pacing");
+        Pacing pacing = Pacing::Deadline;
+        if (pacingName == "timestamp") pacing = Pacing::Timestamp;
+        else if (pacingName == "unthrottled") pacing = Pacing::Unthrottled;
+        else if (pacingName != "deadline") throw std::runtime_error("Unknown pacing " + pacingName);
+        bool loop = parser.get<int>("loop");
+        int fileFps = parser.get<int>("fps");
+        #ifdef CROSSCOMPILING
+            int buffers = parser.get<int>("buffers");
+            bool yuv = parser.get<int>("yuv");
         #endif
-        detector = Detector(parser.get<std::string>("model_path"), parser.get<std::string>("labels_path"), parser.get<float>("confidence_threshold"), parser.get<bool>("use_tpu"));
+
+        // Bringing the cameras up takes about as long as loading the models, so the two overlap
+        std::future<std::vector<std::unique_ptr<VideoSource>>> sourcesReady = std::async(std::launch::async, [=]() {
+            std::vector<std::unique_ptr<VideoSource>> opened;
+            for (const std::string& spec : specs) {
+                int index;
+                if (cameraIndex(spec, index)) {
+                #ifdef CROSSCOMPILING
+                    opened.push_back(std::make_unique<LibCameraVideoSource>(cameraSize.width, cameraSize.height, 30, buffers, index, yuv));
+                #else
+                    throw std::runtime_error("Camera source " + spec + " needs a libcamera build");
+                #endif
+                } else {
+                    opened.push_back(std::make_unique<FileVideoSource>(spec, fileFps, pacing, loop));
+                }
+            }
+            cameraReadySeconds.set(secondsSince(launchTime));
+            return opened;
+        });
+        // A size the detector has already run at, so warm-up can skip it
+        cv::Size warmedUp;
+        if (parser.get<int>("pool")) {
+            DetectorPoolConfig poolConfig;
+            poolConfig.useTpus = parser.get<bool>("use_tpu");
+            poolConfig.cpuInterpreters = parser.get<int>("cpu_interpreters");
+            poolConfig.threadsPerInterpreter = parser.get<int>("pool_threads");
+            poolConfig.xnnpack = parser.get<int>("xnnpack");
+            poolConfig.dispatch = parser.get<std::string>("dispatch") == "round" ? Dispatch::RoundRobin : Dispatch::LeastLoaded;
+            poolConfig.confidenceThresh = parser.get<float>("confidence_threshold");
+            poolConfig.swapRB = parser.get<int>("swap_rb");
+            poolConfig.letterbox = parser.get<int>("letterbox");
+            pool = std::make_unique<DetectorPool>(parser.get<std::string>("model_path"), parser.get<std::string>("labels_path"), poolConfig);
+        } else {
+            std::string backend = parser.get<std::string>("backend");
+            if (backend != "tflite" && backend != "yunet" && backend != "auto") throw std::runtime_error("Unknown backend " + backend);
+            // The tflite detector comes first, so auto-selection measures accuracy against it
+            std::vector<std::unique_ptr<Detector>> candidates;
+            if (backend != "yunet") {
+                TfliteCpuConfig cpu;
+                cpu.threads = parser.get<int>("threads");
+                cpu.xnnpack = parser.get<int>("xnnpack");
+                cpu.maxBatch = parser.get<int>("batch");
+                try {
+                    candidates.push_back(std::make_unique<TfliteDetector>(parser.get<std::string>("model_path"), parser.get<std::string>("labels_path"),
+                                                                          parser.get<float>("confidence_threshold"), parser.get<bool>("use_tpu"),
+                                                                          parser.get<int>("swap_rb"), parser.get<int>("letterbox"), cpu));
+                } catch (std::runtime_error& e) {
+                    if (backend != "auto") throw;
+                    std::cout << "Skipping the tflite detector - " << e.what() << std::endl;
+                }
+            }
+            if (backend != "tflite") {
+                YunetConfig yunetConfig;
+                yunetConfig.scoreThresh = parser.get<float>("confidence_threshold");
+                yunetConfig.inputWidth = parser.get<int>("yunet_width");
+                candidates.push_back(std::make_unique<YunetDetector>(parser.get<std::string>("yunet_model"), yunetConfig));
+            }
+            std::vector<cv::Mat> warmup;
+            if (candidates.size() > 1) {
+                sources = sourcesReady.get();
+                for (int i = 0; i < parser.get<int>("autoselect_frames"); i++) warmup.push_back(sources[0]->acquireFrame().writable().clone());
+            }
+            detector = Detector::select(std::move(candidates), warmup, parser.get<float>("accuracy_floor"));
+            // Selection already ran every candidate on real frames from the first source
+            if (!warmup.empty()) warmedUp = warmup[0].size();
+            if (parser.get<int>("tiles")) {
+                TilingConfig tiling;
+                tiling.enabled = true;
+                tiling.cols = parser.get<int>("tile_cols");
+                tiling.rows = parser.get<int>("tile_rows");
+                tiling.overlap = parser.get<float>("tile_overlap");
+                tiling.fullFrame = parser.get<int>("tile_full_frame");
+                std::string chosen = detector->name();
+                std::vector<std::unique_ptr<Detector>> tileDetectors;
+                tileDetectors.push_back(std::move(detector));
+                // The Edge TPU is one device, so extra interpreters are only made for the CPU backends
+                int extra = parser.get<int>("tile_interpreters") - 1;
+                if (extra > 0 && chosen == "tflite") {
+                    auto model = TfliteDetector::loadModel(parser.get<std::string>("model_path"));
+                    auto labels = TfliteDetector::loadLabels(parser.get<std::string>("labels_path"));
+                    TfliteCpuConfig cpu;
+                    cpu.threads = std::max(1, parser.get<int>("threads"));
+                    cpu.xnnpack = parser.get<int>("xnnpack");
+                    for (int i = 0; i < extra; i++) {
+                        tileDetectors.push_back(std::make_unique<TfliteDetector>(model, nullptr, labels, parser.get<float>("confidence_threshold"),
+                                                                                 parser.get<int>("swap_rb"), parser.get<int>("letterbox"), cpu));
+                    }
+                } else if (extra > 0 && chosen == "yunet") {
+                    YunetConfig yunetConfig;
+                    yunetConfig.scoreThresh = parser.get<float>("confidence_threshold");
+                    yunetConfig.inputWidth = parser.get<int>("yunet_width");
+                    for (int i = 0; i < extra; i++) tileDetectors.push_back(std::make_unique<YunetDetector>(parser.get<std::string>("yunet_model"), yunetConfig));
+                } else if (extra > 0) {
+                    std::cout << "Tiling on one " << chosen << " detector; extra interpreters are CPU only" << std::endl;
+                }
+                auto tiled = std::make_unique<TiledDetector>(std::move(tileDetectors), tiling);
+                // Tiles are smaller than the frame, so the interpreters see a new input size
+                warmedUp = cv::Size();
+                printf("Detecting on %zu tiles\n", tiled->tileCount());
+                detector = std::move(tiled);
+            }
+        }
+        if (parser.get<int>("recognize")) {
+            recognizer = std::make_unique<Recognizer>(parser.get<std::string>("recognizer_model"), parser.get<float>("match_threshold"), parser.get<int>("recognize_batch"));
+            recognizer->warmUp();
+            vault = std::make_unique<NameVault>(parser.get<std::string>("vault"));
+            MatcherConfig matcherConfig;
+            matcherConfig.threads = parser.get<int>("match_threads");
+            matcherConfig.ivfMinRows = parser.get<int>("ivf_min_rows");
+            matcherConfig.ivfProbe = parser.get<int>("ivf_probe");
+            recognizer->setVault(vault.get(), matcherConfig);
+            std::vector<std::string> faceLabels;
+            std::stringstream labelList(parser.get<std::string>("recognize_labels"));
+            for (std::string label; std::getline(labelList, label, ',');) {
+                if (!label.empty()) faceLabels.push_back(label);
+            }
+            recognizer->setLabels(faceLabels);
+            RecognitionCacheConfig cacheConfig;
+            cacheConfig.enabled = parser.get<int>("recognition_cache") && parser.get<int>("track");
+            cacheConfig.confidentScore = parser.get<float>("cache_confident");
+            cacheConfig.maxAge = parser.get<int>("cache_max_age");
+            cacheConfig.shotWindow = parser.get<int>("best_shot_window");
+            recognizer->setCache(cacheConfig);
+            std::cout << "Vault holds " << vault->size() << " identities" << std::endl;
+        }
+        if (sourcesReady.valid()) sources = sourcesReady.get();
+        // Once at each size the sources deliver, which only they know once they're open
+        std::vector<cv::Size> sizes;
+        for (const auto& source : sources) {
+            cv::Size size = source->getSize();
+            if (size != warmedUp && std::find(sizes.begin(), sizes.end(), size) == sizes.end()) sizes.push_back(size);
+        }
+        if (pool) {
+            pool->warmUp(sizes);
+        } else {
+            for (const cv::Size& size : sizes) detector->warmUp(size);
+        }
+        modelsReadySeconds.set(secondsSince(launchTime));
+        printf("Startup: camera ready after %.0f ms, models after %.0f ms\n", cameraReadySeconds.value() * 1000, modelsReadySeconds.value() * 1000);
     } catch (std::runtime_error& e) {
         std::cout << "Error - " << e.what() << std::endl;
         return 1;
     }
 
-    // cv::Ptr<cv::FaceDetectorYN> detector = cv::FaceDetectorYN::create(fd_modelPath, "", source->getSize());
-    // cv::Ptr<cv::FaceRecognizerSF> faceRecognizer = cv::FaceRecognizerSF::create(fr_modelPath, "");
+    PipelineConfig config;
+    config.captureDepth = parser.get<int>("queue_depth");
+    config.resultDepth = parser.get<int>("queue_depth");
+    config.captureDrop = parser.get<int>("capture_drop") ? DropPolicy::DropNewest : DropPolicy::Block;
+    config.resultDrop = parser.get<int>("result_drop") ? DropPolicy::DropNewest : DropPolicy::Block;
+    config.latestFrame = parser.get<int>("latest_frame");
+    config.adaptiveFrameRate = parser.get<int>("adaptive_fps");
+    config.minFrameRate = parser.get<double>("min_fps");
+    config.track = parser.get<int>("track");
+    config.detectEvery = parser.get<int>("detect_every");
+    config.adaptiveCadence = parser.get<int>("adaptive_cadence");
+    config.maxBatch = parser.get<int>("batch");
+    config.batchWaitMs = parser.get<double>("batch_wait_ms");
+    config.motionGate.enabled = parser.get<int>("motion_gate");
+    config.motionGate.cell = parser.get<int>("motion_cell");
+    config.motionGate.threshold = parser.get<int>("motion_threshold");
+    config.motionGate.sensitivity = parser.get<float>("motion_sensitivity");
+    config.motionGate.refreshEvery = parser.get<int>("motion_refresh");
 
-    int nFrame = 0;
-    while (true) {
-       
-        tm.start();
-
-        cv::Mat frame;
+    std::unique_ptr<MetricsExporter> exporter;
+    std::string metricsFile = parser.get<std::string>("metrics_file");
+    std::string metricsSocket = parser.get<std::string>("metrics_socket");
+    if (!metricsFile.empty() || !metricsSocket.empty()) {
         try {
-            source->getFrame(frame);
+            exporter = std::make_unique<MetricsExporter>(metricsFile, metricsSocket, std::chrono::milliseconds(parser.get<int>("metrics_interval")));
         } catch (std::runtime_error& e) {
             std::cout << "Error - " << e.what() << std::endl;
             return 1;
         }
+    }
 
-        // Inference
-        std::vector<Detection> detections = detector.detect(frame);
-        
-        // if (nFrame % 1 == 0) {
-        //     detector->detect(frame, faces);
+    std::vector<VideoSource*> inputs;
+    std::vector<std::string> windows;
+    for (size_t i = 0; i < sources.size(); i++) {
+        inputs.push_back(sources[i].get());
+        windows.push_back(sources.size() > 1 ? "Stream " + std::to_string(i) + " - " + specs[i] : "Stream");
+    }
 
-        //     // Aligning and cropping facial image through the first face of faces detected.
-        //     if (faces.rows > 0) {
-        //         cv::Mat aligned_face;
-        //         faceRecognizer->alignCrop(frame, faces.row(0), aligned_face);
+    // Display, recording and printing each run on their own thread, so none of them holds up the pipeline
+    SinkSet sinks;
+    size_t sinkDepth = std::max(1, parser.get<int>("sink_depth"));
+    int console = parser.get<int>("console");
+    std::string record = parser.get<std::string>("record");
+    try {
+        if (showDisplay) sinks.add(std::make_unique<DisplaySink>(windows, sinkDepth));
+        if (!record.empty()) {
+            sinks.add(std::make_unique<VideoFileSink>(record, sources[0]->frameRate(), parser.get<std::string>("record_fourcc"), sinkDepth * 2));
+        }
+        if (console < 0 ? showDisplay : console) sinks.add(std::make_unique<ConsoleSink>(sinkDepth * 4));
+    } catch (std::runtime_error& e) {
+        std::cout << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+    sinks.start();
 
-        //         // Run feature extraction with given aligned_face
-        //         cv::Mat feature;
-        //         faceRecognizer->feature(aligned_face, feature);
-        //         feature = feature.clone();
-        //     }
-        // }
+    std::unique_ptr<EventLog> events;
+    if (parser.has("events")) {
+        EventLogConfig eventConfig;
+        eventConfig.segmentBytes = (size_t)parser.get<int>("events_segment_mb") << 20;
+        eventConfig.maxBytes = (uint64_t)parser.get<int>("events_max_mb") << 20;
+        eventConfig.emptyFrames = parser.get<int>("events_empty");
+        try {
+            events = std::make_unique<EventLog>(parser.get<std::string>("events"), eventConfig);
+        } catch (std::runtime_error& e) {
+            std::cout << "Error - " << e.what() << std::endl;
+            return 1;
+        }
+        events->start();
+    }
+    std::unique_ptr<Pipeline> pipeline;
+    if (pool) {
+        pipeline = std::make_unique<Pipeline>(inputs, *pool, config);
+    } else {
+        pipeline = std::make_unique<Pipeline>(inputs, *detector, config);
+    }
+    pipeline->setRecognizer(recognizer.get());
+    pipeline->start();
+
+    int nFrame = 0;
+    FrameResult result;
+    std::vector<StreamStats> streamStats(sources.size());
+    std::vector<StreamStats> reported(sources.size());
+    auto lastReport = std::chrono::steady_clock::now();
+    auto runStart = lastReport;
+    tm.start();
+    while (pipeline->next(result)) {
 
+        // Throughput of the whole pipeline, measured at the sink
         tm.stop();
+        auto latency = std::chrono::steady_clock::now() - result.captureTime;
+        frameLatencySeconds.observe(latency);
+        streamStats[result.source].add(std::chrono::duration<double, std::milli>(latency).count());
+        framesProcessed.add();
+        if (result.detected && firstDetectionSeconds.value() == 0) {
+            firstDetectionSeconds.set(secondsSince(launchTime));
+            printf("Time to first detection: %.0f ms\n", firstDetectionSeconds.value() * 1000);
+        }
 
-        if (showDisplay) {
-            if (display.show(frame, detections, tm.getFPS()))
-                break;
-        } else {
-            std::cout << "FPS: " << tm.getFPS() << std::endl;
+        {
+            ScopedTimer timer(sinkSeconds);
+            if (events) events->record(result);
+            sinks.publish(result, tm.getFPS());
+            if (sinks.quitRequested()) break;
+            if (!showDisplay && std::chrono::steady_clock::now() - lastReport >= std::chrono::seconds(1)) {
+                // Once a second is plenty on a headless unit; the metrics carry the detail
+                double seconds = secondsSince(lastReport);
+                lastReport = std::chrono::steady_clock::now();
+                std::cout << "FPS: " << tm.getFPS() << std::endl;
+                for (size_t i = 0; sources.size() > 1 && i < sources.size(); i++) {
+                    uint64_t frames = streamStats[i].frames - reported[i].frames;
+                    double latencyMs = streamStats[i].latencyMs - reported[i].latencyMs;
+                    printf("  stream %zu: %.1f fps, %.1f ms latency\n", i, frames / seconds, frames ? latencyMs / frames : 0.0);
+                    reported[i] = streamStats[i];
+                }
+            }
         }
 
+        tm.start();
         ++nFrame;
     }
+    pipeline->stop();
+    sinks.stop();
+    if (events) {
+        events->stop();
+        std::cout << "Event log: " << events->logged() << " frames, " << events->dropped() << " dropped" << std::endl;
+    }
+
+    if (pipeline->failed()) {
+        std::cout << "Error - " << pipeline->error() << std::endl;
+    }
+    if (pipeline->captureDropped() || pipeline->resultDropped()) {
+        std::cout << "Dropped " << pipeline->captureDropped() << " captured frames and " << pipeline->resultDropped() << " results" << std::endl;
+    }
+    if (pipeline->staleDropped()) {
+        std::cout << "Skipped " << pipeline->staleDropped() << " stale frames to stay on the newest" << std::endl;
+    }
+    double runSeconds = secondsSince(runStart);
+    for (size_t i = 0; sources.size() > 1 && i < sources.size(); i++) {
+        const StreamStats& stats = streamStats[i];
+        printf("Stream %zu (%s): %llu frames, %.1f fps, latency %.1f ms mean / %.1f ms worst, %llu dropped\n", i, specs[i].c_str(),
+               (unsigned long long)stats.frames, stats.frames / runSeconds, stats.frames ? stats.latencyMs / stats.frames : 0.0,
+               stats.worstMs, (unsigned long long)pipeline->dropped(i));
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        const Sink& sink = sinks.sink(i);
+        std::cout << "Sink " << sink.name() << ": " << sink.consumed() << " frames, " << sink.dropped() << " dropped" << std::endl;
+    }
+    if (pool) {
+        for (size_t i = 0; i < pool->size(); i++) {
+            std::cout << "Worker " << pool->workerName(i) << " processed " << pool->workerProcessed(i) << " frames" << std::endl;
+        }
+    }
 
     std::cout << "Processed " << nFrame << " frames" << std::endl;
-    delete source;
     std::cout << "Done." << std::endl;
 
-    return 0;
+    return pipeline->failed() ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,213 @@
+// Replays a clip and counts the heap allocations made per frame once warmed up, decode
+// included. First serially, stage by stage, so an allocation can be pinned on a stage; then
+// through the threaded Pipeline with tracking and recognition, so the queue and mailbox
+// hand-offs, the tracker's filled-in frames and the recognizer are covered too. Fails if any
+// frame after warm-up allocates. Skipped (exit code 77) when the clip or the models aren't there
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <iostream>
+#include <malloc.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "Detector.h"
+#include "Display.h"
+#include "Pipeline.h"
+#include "Recognizer.h"
+#include "Tracker.h"
+#include "VideoSource.h"
+
+static const int kSkip = 77;
+
+static std::atomic<uint64_t> allocations{0};
+
+#ifdef __GLIBC__
+
+// Every allocation in the process lands here, operator new included, and goes on to glibc's own
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    void* p = memalign(alignment, size);
+    if (!p) return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+}
+
+#endif
+
+// Allocations made by one stage across the measured frames
+struct StageCount {
+    const char* name;
+    uint64_t total = 0;
+    uint64_t worstFrame = 0;
+
+    void add(uint64_t n) {
+        total += n;
+        worstFrame = std::max(worstFrame, n);
+    }
+};
+
+static bool exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+int main(int argc, char** argv) {
+
+    cv::CommandLineParser parser(argc, argv,
+        "{help  h                 |            | Print this message}"
+        "{video v                 | ../res/face_test.mp4 | Clip to replay, looped as needed}"
+        "{model_path m            | ../res/detect_tpu.tflite | Path to the model}"
+        "{labels_path l           | ../res/labels.txt | Path to the labels}"
+        "{confidence_threshold c  | 0.5        | Filter out detections of score < confidence_threshold}"
+        "{use_tpu t               | false      | Use Coral accelerator for object detection}"
+        "{recognizer_model        | ../res/face_recognition_sface_2021dec.onnx | SFace model; empty leaves recognition out}"
+        "{frames n                | 300        | Frames to check}"
+        "{warmup w                | 30         | Frames to run before checking, while buffers settle}"
+        "{detect_every            | 2          | Detector cadence in the pipeline pass, so tracked frames are covered}"
+    );
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+
+#ifndef __GLIBC__
+    std::cerr << "Counting allocations needs glibc, skipping" << std::endl;
+    return kSkip;
+#endif
+
+    int frames = parser.get<int>("frames");
+    int warmup = parser.get<int>("warmup");
+    std::string video = parser.get<std::string>("video");
+    std::string modelPath = parser.get<std::string>("model_path");
+    std::string recognizerModel = parser.get<std::string>("recognizer_model");
+    for (const std::string& path : {video, modelPath, parser.get<std::string>("labels_path"), recognizerModel}) {
+        if (!path.empty() && !exists(path)) {
+            std::cerr << path << " isn't there, skipping" << std::endl;
+            return kSkip;
+        }
+    }
+
+    StageCount capture{"capture"};
+    StageCount detect{"detect"};
+    StageCount tracking{"track"};
+    StageCount recognition{"recognize"};
+    StageCount draw{"draw"};
+    StageCount release{"release"};
+    StageCount pipelined{"pipeline"};
+
+    try {
+        TfliteDetector detector(modelPath, parser.get<std::string>("labels_path"), parser.get<float>("confidence_threshold"), parser.get<bool>("use_tpu"));
+        std::unique_ptr<Recognizer> recognizer;
+        if (!recognizerModel.empty()) {
+            recognizer = std::make_unique<Recognizer>(recognizerModel);
+            RecognitionCacheConfig cache;
+            cache.enabled = true;
+            recognizer->setCache(cache);
+        }
+        Display display(false);
+        cv::Mat canvas;
+
+        // Stage by stage on this thread
+        {
+            FileVideoSource source(video, 0, Pacing::None, true);
+            Tracker tracker;
+            Detections detections;
+            for (int i = 0; i < warmup + frames; i++) {
+                bool measured = i >= warmup;
+
+                uint64_t before = allocations.load();
+                FrameLease frame = source.acquireFrame();
+                uint64_t afterCapture = allocations.load();
+                detector.detect(frame.image(), detections);
+                uint64_t afterDetect = allocations.load();
+                tracker.update(detections);
+                uint64_t afterTrack = allocations.load();
+                if (recognizer) recognizer->recognize(frame.image(), detections);
+                uint64_t afterRecognize = allocations.load();
+                cv::Mat image = frame.writable(canvas);
+                display.visualize(image, detections, 0);
+                image.release();
+                uint64_t afterDraw = allocations.load();
+                frame.reset();
+                uint64_t afterRelease = allocations.load();
+
+                if (!measured) continue;
+                capture.add(afterCapture - before);
+                detect.add(afterDetect - afterCapture);
+                tracking.add(afterTrack - afterDetect);
+                recognition.add(afterRecognize - afterTrack);
+                draw.add(afterDraw - afterRecognize);
+                release.add(afterRelease - afterDraw);
+            }
+        }
+
+        // The same through the pipeline's threads, counted between the results it hands out
+        {
+            FileVideoSource source(video, 0, Pacing::None, true);
+            PipelineConfig config;
+            config.track = true;
+            config.detectEvery = std::max(1, parser.get<int>("detect_every"));
+            Pipeline pipeline(source, detector, config);
+            pipeline.setRecognizer(recognizer.get());
+            pipeline.start();
+            FrameResult result;
+            uint64_t before = 0;
+            for (int i = 0; i < warmup + frames && pipeline.next(result); i++) {
+                cv::Mat image = result.frame.writable(canvas);
+                display.visualize(image, result.detections, 0);
+                image.release();
+                result.frame.reset();
+                uint64_t now = allocations.load();
+                if (i >= warmup) pipelined.add(now - before);
+                before = now;
+            }
+            pipeline.stop();
+            if (pipeline.failed()) throw std::runtime_error(pipeline.error());
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << "Error - " << e.what() << std::endl;
+        return 1;
+    }
+
+    bool clean = true;
+    for (const StageCount* stage : {&capture, &detect, &tracking, &recognition, &draw, &release, &pipelined}) {
+        printf("%-10s %8.2f allocations/frame, worst frame %llu%s\n", stage->name, (double)stage->total / frames,
+               (unsigned long long)stage->worstFrame, stage->total ? "  FAIL" : "");
+        if (stage->total) clean = false;
+    }
+    return clean ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// The one assertion the tests in tests/ need: report where and exit non-zero, so ctest fails
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
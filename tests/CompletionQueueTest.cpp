@@ -0,0 +1,99 @@
+// CompletionQueue on x86: the fd stays readable while items wait, and a simulated camera
+// completion thread wakes a consumer blocked on it. Prints the wake latency it measured
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include "Check.h"
+#include "CompletionQueue.h"
+
+struct Completion {
+    uint64_t sequence = 0;
+    std::chrono::steady_clock::time_point pushed;
+};
+
+static bool readable(int fd, int timeoutMs) {
+    pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, timeoutMs) == 1 && (pfd.revents & POLLIN);
+}
+
+int main() {
+
+    // Several completions queued: each pop takes one, and the fd stays readable until the last
+    {
+        CompletionQueue<Completion> queue(8);
+        for (uint64_t i = 0; i < 3; i++) {
+            Completion c;
+            c.sequence = i;
+            CHECK(queue.push(c));
+        }
+        Completion c;
+        for (uint64_t i = 0; i < 3; i++) {
+            CHECK(readable(queue.fd(), 0));
+            CHECK(queue.pop(c, 0));
+            CHECK(c.sequence == i);
+        }
+        CHECK(!readable(queue.fd(), 0));
+        CHECK(!queue.pop(c, 0));
+    }
+
+    // A completion thread delivering bursts, as a camera does when the consumer falls behind.
+    // The consumer only ever sleeps in poll() on the fd, as a caller of frameFd() would
+    {
+        const uint64_t kCompletions = 2000;
+        const int kBurst = 4;
+        CompletionQueue<Completion> queue(64);
+        std::thread camera([&] {
+            for (uint64_t i = 0; i < kCompletions; i++) {
+                Completion c;
+                c.sequence = i;
+                c.pushed = std::chrono::steady_clock::now();
+                while (!queue.push(c)) std::this_thread::yield();
+                if (i % kBurst == kBurst - 1) std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        });
+
+        std::vector<double> wakeUs;
+        Completion c;
+        for (uint64_t expected = 0; expected < kCompletions; expected++) {
+            // A second without the fd turning readable means items are stuck behind it
+            CHECK(readable(queue.fd(), 1000));
+            CHECK(queue.pop(c, 0));
+            CHECK(c.sequence == expected);
+            wakeUs.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - c.pushed).count());
+        }
+        camera.join();
+        CHECK(!readable(queue.fd(), 0));
+
+        std::sort(wakeUs.begin(), wakeUs.end());
+        double sum = 0;
+        for (double us : wakeUs) sum += us;
+        printf("Wake latency over %zu completions: %.1f us mean, %.1f us p50, %.1f us p99, %.1f us max\n", wakeUs.size(),
+               sum / wakeUs.size(), wakeUs[wakeUs.size() / 2], wakeUs[wakeUs.size() * 99 / 100], wakeUs.back());
+    }
+
+    // pop() with a timeout gives up on an empty queue, and wakes for a late push
+    {
+        CompletionQueue<Completion> queue(4);
+        Completion c;
+        auto start = std::chrono::steady_clock::now();
+        CHECK(!queue.pop(c, 20));
+        CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+        std::thread late([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            Completion l;
+            l.sequence = 7;
+            queue.push(l);
+        });
+        CHECK(queue.pop(c, -1));
+        CHECK(c.sequence == 7);
+        late.join();
+    }
+
+    printf("CompletionQueue tests passed\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+// EventLog: frames come back out of a segment as they went in, stamped on the system clock,
+// and retention deletes by the times inside the segments rather than by their names
+//
+// Usage: eventLogTest [dir], a scratch directory under /tmp by default
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Check.h"
+#include "EventLog.h"
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char** argv) {
+
+    std::string dir = argc > 1 ? argv[1] : "/tmp/eventLogTest-" + std::to_string(getpid());
+    EventLogConfig config;
+    config.segmentBytes = 64 << 10;
+    // Room for one segment as written and not two
+    config.maxBytes = 100 << 10;
+    EventLog log(dir, config);
+    for (const std::string& path : EventLog::segments(dir)) unlink(path.c_str());
+
+    // A segment whose name sorts after any the log will write, with frames from long ago in it,
+    // as a clock stepped back since would leave
+    std::string stale = dir + "/events-99999999999999999.nvlog";
+    EventSegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "NVEVENT", 8);
+    header.version = EventLog::kVersion;
+    header.headerBytes = 4096;
+    header.minTimeUs = 1;
+    header.maxTimeUs = 2;
+    header.frames = 1;
+    int fd = open(stale.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    CHECK(fd >= 0);
+    CHECK(write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header));
+    CHECK(ftruncate(fd, 68 << 10) == 0);
+    close(fd);
+
+    int64_t before = nowUs();
+    log.start();
+    FrameResult result;
+    result.index = 7;
+    result.source = 1;
+    result.detected = true;
+    result.captureTime = std::chrono::steady_clock::now();
+    for (int k = 0; k < 3; k++) {
+        Detection d;
+        d.x1 = 10.f * k;
+        d.y1 = -4;
+        d.x2 = 70000;
+        d.y2 = 100.6f;
+        d.score = 0.5f;
+        d.matchScore = 0.25f;
+        d.trackId = k;
+        d.label = "face";
+        d.name = k == 1 ? "alice" : nullptr;
+        result.detections.push_back(d);
+    }
+    CHECK(log.record(result));
+    log.stop();
+    int64_t after = nowUs();
+    CHECK(log.logged() == 1 && log.dropped() == 0);
+
+    std::vector<std::string> paths = EventLog::segments(dir);
+    CHECK(paths.size() == 1 && paths[0] != stale);
+    EventSegment segment(paths[0]);
+    const EventRecord* frame;
+    CHECK(segment.next(frame));
+    CHECK(frame->frameIndex == 7 && frame->source == 1 && (frame->flags & kEventDetected));
+    int64_t timeUs = frame->timeUs;
+    CHECK(timeUs >= before && timeUs <= after);
+    CHECK(frame->count == 3);
+    const LoggedDetection* d = segment.detections(frame);
+    for (int k = 0; k < 3; k++) {
+        CHECK(d[k].x1 == 10 * k && d[k].y1 == 0 && d[k].x2 == 65535 && d[k].y2 == 101);
+        CHECK(std::abs(d[k].score - 32768) <= 1 && std::abs(d[k].matchScore - 16384) <= 1);
+        CHECK(d[k].trackId == k);
+        CHECK(strcmp(segment.text(d[k].label), "face") == 0);
+        CHECK(strcmp(segment.text(d[k].name), k == 1 ? "alice" : "") == 0);
+    }
+    CHECK(!segment.next(frame) && !segment.damaged());
+    CHECK(segment.header().frames == 1 && segment.header().minTimeUs == timeUs);
+
+    unlink(paths[0].c_str());
+    rmdir(dir.c_str());
+    return 0;
+}
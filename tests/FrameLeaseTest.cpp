@@ -0,0 +1,138 @@
+// FrameLease over a stand-in buffer pool: frames pass through the stages' hand-offs without a
+// pixel being copied, and a buffer goes back on the free list when, and only when, the last
+// lease on it is let go
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "Check.h"
+#include "CompletionQueue.h"
+#include "FrameLease.h"
+#include "SpscQueue.h"
+
+// Lends out fixed buffers the way the camera and file pools do, counting what comes back
+struct FakePool {
+    struct Claim : FrameClaim {
+        FakePool* owner;
+        std::vector<uint8_t> pixels;
+
+        void release() override {
+            owner->released++;
+            owner->free.push(this);
+        }
+    };
+
+    static const int kWidth = 64, kHeight = 48;
+
+    explicit FakePool(size_t count) : free(count) {
+        for (size_t i = 0; i < count; i++) {
+            claims.push_back(std::make_unique<Claim>());
+            claims.back()->owner = this;
+            claims.back()->pixels.assign(kWidth * kHeight * 3, 0);
+            free.push(claims.back().get());
+        }
+    }
+
+    // A lease on the next free buffer, or an empty lease if every buffer is out
+    FrameLease lease(bool readOnly = false) {
+        Claim* claim;
+        if (!free.tryPop(claim)) return FrameLease();
+        cv::Mat image(kHeight, kWidth, CV_8UC3, claim->pixels.data());
+        return FrameLease(image, claim, readOnly);
+    }
+
+    std::vector<std::unique_ptr<Claim>> claims;
+    CompletionQueue<Claim*> free;
+    int released = 0;
+};
+
+static bool inPool(const FakePool& pool, const uint8_t* data) {
+    for (const auto& claim : pool.claims) {
+        if (data == claim->pixels.data()) return true;
+    }
+    return false;
+}
+
+int main() {
+
+    // One frame through capture -> inference -> results -> sink: every stage sees the pool's pixels
+    {
+        FakePool pool(2);
+        SpscQueue<FrameLease> captured(4), results(4);
+        FrameLease frame = pool.lease();
+        const uint8_t* pixels = frame.image().data;
+        CHECK(frame.borrowed() && frame.holders() == 1);
+
+        CHECK(captured.tryPush(std::move(frame)));
+        CHECK(frame.empty() && !frame.borrowed());
+
+        FrameLease inference;
+        CHECK(captured.tryPop(inference));
+        CHECK(inference.image().data == pixels);
+        FrameLease kept = inference;  // the tracker keeping a reference alongside the result
+        CHECK(inference.holders() == 2);
+        CHECK(results.tryPush(std::move(inference)));
+
+        FrameLease sink;
+        CHECK(results.tryPop(sink));
+        CHECK(sink.image().data == pixels);
+        // Writable leases draw in place rather than copying
+        cv::Mat scratch;
+        CHECK(sink.writable(scratch).data == pixels);
+        CHECK(sink.writable().data == pixels);
+        CHECK(scratch.empty());
+
+        CHECK(pool.released == 0);
+        sink.reset();
+        CHECK(pool.released == 0 && kept.holders() == 1);
+        kept = FrameLease();
+        // The last lease going away is what puts the buffer back
+        CHECK(pool.released == 1);
+        FakePool::Claim* claim;
+        bool returned = false;
+        while (pool.free.tryPop(claim)) returned = returned || claim->pixels.data() == pixels;
+        CHECK(returned);
+    }
+
+    // A steady stream through a two-buffer pool never copies and never runs the pool dry
+    {
+        FakePool pool(2);
+        FrameLease previous;
+        for (int i = 0; i < 1000; i++) {
+            FrameLease frame = pool.lease();
+            CHECK(!frame.empty());
+            CHECK(inPool(pool, frame.image().data));
+            memset(frame.writable().data, i & 0xff, 3);
+            previous = std::move(frame);
+        }
+        previous.reset();
+        CHECK(pool.released == 1000);
+        FakePool::Claim* claim;
+        int available = 0;
+        while (pool.free.tryPop(claim)) available++;
+        CHECK(available == 2);
+    }
+
+    // Read-only buffers are the one case that copies, and only into the caller's scratch
+    {
+        FakePool pool(1);
+        FrameLease frame = pool.lease(true);
+        const uint8_t* pixels = frame.image().data;
+        cv::Mat scratch;
+        cv::Mat drawn = frame.writable(scratch);
+        CHECK(drawn.data != pixels && drawn.data == scratch.data);
+        // Self-assignment and assigning a lease on the same buffer keep the claim alive
+        FrameLease& alias = frame;
+        frame = alias;
+        FrameLease same = frame;
+        frame = same;
+        CHECK(frame.holders() == 2 && pool.released == 0);
+        same.reset();
+        frame.reset();
+        CHECK(pool.released == 1);
+    }
+
+    printf("FrameLease tests passed\n");
+    return 0;
+}
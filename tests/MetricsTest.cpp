@@ -0,0 +1,55 @@
+// renderMetrics: labelled series registered out of order still come out under one HELP/TYPE
+// per family, for counters and gauges alike, and the values are summed across threads
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "Check.h"
+#include "Metrics.h"
+
+static Counter aDropped("test_dropped_total{stage=\"a\"}", "Frames dropped");
+static Gauge aDepth("test_depth{queue=\"a\"}", "Frames waiting");
+static Counter captured("test_captured_total", "Frames captured");
+static Gauge rate("test_rate", "Frames a second");
+static Counter bDropped("test_dropped_total{stage=\"b\"}", "Frames dropped");
+static Gauge bDepth("test_depth{queue=\"b\"}", "Frames waiting");
+
+static size_t occurrences(const std::string& text, const std::string& what) {
+    size_t n = 0;
+    for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) n++;
+    return n;
+}
+
+int main() {
+
+    aDropped.add(2);
+    std::thread other([]() { aDropped.add(3); });
+    other.join();
+    bDropped.add();
+    aDepth.set(4);
+    bDepth.set(1);
+
+    std::string text = renderMetrics();
+    CHECK(occurrences(text, "# TYPE test_dropped_total counter\n") == 1);
+    CHECK(occurrences(text, "# TYPE test_depth gauge\n") == 1);
+    CHECK(occurrences(text, "# HELP test_depth ") == 1);
+    CHECK(text.find("test_dropped_total{stage=\"a\"} 5\n") != std::string::npos);
+
+    // Each family's series follow its TYPE line with no other family in between
+    size_t type = text.find("# TYPE test_depth gauge\n");
+    size_t a = text.find("test_depth{queue=\"a\"} 4\n");
+    size_t b = text.find("test_depth{queue=\"b\"} 1\n");
+    size_t between = text.find("test_rate", type);
+    CHECK(a != std::string::npos && b != std::string::npos);
+    CHECK(type < a && type < b);
+    CHECK(between == std::string::npos || between > std::max(a, b));
+
+    type = text.find("# TYPE test_dropped_total counter\n");
+    size_t dropped = text.find("test_dropped_total{stage=\"b\"} 1\n");
+    between = text.find("test_captured_total", type);
+    CHECK(type < dropped);
+    CHECK(between == std::string::npos || between > dropped);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// MotionGate: sensor noise and slow lighting drift on a still scene don't count as motion, a
+// small object moving does, and grey and BGR frames of the same scene see the same cells change
+// at widths that leave the vectorised column sum a scalar tail
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "Check.h"
+#include "MotionGate.h"
+
+// A still scene as a camera sees it: a fixed pattern, a brightness offset, noise of a few levels,
+// and optionally a bright square
+struct Scene {
+    int width, height, channels;
+    std::vector<uint8_t> pixels;
+    uint32_t seed = 1;
+
+    Scene(int w, int h, int c) : width(w), height(h), channels(c), pixels((size_t)w * h * c) {}
+
+    cv::Mat render(int brightness, int squareX = -1, int squareY = 0, int squareSide = 64) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                seed = seed * 1664525u + 1013904223u;
+                int noise = (int)(seed >> 29) - 4;
+                bool square = squareX >= 0 && x >= squareX && x < squareX + squareSide && y >= squareY && y < squareY + squareSide;
+                int v = square ? 240 : 40 + (x / 40 + y / 30) % 5 * 20 + brightness + noise;
+                v = v < 0 ? 0 : v > 255 ? 255 : v;
+                for (int c = 0; c < channels; c++) pixels[((size_t)y * width + x) * channels + c] = (uint8_t)v;
+            }
+        }
+        return cv::Mat(height, width, channels == 1 ? CV_8UC1 : CV_8UC3, pixels.data());
+    }
+};
+
+int main() {
+
+    for (int width : {640, 330}) {
+        int height = width * 3 / 4;
+        Scene grey(width, height, 1), bgr(width, height, 3);
+        MotionGate greyGate, bgrGate;
+
+        // The first frame only primes the background
+        CHECK(greyGate.changed(grey.render(0)));
+        CHECK(bgrGate.changed(bgr.render(0)));
+
+        // Noise and a drift of a level every ten frames stay under the threshold
+        for (int frame = 0; frame < 100; frame++) {
+            CHECK(!greyGate.changed(grey.render(frame / 10)));
+            CHECK(!bgrGate.changed(bgr.render(frame / 10)));
+        }
+
+        // A square a sixth of the frame's height, moving across it
+        for (int frame = 0; frame < 5; frame++) {
+            int x = 20 + frame * 50;
+            CHECK(greyGate.changed(grey.render(10, x, 40, height / 6)));
+            CHECK(bgrGate.changed(bgr.render(10, x, 40, height / 6)));
+            CHECK(greyGate.changedShare() == bgrGate.changedShare());
+        }
+    }
+
+    // New geometry drops the old background rather than comparing against it
+    MotionGate gate;
+    Scene small(320, 240, 3), large(640, 480, 3);
+    CHECK(gate.changed(small.render(0)));
+    CHECK(!gate.changed(small.render(0)));
+    CHECK(gate.changed(large.render(0)));
+    CHECK(gate.changedShare() == 1);
+
+    return 0;
+}
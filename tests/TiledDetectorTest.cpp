@@ -0,0 +1,77 @@
+// TiledDetector's merge: overlapping boxes with the same label are one object, and a box cut
+// off by a seam grows the better one, but a face inside a person box is kept as a face
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include "Check.h"
+#include "TiledDetector.h"
+
+// Finds the same boxes in whatever it's given. Labels live in the detector, as they do in
+// TfliteDetector, so two fakes give the same label as different pointers
+class FakeDetector : public Detector {
+public:
+
+    FakeDetector() : _face("face"), _person("person") {}
+
+    void detect(const cv::Mat&, Detections& detections) override {
+        detections.clear();
+        detections.push_back(box(0, 0, 200, 400, 0.9f, _person.c_str()));
+        detections.push_back(box(50, 20, 110, 90, 0.8f, _face.c_str()));
+        detections.push_back(box(300, 100, 380, 200, 0.7f, _face.c_str()));
+        detections.push_back(box(304, 104, 384, 204, 0.6f, _otherFace));
+        detections.push_back(box(300, 100, 340, 210, 0.5f, _otherFace));
+    }
+    void detectBatch(const cv::Mat* frames, size_t count, Detections* detections) override {
+        for (size_t i = 0; i < count; i++) detect(frames[i], detections[i]);
+    }
+    const char* name() const override { return "fake"; }
+    bool hasLabel(const char* label) const override { return _face == label || _person == label; }
+
+private:
+
+    static Detection box(float x1, float y1, float x2, float y2, float score, const char* label) {
+        Detection d;
+        d.x1 = x1;
+        d.y1 = y1;
+        d.x2 = x2;
+        d.y2 = y2;
+        d.score = score;
+        d.label = label;
+        return d;
+    }
+
+    std::string _face;
+    std::string _person;
+    char _otherFace[5] = {'f', 'a', 'c', 'e', '\0'};
+
+};
+
+int main() {
+
+    // One tile covering the frame, so every box reaches the merge once
+    TilingConfig config;
+    config.cols = 1;
+    config.rows = 1;
+    config.fullFrame = false;
+    std::vector<std::unique_ptr<Detector>> detectors;
+    detectors.push_back(std::make_unique<FakeDetector>());
+    TiledDetector tiled(std::move(detectors), config);
+
+    cv::Mat frame(480, 640, CV_8UC3, cv::Scalar(0, 0, 0));
+    Detections detections;
+    tiled.detect(frame, detections);
+
+    CHECK(detections.size() == 3);
+    const Detection& person = detections[0];
+    const Detection& inside = detections[1];
+    const Detection& merged = detections[2];
+    CHECK(std::string(person.label) == "person" && person.x2 == 200 && person.y2 == 400);
+    CHECK(std::string(inside.label) == "face" && inside.x1 == 50 && inside.y2 == 90);
+    // The shifted duplicate and the cut-off box are folded into the best of the three
+    CHECK(std::string(merged.label) == "face" && merged.score == 0.7f);
+    CHECK(merged.x1 == 300 && merged.y1 == 100 && merged.x2 == 384 && merged.y2 == 210);
+
+    return 0;
+}
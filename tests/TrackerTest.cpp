@@ -0,0 +1,63 @@
+// Tracker: a name recognition gave a tracked face on a detector frame stays on the boxes
+// predict() fills in for the frames the detector skips
+
+#include <cstring>
+
+#include "Check.h"
+#include "Tracker.h"
+
+static Detection face(float x, float y) {
+    Detection d;
+    d.x1 = x;
+    d.y1 = y;
+    d.x2 = x + 80;
+    d.y2 = y + 100;
+    d.score = 0.9f;
+    d.label = "face";
+    return d;
+}
+
+int main() {
+
+    Tracker tracker;
+    Detections detections;
+    detections.push_back(face(100, 50));
+    detections.push_back(face(400, 60));
+    tracker.update(detections);
+    int aliceTrack = detections[0].trackId;
+    CHECK(aliceTrack >= 0 && detections[1].trackId != aliceTrack);
+
+    // What the recognizer does to the detector's frame, after the tracker has seen it
+    detections[0].name = "alice";
+    detections[0].matchScore = 0.7f;
+    detections[0].hasEmbedding = true;
+    for (int k = 0; k < kEmbeddingSize; k++) detections[0].embedding[k] = k == 0 ? 1.f : 0.f;
+    tracker.annotate(detections);
+
+    for (int frame = 0; frame < 3; frame++) {
+        Detections tracked;
+        tracker.predict(tracked);
+        CHECK(tracked.size() == 2);
+        const Detection* alice = nullptr;
+        const Detection* other = nullptr;
+        for (const Detection& d : tracked) (d.trackId == aliceTrack ? alice : other) = &d;
+        CHECK(alice && other);
+        CHECK(alice->name && strcmp(alice->name, "alice") == 0);
+        CHECK(alice->matchScore == 0.7f);
+        CHECK(alice->hasEmbedding && alice->embedding[0] == 1.f);
+        CHECK(other->name == nullptr);
+    }
+
+    // The next detector frame continues the track; its name comes from recognition again
+    detections.clear();
+    detections.push_back(face(104, 52));
+    tracker.update(detections);
+    CHECK(detections[0].trackId == aliceTrack);
+    detections[0].name = "alice";
+    tracker.annotate(detections);
+    Detections tracked;
+    tracker.predict(tracked);
+    CHECK(tracked.size() == 1 && tracked[0].name && strcmp(tracked[0].name, "alice") == 0);
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+// The YUV 4:2:0 kernels against OpenCV on synthetic camera frames with padded strides:
+// YuvTensorResizer against cv::cvtColor then cv::resize, stretched and letterboxed, in RGB and
+// BGR, and YuvPlanes::toBgr on planes that aren't laid out back to back
+
+#include <cstring>
+#include <stdio.h>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "Check.h"
+#include "Preprocess.h"
+
+// The resize kernels round in Q7 where OpenCV rounds in its own fixed point
+static const double kMaxDiff = 12;
+static const double kMeanDiff = 1.5;
+
+// A BGR frame as a camera would deliver it in YUV420: planes back to back, rows padded to stride
+struct CameraYuv {
+    std::vector<uint8_t> buffer;
+    YuvPlanes planes;
+};
+
+static CameraYuv toCameraYuv(const cv::Mat& bgr, int stride) {
+    cv::Mat i420;
+    cv::cvtColor(bgr, i420, cv::COLOR_BGR2YUV_I420);
+    int width = bgr.cols, height = bgr.rows;
+    CameraYuv yuv;
+    yuv.buffer.assign((size_t)stride * height * 3 / 2, 0);
+    const uint8_t* src = i420.ptr<uint8_t>(0);
+    uint8_t* y = yuv.buffer.data();
+    uint8_t* u = y + (size_t)stride * height;
+    uint8_t* v = u + (size_t)(stride / 2) * (height / 2);
+    for (int r = 0; r < height; r++) memcpy(y + (size_t)r * stride, src + (size_t)r * width, width);
+    src += (size_t)width * height;
+    for (int r = 0; r < height / 2; r++) memcpy(u + (size_t)r * (stride / 2), src + (size_t)r * (width / 2), width / 2);
+    src += (size_t)(width / 2) * (height / 2);
+    for (int r = 0; r < height / 2; r++) memcpy(v + (size_t)r * (stride / 2), src + (size_t)r * (width / 2), width / 2);
+    yuv.planes.y = y;
+    yuv.planes.u = u;
+    yuv.planes.v = v;
+    yuv.planes.width = width;
+    yuv.planes.height = height;
+    yuv.planes.yStride = stride;
+    yuv.planes.uvStride = stride / 2;
+    return yuv;
+}
+
+// Smooth colour gradients with sensor-like noise, so both flat areas and edges are covered
+static cv::Mat syntheticFrame(int width, int height) {
+    cv::Mat coarse(height / 16 + 1, width / 16 + 1, CV_8UC3);
+    cv::randu(coarse, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat frame, noise(height, width, CV_8UC3);
+    cv::resize(coarse, frame, cv::Size(width, height));
+    cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(16));
+    cv::add(frame, noise, frame);
+    return frame;
+}
+
+static void checkResize(const CameraYuv& yuv, int dstWidth, int dstHeight, bool swapRB, bool letterbox) {
+    YuvTensorResizer resizer;
+    std::vector<uint8_t> tensor((size_t)dstWidth * dstHeight * 3);
+    Letterbox box = resizer.run(yuv.planes, tensor.data(), dstWidth, dstHeight, swapRB, letterbox);
+
+    // OpenCV converting the whole frame, then resizing it into the same place
+    const YuvPlanes& p = yuv.planes;
+    cv::Mat full, inner;
+    cv::cvtColor(cv::Mat(p.height * 3 / 2, p.width, CV_8UC1, (void*)p.y, p.yStride), full, swapRB ? cv::COLOR_YUV2RGB_I420 : cv::COLOR_YUV2BGR_I420);
+    cv::Size innerSize(std::lround(p.width * box.scaleX), std::lround(p.height * box.scaleY));
+    cv::resize(full, inner, innerSize);
+    cv::Mat expected = cv::Mat::zeros(dstHeight, dstWidth, CV_8UC3);
+    cv::Mat area = expected(cv::Rect(box.padX, box.padY, innerSize.width, innerSize.height));
+    inner.copyTo(area);
+
+    cv::Mat diff;
+    cv::absdiff(expected, cv::Mat(dstHeight, dstWidth, CV_8UC3, tensor.data()), diff);
+    double maxDiff;
+    cv::minMaxLoc(diff.reshape(1), nullptr, &maxDiff);
+    cv::Scalar means = cv::mean(diff);
+    double meanDiff = (means[0] + means[1] + means[2]) / 3;
+    if (maxDiff > kMaxDiff || meanDiff > kMeanDiff) {
+        fprintf(stderr, "%dx%d stride %d -> %dx%d%s%s: max diff %.0f, mean diff %.3f\n", p.width, p.height, p.yStride,
+                dstWidth, dstHeight, swapRB ? " rgb" : " bgr", letterbox ? " letterboxed" : "", maxDiff, meanDiff);
+    }
+    CHECK(maxDiff <= kMaxDiff);
+    CHECK(meanDiff <= kMeanDiff);
+}
+
+int main() {
+
+    cv::setRNGSeed(17);
+    struct Case { int width, height, pad; };
+    // Camera sizes with and without row padding, and one that isn't a multiple of 16
+    const Case cases[] = {{640, 480, 64}, {1296, 972, 0}, {1920, 1080, 128}, {330, 250, 6}};
+    for (const Case& c : cases) {
+        cv::Mat frame = syntheticFrame(c.width, c.height);
+        CameraYuv yuv = toCameraYuv(frame, c.width + c.pad);
+        for (int swapRB = 0; swapRB < 2; swapRB++) {
+            for (int letterbox = 0; letterbox < 2; letterbox++) {
+                checkResize(yuv, 300, 300, swapRB, letterbox);
+                checkResize(yuv, 320, 240, swapRB, letterbox);
+            }
+        }
+        // Upscaling, as a small crop going into a larger model input would
+        checkResize(yuv, c.width * 5 / 4 / 2 * 2, c.height * 5 / 4 / 2 * 2, true, false);
+
+        // toBgr takes the fast path on the camera layout, and gathers planes kept apart
+        cv::Mat expected, contiguous, scattered;
+        cv::cvtColor(cv::Mat(c.height * 3 / 2, c.width, CV_8UC1, yuv.buffer.data(), yuv.planes.yStride), expected, cv::COLOR_YUV2BGR_I420);
+        yuv.planes.toBgr(contiguous);
+        std::vector<uint8_t> u(yuv.planes.u, yuv.planes.u + (size_t)yuv.planes.uvStride * (c.height / 2));
+        std::vector<uint8_t> v(yuv.planes.v, yuv.planes.v + (size_t)yuv.planes.uvStride * (c.height / 2));
+        YuvPlanes apart = yuv.planes;
+        apart.u = u.data();
+        apart.v = v.data();
+        apart.toBgr(scattered);
+        CHECK(contiguous.size() == expected.size() && scattered.size() == expected.size());
+        CHECK(cv::norm(contiguous, expected, cv::NORM_INF) == 0);
+        CHECK(cv::norm(scattered, expected, cv::NORM_INF) == 0);
+    }
+
+    return 0;
+}